@@ -36,7 +36,11 @@
 #include FT_FREETYPE_H
 #include <epoxy/gl.h>
 
+#include "state.h"
+#include "ktx.h"
+#include "shader.h"
 #include "image.h"
+#include "ring.h"
 #include "text.h"
 #include "draw.h"
 
@@ -91,6 +95,11 @@ const GLfloat red[4] = { 1.f, 0.f, 0.f, 1.f };
 const GLfloat green[4] = { 0.f, 1.f, 0.f, 1.f };
 const GLfloat blew[4] = { 0.f, 0.f, 1.f, 1.f };
 
+const char *charset =
+  " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`"
+  "abcdefghijklmnopqrstuvwxyz{|}~";
+///< Characters preloaded in the glyph atlas.
+
 const GLfloat identity[16] = {
   1.f, 0.f, 0.f, 0.f,
   0.f, 1.f, 0.f, 0.f,
@@ -110,8 +119,9 @@ const GLfloat vertex2_data[] = {
   0.0f, -1.0f, 0.5f
 };
 
-GLuint fragment_shader_id;
-GLuint vertex_shader_id;
+ShaderProgram *program;
+ShaderProgram *submitted[2];
+///< Image and text programs submitted at init to compile them in parallel.
 GLuint program_id;
 GLint color_id;
 GLint matrix_id;
@@ -120,8 +130,9 @@ GLuint vertex2_array_id;
 GLuint vertex1_buffer;
 GLuint vertex2_buffer;
 
-Image *logo;                    ///< Logo data.
+ImageLoad *logo;                ///< Logo data, decoded on a worker thread.
 Text text[1];                   ///< Text data.
+TextObject *label;              ///< Retained label.
 
 unsigned int window_width = MINIMUM_WIDTH;
 unsigned int window_height = MINIMUM_HEIGHT;
@@ -130,9 +141,11 @@ unsigned int window_height = MINIMUM_HEIGHT;
 int
 draw_init ()
 {
+  const char *attributes[] = { NULL };
+  const char *uniforms[] = { "matrix", "color", NULL };
+  ShaderStats stats;
   const char **fragment_shader_source, **vertex_shader_source;
   const char *error_message;
-  GLint result;
   GLuint nfragment, nvertex;
   const GLubyte *version;
 
@@ -140,31 +153,25 @@ draw_init ()
   version = glGetString (GL_VERSION);
   printf ("OpenGL=%s\n", version);
 
-  // Opening logo
-  logo = image_new ("logo.png");
-  if (!logo)
-    {
-      error_message = "Unable to open the logo";
-      goto exit_on_error;
-    }
+  // Opening logo, the window renders while it is decoded
+  logo = image_load_new ("logo.png", NULL, NULL);
 
   // Select shaders
-  if (strstr ((const char *) version, "OpenGL ES"))
+  switch (shader_dialect ())
     {
+    case SHADER_DIALECT_ES:
       nfragment = NFRAGMENT_ES;
       fragment_shader_source = fragment_shader_source_es;
       nvertex = NVERTEX_ES;
       vertex_shader_source = vertex_shader_source_es;
-    }
-  else if (epoxy_gl_version () >= 33)
-    {
+      break;
+    case SHADER_DIALECT_V3:
       nfragment = NFRAGMENT_V3;
       fragment_shader_source = fragment_shader_source_v3;
       nvertex = NVERTEX_V3;
       vertex_shader_source = vertex_shader_source_v3;
-    }
-  else
-    {
+      break;
+    default:
       nfragment = NFRAGMENT_V2;
       fragment_shader_source = fragment_shader_source_v2;
       nvertex = NVERTEX_V2;
@@ -172,95 +179,68 @@ draw_init ()
     }
 
   // Enable
-  glEnable (GL_DEPTH_TEST);
-
-  // Fragment shacer
-  fragment_shader_id = glCreateShader (GL_FRAGMENT_SHADER);
-  glShaderSource (fragment_shader_id, nfragment, fragment_shader_source, NULL);
-  glCompileShader (fragment_shader_id);
-  glGetShaderiv (fragment_shader_id, GL_COMPILE_STATUS, &result);
-  if (!result)
-    {
-      error_message = "Unable to compile fragment shader";
-      goto exit_on_error;
-    }
-
-  // Vertex shader
-  vertex_shader_id = glCreateShader (GL_VERTEX_SHADER);
-  glShaderSource (vertex_shader_id, nvertex, vertex_shader_source, NULL);
-  glCompileShader (vertex_shader_id);
-  glGetShaderiv (vertex_shader_id, GL_COMPILE_STATUS, &result);
-  if (!result)
-    {
-      error_message = "Unable to compile vertex shader";
-      goto exit_on_error;
-    }
-
-  // Program
-  program_id = glCreateProgram ();
-  glAttachShader (program_id, fragment_shader_id);
-  glAttachShader (program_id, vertex_shader_id);
-  glLinkProgram (program_id);
-  glDetachShader (program_id, vertex_shader_id);
-  glDetachShader (program_id, fragment_shader_id);
-  glDeleteShader (fragment_shader_id);
-  glDeleteShader (vertex_shader_id);
-  glGetProgramiv (program_id, GL_LINK_STATUS, &result);
-  if (!result)
-    {
-      error_message = "Unable to link shader";
-      goto exit_on_error;
-    }
-
-  // Position matrix
-  matrix_id = glGetUniformLocation (program_id, "matrix");
-  if (matrix_id == -1)
+  state_reset ();
+  state_enable (GL_DEPTH_TEST, 1);
+
+  // Programs, all of them are submitted before waiting for any, so the
+  // driver can compile them in parallel. The vertex attribute is the first
+  // one
+  program = shader_program_submit ("draw", vertex_shader_source, nvertex,
+                                   fragment_shader_source, nfragment,
+                                   attributes, uniforms);
+  submitted[0] = image_program_submit ();
+  submitted[1] = text_program_submit (TEXT_MODE_BITMAP);
+  if (!shader_program_wait (program))
     {
-      error_message = "could not bind matrix";
-      goto exit_on_error;
-    }
-  color_id = glGetUniformLocation (program_id, "color");
-  if (color_id == -1)
-    {
-      error_message = "could not bind color";
+      error_message = "Unable to get the program";
       goto exit_on_error;
     }
+  program_id = program->id;
+  matrix_id = program->uniforms[0];
+  color_id = program->uniforms[1];
 
   // 1st vertex array
   glGenVertexArrays (1, &vertex1_array_id);
-  glBindVertexArray (vertex1_array_id);
+  state_bind_vertex_array (vertex1_array_id);
   glGenBuffers (1, &vertex1_buffer);
-  glBindBuffer (GL_ARRAY_BUFFER, vertex1_buffer);
+  state_bind_buffer (GL_ARRAY_BUFFER, vertex1_buffer);
   glBufferData (GL_ARRAY_BUFFER, sizeof (vertex1_data), vertex1_data,
                 GL_STATIC_DRAW);
 
   // 2nd vertex array
   glGenVertexArrays (1, &vertex2_array_id);
-  glBindVertexArray (vertex2_array_id);
+  state_bind_vertex_array (vertex2_array_id);
   glGenBuffers (1, &vertex2_buffer);
-  glBindBuffer (GL_ARRAY_BUFFER, vertex2_buffer);
+  state_bind_buffer (GL_ARRAY_BUFFER, vertex2_buffer);
   glBufferData (GL_ARRAY_BUFFER, sizeof (vertex2_data), vertex2_data,
                 GL_STATIC_DRAW);
 
-  // init logo
-  if (!image_init (logo))
-    {
-      error_message = "Unable to init the logo";
-      goto exit_on_error;
-    }
-
   // init text
   if (!text_init (text))
     {
       error_message = "Unable to init the text drawing";
       goto exit_on_error;
     }
+  text_cache_load (text, charset);
+  label = text_object_new (text, "Prueba", 0.6, -0.1, 0.01, 0.01, blew);
+
+  // Shader compile and cache times
+  shader_stats (&stats);
+  printf ("Shaders: %u compiled (%g s each), %u from cache (%g s each)\n",
+          stats.compiles, stats.compile_time, stats.cache_hits,
+          stats.cache_time);
 
   // return on success
   return 1;
 
 exit_on_error:
 
+  // free memory on error
+  shader_program_release (submitted[1]);
+  shader_program_release (submitted[0]);
+  shader_program_release (program);
+  submitted[0] = submitted[1] = program = NULL;
+
   // return on error
   fprintf (stderr, "ERROR: %s\n", error_message);
   return 0;
@@ -270,47 +250,65 @@ exit_on_error:
 void
 draw_render ()
 {
+  // start the GL state counters of the frame
+  state_frame ();
+
   // clear screen
   glClearColor (0., 0., 0., 1.);
   glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   // 1st triangle
-  glUseProgram (program_id);
-  glUniformMatrix4fv (matrix_id, 1, GL_FALSE, identity);
-  glUniform3fv (color_id, 1, red);
-  glEnableVertexAttribArray (0);
-  glBindBuffer (GL_ARRAY_BUFFER, vertex1_buffer);
+  state_use_program (program_id);
+  state_uniform_matrix4fv (matrix_id, identity);
+  state_uniform3fv (color_id, red);
+  state_attributes (STATE_ATTRIBUTE (0));
+  state_bind_buffer (GL_ARRAY_BUFFER, vertex1_buffer);
   glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
   glDrawArrays (GL_TRIANGLES, 0, 3);
-  glDisableVertexAttribArray (0);
 
   // 2nd triangle
-  glUniform3fv (color_id, 1, green);
-  glEnableVertexAttribArray (0);
-  glBindBuffer (GL_ARRAY_BUFFER, vertex2_buffer);
+  state_uniform3fv (color_id, green);
+  state_attributes (STATE_ATTRIBUTE (0));
+  state_bind_buffer (GL_ARRAY_BUFFER, vertex2_buffer);
   glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
   glDrawArrays (GL_TRIANGLES, 0, 3);
-  glDisableVertexAttribArray (0);
 
-  glEnable (GL_BLEND);
-  glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  // Draw the logo
-  image_draw (logo, window_width, window_height);
+  state_enable (GL_BLEND, 1);
+  state_blend_func (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  // Draw the logo when it is ready
+  if (image_load_poll (logo) == IMAGE_LOAD_READY)
+    image_draw (logo->image, window_width, window_height);
   // Draw the text
-  text_draw (text, "Prueba", 0.6, -0.1, 0.01, 0.01, blew);
-  glDisable (GL_BLEND);
+  text_object_draw (text, label);
+  state_enable (GL_BLEND, 0);
 
   // Swap buffers
   glFlush ();
 }
 
+// Check if images are loading
+int
+draw_loading ()
+{
+  return g_atomic_int_get (&logo->state) < IMAGE_LOAD_READY;
+}
+
 // Free draw
 void
 draw_free ()
 {
+  StateStats state;
+  state_frame ();
+  state_stats (&state);
+  printf ("GL state: %u calls issued, %u redundant calls skipped in the last "
+          "frame\n", state.issued, state.skipped);
+  text_object_destroy (label);
   text_destroy (text);
-  image_destroy (logo);
-  glDeleteBuffers (1, &vertex1_buffer);
-  glDeleteBuffers (1, &vertex2_buffer);
-  glDeleteProgram (program_id);
+  image_load_destroy (logo);
+  image_load_finish ();
+  state_delete_buffers (1, &vertex1_buffer);
+  state_delete_buffers (1, &vertex2_buffer);
+  shader_program_release (submitted[1]);
+  shader_program_release (submitted[0]);
+  shader_program_release (program);
 }
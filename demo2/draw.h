@@ -4,11 +4,12 @@
 // Window minimum size
 #define MINIMUM_WIDTH 320
 #define MINIMUM_HEIGHT 240
-extern Image *logo;
+extern ImageLoad *logo;
 extern unsigned int window_width, window_height;
 
 int draw_init ();
 void draw_render ();
+int draw_loading ();
 void draw_free ();
 
 #endif
@@ -37,7 +37,10 @@
 #include <epoxy/gl.h>
 #include <gtk/gtk.h>
 
+#include "ktx.h"
+#include "shader.h"
 #include "image.h"
+#include "ring.h"
 #include "text.h"
 #include "draw.h"
 
@@ -47,6 +50,8 @@
 #define TITLE "GTK3"
 #endif
 ///< windows title.
+#define GLAREA_LOADING_TIME 40
+///< Time in milliseconds between renders while images are loading.
 
 // Windows
 GtkWindow *gtk_window, *main_window;
@@ -79,6 +84,18 @@ glarea_resize (GtkGLArea * widget __attribute__((unused)),
 
 }
 
+/**
+ * GTK function to render while images are loading.
+ *
+ * \return TRUE to continue, FALSE to stop.
+ */
+static gboolean
+glarea_loading ()
+{
+  gtk_gl_area_queue_render (gtk_draw);
+  return draw_loading ();
+}
+
 /**
  * GTK realize function.
  */
@@ -92,6 +109,7 @@ glarea_realize ()
 
   gtk_gl_area_make_current (gtk_draw);
   draw_init ();
+  g_timeout_add (GLAREA_LOADING_TIME, (GSourceFunc) glarea_loading, NULL);
 
 #if DEBUG
   fprintf (stderr, "glarea_realize: end\n");
@@ -37,7 +37,10 @@
 #include <GLFW/glfw3.h>
 #include <gtk/gtk.h>
 
+#include "ktx.h"
+#include "shader.h"
 #include "image.h"
+#include "ring.h"
 #include "text.h"
 #include "draw.h"
 
@@ -37,7 +37,10 @@
 #include <SDL.h>
 #include <gtk/gtk.h>
 
+#include "ktx.h"
+#include "shader.h"
 #include "image.h"
+#include "ring.h"
 #include "text.h"
 #include "draw.h"
 
@@ -47,6 +50,8 @@
 #define TITLE "GTK3"
 #endif
 ///< windows title.
+#define SDL_LOADING_TIME 40
+///< Time in milliseconds between renders while images are loading.
 
 // Windows
 GtkWindow *gtk_window;
@@ -183,7 +188,15 @@ sdl_loop ()
         gdk_gl_context_make_current (gl_context);
       while (g_main_context_pending (context))
         g_main_context_iteration (context, 0);
-      while (SDL_PollEvent (event))
+
+      // Waiting for events, rendering anyway while images are loading
+      if (!SDL_WaitEventTimeout (event, SDL_LOADING_TIME))
+        {
+          if (draw_loading ())
+            sdl_render ();
+          continue;
+        }
+      do
         {
           switch (event->type)
             {
@@ -199,6 +212,7 @@ sdl_loop ()
             }
           sdl_render ();
         }
+      while (SDL_PollEvent (event));
     }
 
 end:
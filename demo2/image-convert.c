@@ -0,0 +1,109 @@
+/**
+ * \file image-convert.c
+ * \brief Source file to convert images between the PNG, QOI and raw RGBA
+ *   formats.
+ * \author Javier Burguete Tolosa.
+ * \date 2022-2025.
+ * \license BSD-2-Clause.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <epoxy/gl.h>
+
+#include "ktx.h"
+#include "shader.h"
+#include "image.h"
+
+/**
+ * Function to get the image file format from the extension of a file name.
+ *
+ * \return file format (ImageFormat), -1 if unknown.
+ */
+static int
+convert_format (const char *name)       ///< File name.
+{
+  const char *extension;
+  extension = strrchr (name, '.');
+  if (!extension)
+    return -1;
+  if (!g_ascii_strcasecmp (extension, ".png"))
+    return IMAGE_FORMAT_PNG;
+  if (!g_ascii_strcasecmp (extension, ".qoi"))
+    return IMAGE_FORMAT_QOI;
+  if (!g_ascii_strcasecmp (extension, ".raw"))
+    return IMAGE_FORMAT_RAW;
+  return -1;
+}
+
+/**
+ * Main function to convert an image file to the format of the output file
+ *   extension: PNG (.png), QOI (.qoi) or raw RGBA (.raw).
+ *
+ * \return 0 on success, error code on error.
+ */
+int
+main (int argn,                 ///< number of command-line arguments.
+      char **argc)              ///< array of command-line arguments.
+{
+  Image *image;
+  const char *error_message;
+  int format;
+
+  if (argn != 3)
+    {
+      printf ("The syntax is:\n./image-convert input output\n"
+              "with output extension .png, .qoi or .raw\n");
+      return 1;
+    }
+  format = convert_format (argc[2]);
+  if (format < 0)
+    {
+      error_message = "unknown output format";
+      goto exit_on_error;
+    }
+  image_set_cache (0);
+  image = image_new (argc[1]);
+  if (!image)
+    {
+      error_message = "unable to read the input image";
+      goto exit_on_error;
+    }
+  if (!image_save (image, argc[2], format))
+    {
+      image_free (image);
+      error_message = "unable to write the output image";
+      goto exit_on_error;
+    }
+  image_free (image);
+  return 0;
+
+exit_on_error:
+  printf ("ERROR! Image converter: %s\n", error_message);
+  return 2;
+}
@@ -4,18 +4,76 @@
 #include <stdio.h>
 #include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <png.h>
 #include <epoxy/gl.h>
 
+#include "state.h"
+#include "ktx.h"
+#include "shader.h"
 #include "image.h"
 
-const char *fs_texture_source_v3 =
+/**
+ * \struct ImageRawHeader
+ * \brief A struct to define the header of a raw image file, also used as
+ *   image cache file. It is followed by the RGBA pixels in the OpenGL order.
+ */
+typedef struct
+{
+  char magic[8];                ///< File identifier.
+  guint32 version;              ///< Raw format version.
+  guint32 width;                ///< Width.
+  guint32 height;               ///< Height.
+  guint32 format;               ///< Pixels format.
+} ImageRawHeader;
+
+static const char image_raw_magic[8] = "GOGLIMAG";
+///< Identifier of the raw image files.
+
+#define IMAGE_QOI_HEADER 14     ///< Size in bytes of the QOI header.
+#define IMAGE_QOI_END 8         ///< Size in bytes of the QOI end marker.
+
+/**
+ * \struct ImagePbo
+ * \brief A struct to define a pixel buffer object to upload images.
+ */
+typedef struct
+{
+  GLsync fence;                 ///< Fence of the last copy to a texture.
+  ImageLoad *load;              ///< Image load decoding in the buffer.
+  GLuint buffer;                ///< Pixel buffer object.
+} ImagePbo;
+
+static GThreadPool *image_pool = NULL;
+///< Pool of threads decoding images.
+static ImagePbo image_pbo[IMAGE_PBOS];
+///< Pixel buffer objects to upload images.
+static int image_pbo_mode = -1;
+///< 1 if pixel buffer objects are available, 0 if not, -1 if not checked.
+static int image_pbo_map_range = 0;
+///< 1 if glMapBufferRange is available.
+static int image_pbo_sync = 0;
+///< 1 if fences are available.
+static int image_cache = 1;
+///< 1 to use the decoded image cache files.
+static int image_texture_mode = -1;
+///< 1 if the texture functions are checked, -1 if not checked.
+static int image_texture_storage = 0;
+///< 1 if immutable texture storage is available.
+static int image_texture_mipmap = 0;
+///< 1 if glGenerateMipmap is available.
+static int image_texture_npot = 0;
+///< 1 if mipmaps of non power of two textures are available.
+static GLfloat image_texture_anisotropy = 1.f;
+///< Maximum anisotropy, 1 if anisotropic filtering is not available.
+
+static const char *fs_texture_source_v3 =
   "#version 330 core\n"
   "in vec2 t_position;"
   "out vec4 fcolor;"
   "uniform sampler2D texture_image;"
   "void main()" "{fcolor=texture(texture_image,t_position);}";
-const char *vs_texture_source_v3 =
+static const char *vs_texture_source_v3 =
   "#version 330 core\n"
   "in vec2 position;"
   "in vec2 texture_position;"
@@ -24,12 +82,12 @@ const char *vs_texture_source_v3 =
   "void main()"
   "{gl_Position=matrix*vec4(position,0.,1.);"
   "t_position=texture_position;}";
-const char *fs_texture_source_v2 =
+static const char *fs_texture_source_v2 =
   "#version 120\n"
   "varying vec2 t_position;"
   "uniform sampler2D texture_image;"
   "void main()" "{gl_FragColor=texture2D(texture_image,t_position);}";
-const char *vs_texture_source_v2 =
+static const char *vs_texture_source_v2 =
   "#version 120\n"
   "attribute vec2 position;"
   "attribute vec2 texture_position;"
@@ -38,13 +96,13 @@ const char *vs_texture_source_v2 =
   "void main()"
   "{gl_Position=matrix*vec4(position,0.,1.);"
   "t_position=texture_position;}";
-const char *fs_texture_source_es =
+static const char *fs_texture_source_es =
   "#version 100\n"
   "precision mediump float;"
   "varying vec2 t_position;"
   "uniform sampler2D texture_image;"
   "void main()" "{gl_FragColor=texture2D(texture_image,t_position);}";
-const char *vs_texture_source_es =
+static const char *vs_texture_source_es =
   "#version 100\n"
   "attribute vec2 position;"
   "attribute vec2 texture_position;"
@@ -55,12 +113,752 @@ const char *vs_texture_source_es =
   "t_position=texture_position;}";
 
 /**
- * Function to read the image on a PNG file.
+ * \struct ImageReader
+ * \brief A struct to define an image file decoded row by row or mapped.
+ */
+typedef struct
+{
+  png_struct *png;              ///< PNG read struct.
+  png_info *info;               ///< PNG info struct.
+  FILE *file;                   ///< PNG file.
+  GMappedFile *mapped;          ///< Raw or cache file mapping, NULL if
+  ///< decoding.
+  GMappedFile *source;          ///< QOI file mapping.
+  Ktx *ktx;                     ///< KTX2 compressed texture.
+  char *cache;                  ///< Cache file name to write after decoding,
+  ///< NULL for none.
+  unsigned int format;          ///< File format (ImageFormat).
+  unsigned int width;           ///< Width.
+  unsigned int height;          ///< Height.
+  unsigned int row_bytes;       ///< Size in bytes of a row.
+  unsigned int passes;          ///< Number of interlace passes.
+} ImageReader;
+
+/**
+ * Function to get the cache file name of an image. It is keyed by the
+ *   source file path, size and modification time.
  *
- * \return pointer to the Image struct data on success, NULL on error.
+ * \return cache file name, it has to be freed with g_free, NULL on error.
  */
-Image *
-image_new (char *name)          ///< Image PNG file name.
+static char *
+image_cache_name (const char *name)     ///< Image file name.
+{
+  GStatBuf stat;
+  char *path, *key, *hash, *file, *file_name;
+  if (g_stat (name, &stat))
+    return NULL;
+  path = g_canonicalize_filename (name, NULL);
+  key = g_strdup_printf ("%s|%" G_GINT64_FORMAT "|%" G_GINT64_FORMAT, path,
+                         (gint64) stat.st_size, (gint64) stat.st_mtime);
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA256, key, -1);
+  file_name = g_strdup_printf ("image-%s.raw", hash);
+  file = g_build_filename (g_get_user_cache_dir (), "gtkopengl", file_name,
+                           NULL);
+  g_free (file_name);
+  g_free (hash);
+  g_free (key);
+  g_free (path);
+  return file;
+}
+
+/**
+ * Function to map a raw image file.
+ *
+ * \return file mapping on success, NULL on error.
+ */
+static GMappedFile *
+image_raw_map (const char *file,        ///< Raw file name.
+               unsigned int *width,     ///< Width.
+               unsigned int *height)    ///< Height.
+{
+  GMappedFile *mapped;
+  const ImageRawHeader *header;
+  gsize size;
+
+  mapped = g_mapped_file_new (file, FALSE, NULL);
+  if (!mapped)
+    return NULL;
+  size = g_mapped_file_get_length (mapped);
+  header = (const ImageRawHeader *) g_mapped_file_get_contents (mapped);
+  if (size < sizeof (ImageRawHeader)
+      || memcmp (header->magic, image_raw_magic, sizeof (header->magic))
+      || header->version != IMAGE_RAW_VERSION
+      || header->format != GL_RGBA
+      || size != sizeof (ImageRawHeader)
+      + 4 * (gsize) header->width * header->height)
+    {
+      g_mapped_file_unref (mapped);
+      return NULL;
+    }
+  *width = header->width;
+  *height = header->height;
+  return mapped;
+}
+
+/**
+ * Function to get the pixels of a raw image file mapping.
+ *
+ * \return pointer to the pixels.
+ */
+static inline GLubyte *
+image_raw_pixels (GMappedFile * mapped) ///< Raw file mapping.
+{
+  return (GLubyte *) g_mapped_file_get_contents (mapped)
+    + sizeof (ImageRawHeader);
+}
+
+/**
+ * Function to write a file in a temporary file renamed at the end, so a file
+ *   is never read half written.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+image_file_write (const char *file,     ///< File name.
+                  const void *header,   ///< Header.
+                  gsize header_size,    ///< Header size in bytes.
+                  const void *data,     ///< Data.
+                  gsize size)           ///< Data size in bytes.
+{
+  FILE *f;
+  char *dir, *tmp;
+  int ok;
+
+  dir = g_path_get_dirname (file);
+  g_mkdir_with_parents (dir, 0755);
+  tmp = g_strdup_printf ("%s.%p.tmp", file, (void *) &f);
+  f = g_fopen (tmp, "wb");
+  ok = f && fwrite (header, 1, header_size, f) == header_size
+    && fwrite (data, 1, size, f) == size;
+  if (f && fclose (f))
+    ok = 0;
+  if (!ok || g_rename (tmp, file))
+    {
+      printf ("ERROR! Image: unable to write %s\n", file);
+      g_unlink (tmp);
+      ok = 0;
+    }
+  g_free (tmp);
+  g_free (dir);
+  return ok;
+}
+
+/**
+ * Function to write a raw image file.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+image_raw_write (const char *file,      ///< Raw file name.
+                 unsigned int width,    ///< Width.
+                 unsigned int height,   ///< Height.
+                 const GLubyte * pixels)        ///< Pixels in the OpenGL order.
+{
+  ImageRawHeader header;
+  memcpy (header.magic, image_raw_magic, sizeof (header.magic));
+  header.version = IMAGE_RAW_VERSION;
+  header.width = width;
+  header.height = height;
+  header.format = GL_RGBA;
+  return image_file_write (file, &header, sizeof (header), pixels,
+                           4 * (gsize) width * height);
+}
+
+/**
+ * Function to read a big endian 32 bits number.
+ *
+ * \return number.
+ */
+static inline guint32
+image_qoi_read32 (const guint8 * b)     ///< Bytes.
+{
+  return ((guint32) b[0] << 24) | ((guint32) b[1] << 16)
+    | ((guint32) b[2] << 8) | b[3];
+}
+
+/**
+ * Function to write a big endian 32 bits number.
+ */
+static inline void
+image_qoi_write32 (guint8 * b,  ///< Bytes.
+                   guint32 x)   ///< Number.
+{
+  b[0] = x >> 24;
+  b[1] = x >> 16;
+  b[2] = x >> 8;
+  b[3] = x;
+}
+
+/**
+ * Function to map a QOI file and to read its header.
+ *
+ * \return file mapping on success, NULL on error.
+ */
+static GMappedFile *
+image_qoi_map (const char *file,        ///< QOI file name.
+               unsigned int *width,     ///< Width.
+               unsigned int *height)    ///< Height.
+{
+  GMappedFile *mapped;
+  const guint8 *bytes;
+  gsize size;
+
+  mapped = g_mapped_file_new (file, FALSE, NULL);
+  if (!mapped)
+    return NULL;
+  size = g_mapped_file_get_length (mapped);
+  bytes = (const guint8 *) g_mapped_file_get_contents (mapped);
+  if (size < IMAGE_QOI_HEADER + IMAGE_QOI_END
+      || memcmp (bytes, "qoif", 4) || bytes[12] < 3 || bytes[12] > 4)
+    {
+      g_mapped_file_unref (mapped);
+      return NULL;
+    }
+  *width = image_qoi_read32 (bytes + 4);
+  *height = image_qoi_read32 (bytes + 8);
+  return mapped;
+}
+
+/**
+ * Function to decode the pixels of a QOI file. The rows are decoded in their
+ *   places in the OpenGL order.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+image_qoi_decode (GMappedFile * mapped, ///< QOI file mapping.
+                  unsigned int width,   ///< Width.
+                  unsigned int height,  ///< Height.
+                  GLubyte * pixels)     ///< Pixels in the OpenGL order.
+{
+  guint8 index[64][4];
+  guint8 px[4];
+  const guint8 *bytes;
+  GLubyte *row;
+  gsize p, end;
+  unsigned int i, j, run;
+  guint8 b, vg;
+
+  bytes = (const guint8 *) g_mapped_file_get_contents (mapped);
+  end = g_mapped_file_get_length (mapped) - IMAGE_QOI_END;
+  memset (index, 0, sizeof (index));
+  px[0] = px[1] = px[2] = 0;
+  px[3] = 255;
+  p = IMAGE_QOI_HEADER;
+  run = 0;
+  for (i = 0; i < height; ++i)
+    {
+      row = pixels + 4 * (gsize) width * (height - 1 - i);
+      for (j = 0; j < width; ++j, row += 4)
+        {
+          if (run)
+            --run;
+          else if (p < end)
+            {
+              b = bytes[p++];
+              if (b == 0xfe)
+                {
+                  if (p + 3 > end)
+                    return 0;
+                  memcpy (px, bytes + p, 3);
+                  p += 3;
+                }
+              else if (b == 0xff)
+                {
+                  if (p + 4 > end)
+                    return 0;
+                  memcpy (px, bytes + p, 4);
+                  p += 4;
+                }
+              else
+                switch (b & 0xc0)
+                  {
+                  case 0x00:
+                    memcpy (px, index[b], 4);
+                    break;
+                  case 0x40:
+                    px[0] += ((b >> 4) & 3) - 2;
+                    px[1] += ((b >> 2) & 3) - 2;
+                    px[2] += (b & 3) - 2;
+                    break;
+                  case 0x80:
+                    if (p >= end)
+                      return 0;
+                    vg = (b & 0x3f) - 32;
+                    px[0] += vg - 8 + ((bytes[p] >> 4) & 0x0f);
+                    px[1] += vg;
+                    px[2] += vg - 8 + (bytes[p] & 0x0f);
+                    ++p;
+                    break;
+                  default:
+                    run = b & 0x3f;
+                  }
+              memcpy (index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11)
+                            & 63], px, 4);
+            }
+          else
+            return 0;
+          memcpy (row, px, 4);
+        }
+    }
+  return 1;
+}
+
+/**
+ * Function to write a QOI file.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+image_qoi_write (const char *file,      ///< QOI file name.
+                 unsigned int width,    ///< Width.
+                 unsigned int height,   ///< Height.
+                 const GLubyte * pixels)        ///< Pixels in the OpenGL order.
+{
+  static const guint8 qoi_end[IMAGE_QOI_END] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  guint8 header[IMAGE_QOI_HEADER];
+  guint8 index[64][4];
+  guint8 prev[4];
+  const GLubyte *px;
+  guint8 *data, *d;
+  gsize size;
+  unsigned int i, j, h, run;
+  int ok;
+  signed char vr, vg, vb, vg_r, vg_b;
+
+  // The worst case is 5 bytes per pixel
+  size = 5 * (gsize) width * height + IMAGE_QOI_END;
+  data = d = (guint8 *) g_malloc (size);
+  memset (index, 0, sizeof (index));
+  prev[0] = prev[1] = prev[2] = 0;
+  prev[3] = 255;
+  run = 0;
+  for (i = 0; i < height; ++i)
+    {
+      px = pixels + 4 * (gsize) width * (height - 1 - i);
+      for (j = 0; j < width; ++j, px += 4)
+        {
+          if (!memcmp (px, prev, 4))
+            {
+              if (++run == 62)
+                {
+                  *d++ = 0xc0 | (run - 1);
+                  run = 0;
+                }
+              continue;
+            }
+          if (run)
+            {
+              *d++ = 0xc0 | (run - 1);
+              run = 0;
+            }
+          h = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) & 63;
+          if (!memcmp (index[h], px, 4))
+            *d++ = h;
+          else
+            {
+              memcpy (index[h], px, 4);
+              if (px[3] == prev[3])
+                {
+                  vr = px[0] - prev[0];
+                  vg = px[1] - prev[1];
+                  vb = px[2] - prev[2];
+                  vg_r = vr - vg;
+                  vg_b = vb - vg;
+                  if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3
+                      && vb < 2)
+                    *d++ = 0x40 | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2);
+                  else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32
+                           && vg_b > -9 && vg_b < 8)
+                    {
+                      *d++ = 0x80 | (vg + 32);
+                      *d++ = ((vg_r + 8) << 4) | (vg_b + 8);
+                    }
+                  else
+                    {
+                      *d++ = 0xfe;
+                      memcpy (d, px, 3);
+                      d += 3;
+                    }
+                }
+              else
+                {
+                  *d++ = 0xff;
+                  memcpy (d, px, 4);
+                  d += 4;
+                }
+            }
+          memcpy (prev, px, 4);
+        }
+    }
+  if (run)
+    *d++ = 0xc0 | (run - 1);
+  memcpy (d, qoi_end, IMAGE_QOI_END);
+  d += IMAGE_QOI_END;
+
+  memcpy (header, "qoif", 4);
+  image_qoi_write32 (header + 4, width);
+  image_qoi_write32 (header + 8, height);
+  header[12] = 4;
+  header[13] = 0;
+  ok = image_file_write (file, header, IMAGE_QOI_HEADER, data, d - data);
+  g_free (data);
+  return ok;
+}
+
+/**
+ * Function to write a PNG file.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+image_png_write (const char *file,      ///< PNG file name.
+                 unsigned int width,    ///< Width.
+                 unsigned int height,   ///< Height.
+                 const GLubyte * pixels)        ///< Pixels in the OpenGL order.
+{
+  png_struct *png;
+  png_info *info;
+  png_byte **rows;
+  FILE *f;
+  unsigned int i;
+  int ok;
+
+  f = g_fopen (file, "wb");
+  if (!f)
+    return 0;
+  png = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  info = png_create_info_struct (png);
+  rows = (png_byte **) g_slice_alloc (height * sizeof (png_byte *));
+  for (i = 0; i < height; ++i)
+    rows[i] = (png_byte *) pixels + 4 * (gsize) width * (height - 1 - i);
+  ok = 0;
+  if (setjmp (png_jmpbuf (png)))
+    goto exit_on_error;
+  png_init_io (png, f);
+  png_set_IHDR (png, info, width, height, 8, PNG_COLOR_TYPE_RGBA,
+                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                PNG_FILTER_TYPE_DEFAULT);
+  png_set_rows (png, info, rows);
+  png_write_png (png, info, PNG_TRANSFORM_IDENTITY, NULL);
+  ok = 1;
+
+exit_on_error:
+  png_destroy_write_struct (&png, &info);
+  g_slice_free1 (height * sizeof (png_byte *), rows);
+  if (fclose (f))
+    ok = 0;
+  return ok;
+}
+
+/**
+ * Function to close an image file.
+ */
+static void
+image_reader_close (ImageReader * reader)       ///< ImageReader struct.
+{
+  if (reader->file)
+    fclose (reader->file);
+  if (reader->png)
+    png_destroy_read_struct (&reader->png, &reader->info, NULL);
+  if (reader->mapped)
+    g_mapped_file_unref (reader->mapped);
+  if (reader->source)
+    g_mapped_file_unref (reader->source);
+  if (reader->ktx)
+    {
+      ktx_close (reader->ktx);
+      g_slice_free1 (sizeof (Ktx), reader->ktx);
+    }
+  g_free (reader->cache);
+}
+
+/**
+ * Function to open an image file and to read its header. The format is
+ *   detected by the file signature. The pixels are transformed to 8 bits RGBA
+ *   format. The raw and KTX2 files are mapped and, for the other formats, a
+ *   valid cache file is mapped if it exists.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+image_reader_open (ImageReader * reader,        ///< ImageReader struct.
+                   const char *name)    ///< Image file name.
+{
+  char magic[8];
+
+  reader->file = NULL;
+  reader->png = NULL;
+  reader->info = NULL;
+  reader->mapped = reader->source = NULL;
+  reader->ktx = NULL;
+  reader->cache = NULL;
+  reader->passes = 0;
+
+  // detecting the format
+  reader->file = fopen (name, "rb");
+  if (!reader->file || fread (magic, 1, 8, reader->file) != 8)
+    goto exit_on_error;
+  if (!memcmp (magic, image_raw_magic, 8))
+    reader->format = IMAGE_FORMAT_RAW;
+  else if (!memcmp (magic, "qoif", 4))
+    reader->format = IMAGE_FORMAT_QOI;
+  else if (!memcmp (magic, "\xabKTX 20\xbb", 8))
+    reader->format = IMAGE_FORMAT_KTX2;
+  else if (!png_sig_cmp ((png_const_bytep) magic, 0, 8))
+    reader->format = IMAGE_FORMAT_PNG;
+  else
+    goto exit_on_error;
+  if (reader->format != IMAGE_FORMAT_PNG)
+    {
+      fclose (reader->file);
+      reader->file = NULL;
+    }
+
+  // mapping the raw file
+  if (reader->format == IMAGE_FORMAT_RAW)
+    {
+      reader->mapped = image_raw_map (name, &reader->width, &reader->height);
+      if (!reader->mapped)
+        goto exit_on_error;
+      reader->row_bytes = 4 * reader->width;
+      return 1;
+    }
+
+  // mapping the KTX2 file
+  if (reader->format == IMAGE_FORMAT_KTX2)
+    {
+      reader->ktx = (Ktx *) g_slice_alloc (sizeof (Ktx));
+      if (!ktx_open (reader->ktx, name))
+        {
+          g_slice_free1 (sizeof (Ktx), reader->ktx);
+          reader->ktx = NULL;
+          goto exit_on_error;
+        }
+      reader->width = reader->ktx->width;
+      reader->height = reader->ktx->height;
+      reader->row_bytes = 4 * reader->width;
+      return 1;
+    }
+
+  // mapping the cache file, only the PNG files are slow enough to decode
+  if (reader->format == IMAGE_FORMAT_PNG && g_atomic_int_get (&image_cache))
+    reader->cache = image_cache_name (name);
+  if (reader->cache)
+    {
+      reader->mapped = image_raw_map (reader->cache, &reader->width,
+                                      &reader->height);
+      if (reader->mapped)
+        {
+          reader->row_bytes = 4 * reader->width;
+          return 1;
+        }
+    }
+
+  // mapping the QOI file
+  if (reader->format == IMAGE_FORMAT_QOI)
+    {
+      reader->source = image_qoi_map (name, &reader->width, &reader->height);
+      if (!reader->source)
+        goto exit_on_error;
+      reader->row_bytes = 4 * reader->width;
+      return 1;
+    }
+
+  // starting png structs
+  reader->png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL,
+                                        NULL);
+  reader->info = png_create_info_struct (reader->png);
+
+  // reading the header and setting the transformations
+  if (setjmp (png_jmpbuf (reader->png)))
+    goto exit_on_error;
+  png_init_io (reader->png, reader->file);
+  png_set_sig_bytes (reader->png, 8);
+  png_read_info (reader->png, reader->info);
+  png_set_expand (reader->png);
+  png_set_strip_16 (reader->png);
+  png_set_packing (reader->png);
+  png_set_gray_to_rgb (reader->png);
+  png_set_add_alpha (reader->png, 0xff, PNG_FILLER_AFTER);
+  reader->passes = png_set_interlace_handling (reader->png);
+  png_read_update_info (reader->png, reader->info);
+  reader->width = png_get_image_width (reader->png, reader->info);
+  reader->height = png_get_image_height (reader->png, reader->info);
+  reader->row_bytes = png_get_rowbytes (reader->png, reader->info);
+  return 1;
+
+exit_on_error:
+  image_reader_close (reader);
+  reader->file = NULL;
+  reader->png = NULL;
+  reader->mapped = reader->source = NULL;
+  reader->ktx = NULL;
+  reader->cache = NULL;
+  return 0;
+}
+
+/**
+ * Function to decode the pixels of an image file. Every row is decoded
+ *   straight in its place in the OpenGL order (bottom row first), the
+ *   interlaced PNG images are decoded in the same rows on every pass. The
+ *   cache file is written after decoding. If a raw or cache file is mapped,
+ *   the pixels are copied. The first mipmap level of the KTX2 textures is
+ *   decoded.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+image_reader_read (ImageReader * reader,        ///< ImageReader struct.
+                   GLubyte * pixels)    ///< Pixels in the OpenGL order.
+{
+  unsigned int i, pass;
+  if (reader->mapped)
+    {
+      memcpy (pixels, image_raw_pixels (reader->mapped),
+              reader->row_bytes * (gsize) reader->height);
+      return 1;
+    }
+  if (reader->ktx)
+    return ktx_decode (reader->ktx, 0, pixels);
+  if (reader->source)
+    {
+      if (!image_qoi_decode (reader->source, reader->width, reader->height,
+                             pixels))
+        return 0;
+    }
+  else
+    {
+      if (setjmp (png_jmpbuf (reader->png)))
+        return 0;
+      for (pass = 0; pass < reader->passes; ++pass)
+        for (i = 0; i < reader->height; ++i)
+          png_read_row (reader->png,
+                        pixels + reader->row_bytes * (reader->height - 1 - i),
+                        NULL);
+      png_read_end (reader->png, NULL);
+    }
+  if (reader->cache)
+    image_raw_write (reader->cache, reader->width, reader->height, pixels);
+  return 1;
+}
+
+/**
+ * Function to decode the image on a file in a given memory. The image has
+ *   to have the given size. It does not use GL, so it can be called from any
+ *   thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+image_decode (const char *name, ///< Image file name.
+              unsigned int width,       ///< Width.
+              unsigned int height,      ///< Height.
+              GLubyte * pixels) ///< Pixels in the OpenGL order.
+{
+  ImageReader reader[1];
+  int ok;
+  if (!image_reader_open (reader, name))
+    return 0;
+  ok = reader->width == width && reader->height == height
+    && image_reader_read (reader, pixels);
+  image_reader_close (reader);
+  return ok;
+}
+
+/**
+ * Function to open an image file to read its rows in order, top-down. The
+ *   non interlaced PNG files are decoded row by row and the raw and cache
+ *   files are read from the mapping, so the memory does not grow with the
+ *   image size. The other files are decoded at once.
+ *
+ * \return pointer to the ImageStream struct on success, NULL on error.
+ */
+ImageStream *
+image_stream_open (const char *name,    ///< Image file name.
+                   unsigned int *width, ///< Width.
+                   unsigned int *height)        ///< Height.
+{
+  ImageStream *stream;
+  ImageReader *reader;
+
+  reader = (ImageReader *) g_slice_alloc (sizeof (ImageReader));
+  if (!image_reader_open (reader, name))
+    {
+      g_slice_free1 (sizeof (ImageReader), reader);
+      return NULL;
+    }
+  stream = (ImageStream *) g_slice_alloc (sizeof (ImageStream));
+  stream->reader = reader;
+  stream->pixels = NULL;
+  stream->row = 0;
+  stream->size = reader->row_bytes * (gsize) reader->height;
+  if (!reader->mapped && reader->passes != 1)
+    {
+      stream->pixels = (GLubyte *) g_try_malloc (stream->size);
+      if (!stream->pixels || !image_reader_read (reader, stream->pixels))
+        {
+          image_stream_close (stream);
+          return NULL;
+        }
+    }
+  *width = reader->width;
+  *height = reader->height;
+  return stream;
+}
+
+/**
+ * Function to read the next rows of an image stream.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+image_stream_read (ImageStream * stream,        ///< ImageStream struct.
+                   GLubyte * rows,      ///< RGBA rows, top-down.
+                   unsigned int nrows)  ///< Number of rows.
+{
+  ImageReader *reader;
+  const GLubyte *pixels;
+  unsigned int i;
+
+  reader = (ImageReader *) stream->reader;
+  if (stream->row + nrows > reader->height)
+    return 0;
+  if (reader->mapped || stream->pixels)
+    {
+      pixels = reader->mapped ? image_raw_pixels (reader->mapped)
+        : stream->pixels;
+      for (i = 0; i < nrows; ++i, ++stream->row)
+        memcpy (rows + reader->row_bytes * (gsize) i,
+                pixels + reader->row_bytes
+                * (gsize) (reader->height - 1 - stream->row),
+                reader->row_bytes);
+      return 1;
+    }
+  if (setjmp (png_jmpbuf (reader->png)))
+    return 0;
+  for (i = 0; i < nrows; ++i, ++stream->row)
+    png_read_row (reader->png, rows + reader->row_bytes * (gsize) i, NULL);
+  return 1;
+}
+
+/**
+ * Function to close an image stream.
+ */
+void
+image_stream_close (ImageStream * stream)       ///< ImageStream struct.
+{
+  image_reader_close ((ImageReader *) stream->reader);
+  g_slice_free1 (sizeof (ImageReader), stream->reader);
+  g_free (stream->pixels);
+  g_slice_free1 (sizeof (ImageStream), stream);
+}
+
+/**
+ * Function to set the geometry of an image.
+ */
+static void
+image_geometry (Image * image)  ///< Image struct.
 {
   const GLfloat matrix[16] = {
     1.f, 0.f, 0.f, 0.f,
@@ -84,12 +882,23 @@ image_new (char *name)          ///< Image PNG file name.
     0, 1, 2,
     2, 3, 0
   };
+  memcpy (image->matrix, matrix, 16 * sizeof (GLfloat));
+  memcpy (image->vertices, vertices, 8 * sizeof (GLfloat));
+  memcpy (image->square_texture, square_texture, 8 * sizeof (GLfloat));
+  memcpy (image->elements, elements, 6 * sizeof (GLushort));
+}
+
+/**
+ * Function to read the image on a PNG, QOI, raw or KTX2 file. The KTX2
+ *   compressed textures are kept compressed to upload them.
+ *
+ * \return pointer to the Image struct data on success, NULL on error.
+ */
+Image *
+image_new (char *name)          ///< Image file name.
+{
+  ImageReader reader[1];
   Image *image;
-  png_struct *png;
-  png_info *info;
-  png_byte **row_pointers;
-  FILE *file;
-  unsigned int i, row_bytes;
 
 #if DEBUG
   printf ("image_new: start\n");
@@ -99,58 +908,55 @@ image_new (char *name)          ///< Image PNG file name.
   // initing image
   image = NULL;
 
-  // starting png structs
-  png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  info = png_create_info_struct (png);
-
   // opening file
-  file = fopen (name, "rb");
-  if (!file)
+  if (!image_reader_open (reader, name))
     goto error1;
 
-  // reading file and transforming to 8 bits RGBA format
-  if (setjmp (png_jmpbuf (png)))
-    goto error2;
-  png_init_io (png, file);
-  if (setjmp (png_jmpbuf (png)))
-    goto error2;
-  png_read_png (png,
-                info,
-                PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_PACKING |
-                PNG_TRANSFORM_EXPAND, NULL);
-
   // allocating image
   image = (Image *) g_slice_alloc (sizeof (Image));
+  image->width = reader->width;
+  image->height = reader->height;
+  image->size = reader->row_bytes * image->height;
+  image->ktx = NULL;
+
+  // the compressed texture is used from the mapping without decoding
+  if (reader->ktx)
+    {
+      image->ktx = reader->ktx;
+      reader->ktx = NULL;
+      image->mapped = NULL;
+      image->image = NULL;
+      image_geometry (image);
+      goto error2;
+    }
 
-  // copying pixels in the OpenGL order
-  image->width = png_get_image_width (png, info);
-  image->height = png_get_image_height (png, info);
-  row_bytes = png_get_rowbytes (png, info);
-  image->size = row_bytes * image->height;
+  // the raw or cached pixels are used from the mapping without copying
+  if (reader->mapped)
+    {
+      image->mapped = g_mapped_file_ref (reader->mapped);
+      image->image = image_raw_pixels (reader->mapped);
+      image_geometry (image);
+      goto error2;
+    }
+  image->mapped = NULL;
   image->image = (GLubyte *) g_slice_alloc (image->size);
-  if (!image->image)
+
+  // decoding pixels in the OpenGL order
+  if (!image->image || !image_reader_read (reader, image->image))
     {
+      if (image->image)
+        g_slice_free1 (image->size, image->image);
       g_slice_free1 (sizeof (Image), image);
       image = NULL;
       goto error2;
     }
-  row_pointers = png_get_rows (png, info);
-  for (i = 0; i < image->height; i++)
-    memcpy (image->image + (row_bytes * (image->height - 1 - i)),
-            row_pointers[i], row_bytes);
-  memcpy (image->matrix, matrix, 16 * sizeof (GLfloat));
-  memcpy (image->vertices, vertices, 8 * sizeof (GLfloat));
-  memcpy (image->square_texture, square_texture, 8 * sizeof (GLfloat));
-  memcpy (image->elements, elements, 6 * sizeof (GLushort));
+  image_geometry (image);
 
 error2:
-  // closing file
-  fclose (file);
+  // closing file and freeing memory
+  image_reader_close (reader);
 
 error1:
-  // freeing memory
-  png_destroy_read_struct (&png, &info, NULL);
-
 #if DEBUG
   printf ("image_new: end\n");
   fflush (stdout);
@@ -159,139 +965,244 @@ error1:
 }
 
 /**
- * Function to init the variables used to draw the image.
- *
- * \return 1 on success, 0 on error.
+ * Function to check the texture functions. It has to be called on the GL
+ *   thread.
  */
-int
-image_init (Image * image)      ///< Image struct.
+static void
+image_texture_check ()
 {
-  const char *vertex_name = "position";
-  const char *texture_name = "texture_image";
-  const char *texture_position_name = "texture_position";
-  const char *matrix_name = "matrix";
-  const char *vs_texture_source[1];
-  const char *fs_texture_source[1];
-  // GLSL version
-  const char *error_message;
-  GLint k;
-  GLuint vs, fs;
-
-#if DEBUG
-  printf ("image_init: start\n");
-  fflush (stdout);
-#endif
-
-  // Select shaders
-  if (strstr ((const char *) glGetString (GL_VERSION), "OpenGL ES"))
+  int version, desktop;
+  if (image_texture_mode >= 0)
+    return;
+  version = epoxy_gl_version ();
+  desktop = epoxy_is_desktop_gl ();
+  if (desktop)
     {
-      fs_texture_source[0] = fs_texture_source_es;
-      vs_texture_source[0] = vs_texture_source_es;
-    }
-  else if (epoxy_gl_version () >= 33)
-    {
-      fs_texture_source[0] = fs_texture_source_v3;
-      vs_texture_source[0] = vs_texture_source_v3;
+      image_texture_storage = version >= 42
+        || epoxy_has_gl_extension ("GL_ARB_texture_storage");
+      image_texture_mipmap = version >= 30
+        || epoxy_has_gl_extension ("GL_ARB_framebuffer_object");
+      image_texture_npot = 1;
     }
   else
     {
-      fs_texture_source[0] = fs_texture_source_v2;
-      vs_texture_source[0] = vs_texture_source_v2;
+      image_texture_storage = version >= 30;
+      image_texture_mipmap = 1;
+      image_texture_npot = version >= 30
+        || epoxy_has_gl_extension ("GL_OES_texture_npot");
     }
+  if ((desktop && version >= 46)
+      || epoxy_has_gl_extension ("GL_EXT_texture_filter_anisotropic")
+      || epoxy_has_gl_extension ("GL_ARB_texture_filter_anisotropic"))
+    glGetFloatv (GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &image_texture_anisotropy);
+  image_texture_mode = 1;
+}
 
-  fs = glCreateShader (GL_FRAGMENT_SHADER);
-  glShaderSource (fs, 1, fs_texture_source, NULL);
-  glCompileShader (fs);
-  glGetShaderiv (fs, GL_COMPILE_STATUS, &k);
-  if (!k)
-    {
-      error_message = "unable to compile the texture fragment shader";
-      goto exit_on_error;
-    }
+/**
+ * Function to get the next mipmap level of an image with a 2x2 box filter.
+ *   It does not use GL, so it can be called from any thread.
+ */
+void
+image_downsample (const GLubyte * pixels,       ///< Pixels in the OpenGL order.
+                  unsigned int width,   ///< Width.
+                  unsigned int height,  ///< Height.
+                  GLubyte * next)       ///< Next level pixels.
+{
+  const GLubyte *r0, *r1;
+  unsigned int w, h, x, y, x1, k;
 
-  vs = glCreateShader (GL_VERTEX_SHADER);
-  glShaderSource (vs, 1, vs_texture_source, NULL);
-  glCompileShader (vs);
-  glGetShaderiv (vs, GL_COMPILE_STATUS, &k);
-  if (!k)
+  w = MAX (1, width / 2);
+  h = MAX (1, height / 2);
+  for (y = 0; y < h; ++y)
     {
-      error_message = "unable to compile the 2D texture vertex shader";
-      goto exit_on_error;
+      r0 = pixels + 4 * (gsize) width * MIN (2 * y, height - 1);
+      r1 = pixels + 4 * (gsize) width * MIN (2 * y + 1, height - 1);
+      for (x = 0; x < w; ++x, next += 4)
+        {
+          x1 = MIN (2 * x + 1, width - 1);
+          for (k = 0; k < 4; ++k)
+            next[k] = (r0[8 * x + k] + r0[4 * x1 + k] + r1[8 * x + k]
+                       + r1[4 * x1 + k] + 2) / 4;
+        }
     }
+}
+
+/**
+ * Function to upload the mipmap levels of an image, filtered on the CPU, to
+ *   the bound texture.
+ */
+static void
+image_mipmaps (Image * image,   ///< Image struct.
+               unsigned int levels)     ///< Number of mipmap levels.
+{
+  GLubyte *pixels[2];
+  gsize size;
+  unsigned int i, width, height;
 
-  image->program_texture = glCreateProgram ();
-  glAttachShader (image->program_texture, fs);
-  glAttachShader (image->program_texture, vs);
-  glLinkProgram (image->program_texture);
-  glDetachShader (image->program_texture, vs);
-  glDetachShader (image->program_texture, fs);
-  glDeleteShader (vs);
-  glDeleteShader (fs);
-  glGetProgramiv (image->program_texture, GL_LINK_STATUS, &k);
-  if (!k)
+  size = 4 * (gsize) MAX (1, image->width / 2) * MAX (1, image->height / 2);
+  pixels[0] = (GLubyte *) g_slice_alloc (size);
+  pixels[1] = (GLubyte *) g_slice_alloc (size);
+  width = image->width;
+  height = image->height;
+  for (i = 1; i < levels; ++i)
     {
-      error_message = "unable to link the program 2D texture";
-      goto exit_on_error;
+      image_downsample ((i == 1) ? image->image : pixels[i & 1], width,
+                        height, pixels[(i + 1) & 1]);
+      width = MAX (1, width / 2);
+      height = MAX (1, height / 2);
+      glTexImage2D (GL_TEXTURE_2D, i, GL_RGBA, width, height, 0, GL_RGBA,
+                    GL_UNSIGNED_BYTE, pixels[(i + 1) & 1]);
     }
+  g_slice_free1 (size, pixels[1]);
+  g_slice_free1 (size, pixels[0]);
+}
 
-  glActiveTexture (GL_TEXTURE0);
-  glGenTextures (1, &image->id_texture);
-  glBindTexture (GL_TEXTURE_2D, image->id_texture);
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexImage2D (GL_TEXTURE_2D,  // target
-                0,              // level, 0 = base, no minimap,
-                GL_RGBA,        // internalformat
-                image->width,   // width
-                image->height,  // height
-                0,              // border, always 0 in OpenGL ES
-                GL_RGBA,        // format
-                GL_UNSIGNED_BYTE,       // type
-                image->image);  // image data
+/**
+ * Function to submit the texture program shared by the images, the tiled
+ *   images and the sprites without waiting for its compile. The program has
+ *   to be released with shader_program_release.
+ *
+ * \return pointer to the ShaderProgram struct data.
+ */
+ShaderProgram *
+image_program_submit ()
+{
+  const char *attributes[] = { "position", "texture_position", NULL };
+  const char *uniforms[] = { "texture_image", "matrix", NULL };
+  const char *vs_sources[SHADER_DIALECT_ES + 1] = {
+    vs_texture_source_v2, vs_texture_source_v3, vs_texture_source_es
+  };
+  const char *fs_sources[SHADER_DIALECT_ES + 1] = {
+    fs_texture_source_v2, fs_texture_source_v3, fs_texture_source_es
+  };
+  unsigned int dialect;
+  dialect = shader_dialect ();
+  return shader_program_submit ("image", vs_sources + dialect, 1,
+                                fs_sources + dialect, 1, attributes, uniforms);
+}
 
-  image->attribute_texture
-    = glGetAttribLocation (image->program_texture, vertex_name);
-  if (image->attribute_texture == -1)
+/**
+ * Function to get the linked texture program shared by the images, the tiled
+ *   images and the sprites. The program has to be released with
+ *   shader_program_release.
+ *
+ * \return pointer to the ShaderProgram struct data on success, NULL on error.
+ */
+ShaderProgram *
+image_program ()
+{
+  ShaderProgram *program;
+  program = image_program_submit ();
+  if (!shader_program_wait (program))
     {
-      error_message = "could not bind vertex attribute";
-      goto exit_on_error;
+      shader_program_release (program);
+      return NULL;
     }
+  return program;
+}
 
-  image->attribute_texture_position
-    = glGetAttribLocation (image->program_texture, texture_position_name);
-  if (image->attribute_texture_position == -1)
+/**
+ * Function to init the variables used to draw the image.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+image_init (Image * image)      ///< Image struct.
+{
+  const char *error_message;
+  unsigned int i, levels;
+
+#if DEBUG
+  printf ("image_init: start\n");
+  fflush (stdout);
+#endif
+
+  // Shared texture program
+  image->program = image_program ();
+  if (!image->program)
     {
-      error_message = "could not bind position attribute";
+      error_message = "unable to get the texture program";
       goto exit_on_error;
     }
+  image->program_texture = image->program->id;
+  image->attribute_texture
+    = image->program->attributes[IMAGE_ATTRIBUTE_POSITION];
+  image->attribute_texture_position
+    = image->program->attributes[IMAGE_ATTRIBUTE_TEXTURE];
+  image->uniform_texture = image->program->uniforms[IMAGE_UNIFORM_TEXTURE];
+  image->uniform_matrix = image->program->uniforms[IMAGE_UNIFORM_MATRIX];
 
-  image->uniform_texture
-    = glGetUniformLocation (image->program_texture, texture_name);
-  if (image->uniform_texture == -1)
+  state_active_texture (GL_TEXTURE0);
+  glGenTextures (1, &image->id_texture);
+  state_bind_texture (image->id_texture);
+  image_texture_check ();
+  if (image->ktx)
     {
-      error_message = "could not bind uniform texture";
-      goto exit_on_error;
+      if (!ktx_upload (image->ktx, image_texture_storage))
+        {
+          error_message = "unable to upload the compressed texture";
+          goto exit_on_error;
+        }
+      // the compressed texture rows are top-down
+      if (image->ktx->top_down)
+        for (i = 1; i < 8; i += 2)
+          image->square_texture[i] = 1.f - image->square_texture[i];
     }
-
-  image->uniform_matrix
-    = glGetUniformLocation (image->program_texture, matrix_name);
-  if (image->uniform_matrix == -1)
+  else
     {
-      error_message = "could not bind uniform matrix";
-      goto exit_on_error;
+      // full mipmap chain, filtered on the CPU if the GL can not generate it
+      levels = 1;
+      if (image_texture_npot
+          || !((image->width & (image->width - 1))
+               || (image->height & (image->height - 1))))
+        while (MAX (image->width, image->height) >> levels)
+          ++levels;
+      if (!image_texture_mipmap && !image->image)
+        levels = 1;
+      if (image_texture_storage)
+        {
+          glTexStorage2D (GL_TEXTURE_2D, levels, GL_RGBA8, image->width,
+                          image->height);
+          glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, image->width,
+                           image->height, GL_RGBA, GL_UNSIGNED_BYTE,
+                           image->image);
+        }
+      else
+        glTexImage2D (GL_TEXTURE_2D,    // target
+                      0,        // level, 0 = base
+                      GL_RGBA,  // internalformat
+                      image->width,     // width
+                      image->height,    // height
+                      0,        // border, always 0 in OpenGL ES
+                      GL_RGBA,  // format
+                      GL_UNSIGNED_BYTE, // type
+                      image->image);    // image data
+      if (levels > 1)
+        {
+          if (image_texture_mipmap)
+            glGenerateMipmap (GL_TEXTURE_2D);
+          else
+            image_mipmaps (image, levels);
+        }
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                       (levels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
     }
+  if (image_texture_anisotropy > 1.f)
+    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT,
+                     MIN (IMAGE_ANISOTROPY, image_texture_anisotropy));
 
   glGenBuffers (1, &image->vbo);
-  glBindBuffer (GL_ARRAY_BUFFER, image->vbo);
+  state_bind_buffer (GL_ARRAY_BUFFER, image->vbo);
   glBufferData (GL_ARRAY_BUFFER, sizeof (image->vertices), image->vertices,
                 GL_STATIC_DRAW);
 
   glGenBuffers (1, &image->ibo);
-  glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, image->ibo);
+  state_bind_buffer (GL_ELEMENT_ARRAY_BUFFER, image->ibo);
   glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof (image->elements),
                 image->elements, GL_STATIC_DRAW);
 
   glGenBuffers (1, &image->vbo_texture);
-  glBindBuffer (GL_ARRAY_BUFFER, image->vbo_texture);
+  state_bind_buffer (GL_ARRAY_BUFFER, image->vbo_texture);
   glBufferData (GL_ARRAY_BUFFER, sizeof (image->square_texture),
                 image->square_texture, GL_STATIC_DRAW);
 
@@ -303,6 +1214,8 @@ image_init (Image * image)      ///< Image struct.
 
 exit_on_error:
   printf ("ERROR! Image: %s\n", error_message);
+  shader_program_release (image->program);
+  image->program = NULL;
 #if DEBUG
   printf ("image_init: end\n");
   fflush (stdout);
@@ -321,12 +1234,20 @@ image_destroy (Image * image)   ///< Image struct.
   fflush (stdout);
 #endif
 
-  glDeleteBuffers (1, &image->ibo);
-  glDeleteBuffers (1, &image->vbo);
-  glDeleteBuffers (1, &image->vbo_texture);
-  glDeleteTextures (1, &image->id_texture);
-  glDeleteProgram (image->program_texture);
-  g_slice_free1 (image->size, image->image);
+  state_delete_buffers (1, &image->ibo);
+  state_delete_buffers (1, &image->vbo);
+  state_delete_buffers (1, &image->vbo_texture);
+  state_delete_textures (1, &image->id_texture);
+  shader_program_release (image->program);
+  if (image->ktx)
+    {
+      ktx_close (image->ktx);
+      g_slice_free1 (sizeof (Ktx), image->ktx);
+    }
+  else if (image->mapped)
+    g_mapped_file_unref (image->mapped);
+  else if (image->image)
+    g_slice_free1 (image->size, image->image);
 
 #if DEBUG
   printf ("image_destroy: end\n");
@@ -349,19 +1270,519 @@ image_draw (Image * image,      ///< Image struct.
   image->matrix[5] = sp;
   image->matrix[12] = cp - 1.f;
   image->matrix[13] = sp - 1.f;
-  glUseProgram (image->program_texture);
-  glUniformMatrix4fv (image->uniform_matrix, 1, GL_FALSE, image->matrix);
-  glUniform1i (image->uniform_texture, 0);
-  glBindTexture (GL_TEXTURE_2D, image->id_texture);
-  glBindBuffer (GL_ARRAY_BUFFER, image->vbo_texture);
-  glEnableVertexAttribArray (image->attribute_texture_position);
+  state_use_program (image->program_texture);
+  state_uniform_matrix4fv (image->uniform_matrix, image->matrix);
+  state_uniform1i (image->uniform_texture, 0);
+  state_active_texture (GL_TEXTURE0);
+  state_bind_texture (image->id_texture);
+  state_bind_buffer (GL_ARRAY_BUFFER, image->vbo_texture);
+  state_attributes (STATE_ATTRIBUTE (image->attribute_texture_position)
+                    | STATE_ATTRIBUTE (image->attribute_texture));
   glVertexAttribPointer (image->attribute_texture_position,
                          2, GL_FLOAT, GL_FALSE, 0, 0);
-  glBindBuffer (GL_ARRAY_BUFFER, image->vbo);
-  glEnableVertexAttribArray (image->attribute_texture);
+  state_bind_buffer (GL_ARRAY_BUFFER, image->vbo);
   glVertexAttribPointer (image->attribute_texture, 2, GL_FLOAT, GL_FALSE, 0, 0);
-  glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, image->ibo);
+  state_bind_buffer (GL_ELEMENT_ARRAY_BUFFER, image->ibo);
   glDrawElements (GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-  glDisableVertexAttribArray (image->attribute_texture);
-  glDisableVertexAttribArray (image->attribute_texture_position);
+}
+
+/**
+ * Function to free the memory of an image not initialized on the GL thread.
+ */
+void
+image_free (Image * image)      ///< Image struct.
+{
+  if (image->ktx)
+    {
+      ktx_close (image->ktx);
+      g_slice_free1 (sizeof (Ktx), image->ktx);
+    }
+  else if (image->mapped)
+    g_mapped_file_unref (image->mapped);
+  else if (image->image)
+    g_slice_free1 (image->size, image->image);
+  g_slice_free1 (sizeof (Image), image);
+}
+
+/**
+ * Function to write pixels on an image file. It does not use GL, so it can be
+ *   called from any thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+image_write (const char *name,  ///< Image file name.
+             unsigned int width,        ///< Width.
+             unsigned int height,       ///< Height.
+             const GLubyte * pixels,    ///< Pixels in the OpenGL order.
+             unsigned int format)       ///< File format (ImageFormat).
+{
+  switch (format)
+    {
+    case IMAGE_FORMAT_PNG:
+      return image_png_write (name, width, height, pixels);
+    case IMAGE_FORMAT_QOI:
+      return image_qoi_write (name, width, height, pixels);
+    case IMAGE_FORMAT_RAW:
+      return image_raw_write (name, width, height, pixels);
+    }
+  return 0;
+}
+
+/**
+ * Function to save the pixels of an image on a file. The image pixels are
+ *   needed, an image loaded asynchronously through a pixel buffer object can
+ *   not be saved. The compressed textures are decoded.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+image_save (Image * image,      ///< Image struct.
+            const char *name,   ///< Image file name.
+            unsigned int format)        ///< File format (ImageFormat).
+{
+  GLubyte *pixels;
+  int ok;
+
+  pixels = image->image;
+  if (image->ktx)
+    {
+      pixels = (GLubyte *) g_slice_alloc (image->size);
+      if (!ktx_decode (image->ktx, 0, pixels))
+        {
+          g_slice_free1 (image->size, pixels);
+          return 0;
+        }
+    }
+  if (!pixels)
+    return 0;
+  ok = image_write (name, image->width, image->height, pixels, format);
+  if (image->ktx)
+    g_slice_free1 (image->size, pixels);
+  return ok;
+}
+
+/**
+ * Function to enable or disable the decoded image cache files. Tools reading
+ *   every image once can disable them.
+ */
+void
+image_set_cache (int enable)    ///< 1 to enable, 0 to disable.
+{
+  g_atomic_int_set (&image_cache, enable);
+}
+
+/**
+ * Function to free the memory of an asynchronous image load.
+ */
+static void
+image_load_free (ImageLoad * load)      ///< ImageLoad struct.
+{
+  if (load->reader)
+    {
+      image_reader_close ((ImageReader *) load->reader);
+      g_slice_free1 (sizeof (ImageReader), load->reader);
+    }
+  if (load->image)
+    image_free (load->image);
+  g_free (load->name);
+  g_slice_free1 (sizeof (ImageLoad), load);
+}
+
+/**
+ * Function to read the header or to decode the pixels of an image on a worker
+ *   thread.
+ */
+static void
+image_load_thread (gpointer data,       ///< ImageLoad struct.
+                   gpointer user_data G_GNUC_UNUSED)    ///< unused.
+{
+  ImageLoad *load;
+  ImageReader *reader;
+  GLubyte *pixels;
+  unsigned int state;
+
+  load = (ImageLoad *) data;
+  reader = (ImageReader *) load->reader;
+  state = IMAGE_LOAD_FAILED;
+  if (g_atomic_int_get (&load->state) == IMAGE_LOAD_QUEUED)
+    {
+      if (!reader)
+        {
+          // Reading the header, the GL thread gives the memory to decode
+          reader = (ImageReader *) g_slice_alloc (sizeof (ImageReader));
+          if (image_reader_open (reader, load->name))
+            {
+              load->reader = reader;
+              state = IMAGE_LOAD_HEADER;
+            }
+          else
+            g_slice_free1 (sizeof (ImageReader), reader);
+        }
+      else
+        {
+          // Decoding the pixels. The write-only mapping of a pixel buffer
+          // object can not be read back, so the pixels to cache are decoded
+          // in memory, the cache file is written and then they are copied
+          if (load->pbo >= 0 && reader->cache && !reader->mapped)
+            {
+              pixels = (GLubyte *) g_try_malloc (load->image->size);
+              if (pixels && image_reader_read (reader, pixels))
+                {
+                  memcpy (load->pixels, pixels, load->image->size);
+                  state = IMAGE_LOAD_DECODED;
+                }
+              g_free (pixels);
+            }
+          else if (image_reader_read (reader, load->pixels))
+            state = IMAGE_LOAD_DECODED;
+          image_reader_close (reader);
+          g_slice_free1 (sizeof (ImageReader), reader);
+          load->reader = NULL;
+        }
+    }
+  if (!g_atomic_int_compare_and_exchange (&load->state, IMAGE_LOAD_QUEUED,
+                                          state))
+    // The load was destroyed while decoding
+    image_load_free (load);
+}
+
+/**
+ * Function to queue the work of an asynchronous image load.
+ */
+static void
+image_load_push (ImageLoad * load)      ///< ImageLoad struct.
+{
+  if (!image_pool)
+    image_pool = g_thread_pool_new (image_load_thread, NULL,
+                                    g_get_num_processors (), FALSE, NULL);
+  if (!image_pool || !g_thread_pool_push (image_pool, load, NULL))
+    image_load_thread (load, NULL);
+}
+
+/**
+ * Function to check the pixel buffer object functions. It has to be called on
+ *   the GL thread.
+ *
+ * \return 1 if the images can be uploaded through pixel buffer objects, 0
+ *   otherwise.
+ */
+static int
+image_pbo_check ()
+{
+  int version;
+  if (image_pbo_mode >= 0)
+    return image_pbo_mode;
+  version = epoxy_gl_version ();
+  if (epoxy_is_desktop_gl ())
+    {
+      image_pbo_mode = version >= 21
+        || epoxy_has_gl_extension ("GL_ARB_pixel_buffer_object");
+      image_pbo_map_range = version >= 30
+        || epoxy_has_gl_extension ("GL_ARB_map_buffer_range");
+      image_pbo_sync = version >= 32 || epoxy_has_gl_extension ("GL_ARB_sync");
+    }
+  else
+    image_pbo_mode = image_pbo_map_range = image_pbo_sync = version >= 30;
+  return image_pbo_mode;
+}
+
+/**
+ * Function to get a free pixel buffer object and to map it to decode an
+ *   image. A pixel buffer object is free when the copy to the texture of its
+ *   last image finished.
+ *
+ * \return slot of the pixel buffer object, -1 if none is free.
+ */
+static int
+image_pbo_map (ImageLoad * load)        ///< ImageLoad struct.
+{
+  ImagePbo *pbo;
+  GLenum status;
+  int i;
+
+  for (i = 0; i < IMAGE_PBOS; ++i)
+    {
+      pbo = image_pbo + i;
+      if (pbo->load)
+        continue;
+      if (pbo->fence)
+        {
+          status = glClientWaitSync (pbo->fence, 0, 0);
+          if (status != GL_ALREADY_SIGNALED
+              && status != GL_CONDITION_SATISFIED)
+            continue;
+          glDeleteSync (pbo->fence);
+          pbo->fence = NULL;
+        }
+      if (!pbo->buffer)
+        glGenBuffers (1, &pbo->buffer);
+
+      // Orphaning the old storage
+      state_bind_buffer (GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+      glBufferData (GL_PIXEL_UNPACK_BUFFER, load->image->size, NULL,
+                    GL_STREAM_DRAW);
+      if (image_pbo_map_range)
+        load->pixels
+          = (GLubyte *) glMapBufferRange (GL_PIXEL_UNPACK_BUFFER, 0,
+                                          load->image->size,
+                                          GL_MAP_WRITE_BIT
+                                          | GL_MAP_INVALIDATE_BUFFER_BIT);
+      else
+        load->pixels = (GLubyte *) glMapBuffer (GL_PIXEL_UNPACK_BUFFER,
+                                                GL_WRITE_ONLY);
+      state_bind_buffer (GL_PIXEL_UNPACK_BUFFER, 0);
+
+      // Not using pixel buffer objects if they can not be mapped
+      if (!load->pixels)
+        {
+          image_pbo_mode = 0;
+          return -1;
+        }
+      pbo->load = load;
+      return i;
+    }
+  return -1;
+}
+
+/**
+ * Function to unmap the pixel buffer object of an image load. The pixel buffer
+ *   object stays bound if the pixels are valid.
+ *
+ * \return 1 if the pixels are valid, 0 otherwise.
+ */
+static int
+image_pbo_unmap (ImageLoad * load)      ///< ImageLoad struct.
+{
+  ImagePbo *pbo;
+  int valid;
+  pbo = image_pbo + load->pbo;
+  state_bind_buffer (GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+  valid = glUnmapBuffer (GL_PIXEL_UNPACK_BUFFER);
+  if (!valid)
+    state_bind_buffer (GL_PIXEL_UNPACK_BUFFER, 0);
+  pbo->load = NULL;
+  load->pbo = -1;
+  load->pixels = NULL;
+  return valid;
+}
+
+/**
+ * Function to give the memory to decode the pixels of an image load. The
+ *   pixels are decoded, or copied from the cache file, in a mapped pixel buffer
+ *   object if available. Otherwise the cached pixels are used from the mapping
+ *   and the other images are decoded in the image bytes.
+ *
+ * \return 1 on success, 0 if no pixel buffer object is free.
+ */
+static int
+image_load_map (ImageLoad * load)       ///< ImageLoad struct.
+{
+  ImageReader *reader;
+  Image *image;
+
+  reader = (ImageReader *) load->reader;
+  if (!load->image)
+    {
+      image = (Image *) g_slice_alloc (sizeof (Image));
+      image->width = reader->width;
+      image->height = reader->height;
+      image->size = reader->row_bytes * image->height;
+      image->image = NULL;
+      image->mapped = NULL;
+      image->ktx = NULL;
+      image_geometry (image);
+      load->image = image;
+    }
+
+  // The compressed texture is uploaded from the mapping without decoding
+  if (reader->ktx)
+    {
+      load->image->ktx = reader->ktx;
+      reader->ktx = NULL;
+      image_reader_close (reader);
+      g_slice_free1 (sizeof (ImageReader), reader);
+      load->reader = NULL;
+      return 1;
+    }
+
+  // Waiting for a free pixel buffer object. The worker thread decodes the
+  // pixels in it, or copies the mapped cache file, so the GL thread only
+  // issues the copy to the texture
+  if (image_pbo_check ())
+    {
+      load->pbo = image_pbo_map (load);
+      if (load->pbo >= 0)
+        return 1;
+      if (image_pbo_mode)
+        return 0;
+    }
+
+  // Without pixel buffer objects the cached pixels are used from the mapping
+  // without decoding
+  if (reader->mapped)
+    {
+      load->image->mapped = g_mapped_file_ref (reader->mapped);
+      load->image->image = image_raw_pixels (reader->mapped);
+      image_reader_close (reader);
+      g_slice_free1 (sizeof (ImageReader), reader);
+      load->reader = NULL;
+      return 1;
+    }
+  load->image->image = (GLubyte *) g_slice_alloc (load->image->size);
+  load->pixels = load->image->image;
+  return 1;
+}
+
+/**
+ * Function to start to read the image on a PNG file on a worker thread. It
+ *   has to be called on the GL thread, image_load_poll finishes the load.
+ *
+ * \return pointer to the ImageLoad struct.
+ */
+ImageLoad *
+image_load_new (const char *name,       ///< Image file name.
+                ImageLoadCallback callback,
+                ///< Function called when finished, NULL for none.
+                void *data)     ///< User data of the callback.
+{
+  ImageLoad *load;
+
+#if DEBUG
+  printf ("image_load_new: start\n");
+  fflush (stdout);
+#endif
+
+  load = (ImageLoad *) g_slice_alloc (sizeof (ImageLoad));
+  load->name = g_strdup (name);
+  load->image = NULL;
+  load->reader = NULL;
+  load->pixels = NULL;
+  load->pbo = -1;
+  load->callback = callback;
+  load->data = data;
+  load->state = IMAGE_LOAD_QUEUED;
+  image_load_push (load);
+
+#if DEBUG
+  printf ("image_load_new: end\n");
+  fflush (stdout);
+#endif
+  return load;
+}
+
+/**
+ * Function to check an asynchronous image load. When the header is read, the
+ *   memory to decode the pixels is mapped. A decoded image is initialized,
+ *   copying the pixels from the pixel buffer object, and the callback is
+ *   called. It has to be called on the GL thread.
+ *
+ * \return load state (ImageLoadState).
+ */
+unsigned int
+image_load_poll (ImageLoad * load)      ///< ImageLoad struct.
+{
+  ImagePbo *pbo;
+  unsigned int state;
+  int valid;
+
+  state = g_atomic_int_get (&load->state);
+  switch (state)
+    {
+    case IMAGE_LOAD_HEADER:
+      if (!image_load_map (load))
+        return state;
+      if (load->reader)
+        {
+          g_atomic_int_set (&load->state, IMAGE_LOAD_QUEUED);
+          image_load_push (load);
+          return IMAGE_LOAD_QUEUED;
+        }
+      // fallthrough
+
+    case IMAGE_LOAD_DECODED:
+      pbo = NULL;
+      valid = 1;
+      if (load->pbo >= 0)
+        {
+          pbo = image_pbo + load->pbo;
+          valid = image_pbo_unmap (load);
+        }
+      if (valid && image_init (load->image))
+        state = IMAGE_LOAD_READY;
+      else
+        {
+          image_free (load->image);
+          load->image = NULL;
+          state = IMAGE_LOAD_ERROR;
+        }
+      if (pbo && valid)
+        {
+          state_bind_buffer (GL_PIXEL_UNPACK_BUFFER, 0);
+          if (image_pbo_sync)
+            pbo->fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+      break;
+    case IMAGE_LOAD_FAILED:
+      printf ("ERROR! Image: unable to open %s\n", load->name);
+      if (load->pbo >= 0 && image_pbo_unmap (load))
+        state_bind_buffer (GL_PIXEL_UNPACK_BUFFER, 0);
+      state = IMAGE_LOAD_ERROR;
+      break;
+    default:
+      return state;
+    }
+  g_atomic_int_set (&load->state, state);
+  if (load->callback)
+    load->callback (load, load->data);
+  return state;
+}
+
+/**
+ * Function to free the memory used by an asynchronous image load. If the
+ *   image is decoding in memory, the worker thread frees it. If it is decoding
+ *   in a pixel buffer object, the function waits for the worker thread.
+ */
+void
+image_load_destroy (ImageLoad * load)   ///< ImageLoad struct.
+{
+  if (load->pbo < 0
+      && g_atomic_int_compare_and_exchange (&load->state, IMAGE_LOAD_QUEUED,
+                                            IMAGE_LOAD_CANCELLED))
+    return;
+  while (g_atomic_int_get (&load->state) == IMAGE_LOAD_QUEUED)
+    g_usleep (1000);
+  if (load->pbo >= 0 && image_pbo_unmap (load))
+    state_bind_buffer (GL_PIXEL_UNPACK_BUFFER, 0);
+  if (g_atomic_int_get (&load->state) == IMAGE_LOAD_READY)
+    {
+      image_destroy (load->image);
+      g_slice_free1 (sizeof (Image), load->image);
+      load->image = NULL;
+    }
+  image_load_free (load);
+}
+
+/**
+ * Function to free the memory used to load images asynchronously. It has to
+ *   be called on the GL thread after destroying all the image loads.
+ */
+void
+image_load_finish ()
+{
+  unsigned int i;
+  if (image_pool)
+    {
+      g_thread_pool_free (image_pool, FALSE, TRUE);
+      image_pool = NULL;
+    }
+  for (i = 0; i < IMAGE_PBOS; ++i)
+    {
+      if (image_pbo[i].fence)
+        glDeleteSync (image_pbo[i].fence);
+      if (image_pbo[i].buffer)
+        state_delete_buffers (1, &image_pbo[i].buffer);
+      image_pbo[i].fence = NULL;
+      image_pbo[i].buffer = 0;
+    }
 }
@@ -1,6 +1,43 @@
 #ifndef IMAGE__H
 #define IMAGE__H 1
 
+#define IMAGE_PBOS 2            ///< Number of pixel buffer objects to upload.
+#define IMAGE_RAW_VERSION 1     ///< Version of the raw image files.
+#define IMAGE_ANISOTROPY 8.f    ///< Maximum anisotropy of the image textures.
+
+/**
+ * \enum ImageFormat
+ * \brief Image file formats.
+ */
+enum ImageFormat
+{
+  IMAGE_FORMAT_PNG = 0,         ///< PNG.
+  IMAGE_FORMAT_QOI = 1,         ///< QOI, fast lossless decode.
+  IMAGE_FORMAT_RAW = 2,         ///< Raw RGBA pixels in the OpenGL order with a
+  ///< header, mapped without decoding.
+  IMAGE_FORMAT_KTX2 = 3,        ///< KTX2 compressed texture, read only.
+};
+
+/**
+ * \enum ImageAttribute
+ * \brief Attribute locations of the shared texture program.
+ */
+enum ImageAttribute
+{
+  IMAGE_ATTRIBUTE_POSITION = 0, ///< Vertex position.
+  IMAGE_ATTRIBUTE_TEXTURE = 1,  ///< Texture position.
+};
+
+/**
+ * \enum ImageUniform
+ * \brief Uniform locations of the shared texture program.
+ */
+enum ImageUniform
+{
+  IMAGE_UNIFORM_TEXTURE = 0,    ///< Texture sampler.
+  IMAGE_UNIFORM_MATRIX = 1,     ///< Projection matrix.
+};
+
 /**
  * \struct Image
  * \brief A struct to define the image.
@@ -12,6 +49,10 @@ typedef struct
   GLfloat square_texture[8];    ///< Square texture vertices.
   GLushort elements[6];         ///< Element indices.
   GLubyte *image;               ///< Image bytes.
+  GMappedFile *mapped;          ///< Raw file mapping with the image bytes,
+  ///< NULL if the bytes are allocated.
+  Ktx *ktx;                     ///< Compressed texture, NULL for RGBA bytes.
+  ShaderProgram *program;       ///< Shared texture program.
   GLint uniform_texture;        ///< Texture constant.
   GLint attribute_texture;      ///< Texture variable.
   GLint attribute_texture_position;     ///< Texture variable position.
@@ -19,17 +60,93 @@ typedef struct
   GLuint vbo;                   ///< Vertices buffer object.
   GLuint ibo;                   ///< Indices buffer object.
   GLuint vbo_texture;           ///< Texture vertex buffer object.
-  GLuint program_texture;       ///< Texture program.
+  GLuint program_texture;       ///< Texture program identifier.
   GLuint id_texture;            ///< Texture identifier.
   unsigned int width;           ///< Width.
   unsigned int height;          ///< Height.
   unsigned int size;            ///< Size in bytes.
 } Image;
 
+/**
+ * \enum ImageLoadState
+ * \brief States of an asynchronous image load.
+ */
+enum ImageLoadState
+{
+  IMAGE_LOAD_QUEUED = 0,        ///< Waiting or decoding on a worker thread.
+  IMAGE_LOAD_HEADER = 1,        ///< Header read, waiting for the GL thread to
+  ///< map the pixels memory.
+  IMAGE_LOAD_DECODED = 2,       ///< Decoded, waiting for the GL thread.
+  IMAGE_LOAD_FAILED = 3,        ///< Decoding failed, not yet reported.
+  IMAGE_LOAD_READY = 4,         ///< Ready to draw.
+  IMAGE_LOAD_ERROR = 5,         ///< Error.
+  IMAGE_LOAD_CANCELLED = 6,     ///< Destroyed while decoding.
+};
+
+typedef struct _ImageLoad ImageLoad;
+
+/**
+ * \typedef ImageLoadCallback
+ * \brief Function called on the GL thread when an image load finishes.
+ */
+typedef void (*ImageLoadCallback) (ImageLoad * load, void *data);
+
+/**
+ * \struct _ImageLoad
+ * \brief A struct to define an image decoded on a worker thread.
+ */
+struct _ImageLoad
+{
+  char *name;                   ///< Image file name.
+  Image *image;                 ///< Image struct, NULL until the header is
+  ///< read.
+  void *reader;                 ///< Image reader while decoding.
+  GLubyte *pixels;              ///< Memory to decode the pixels, a mapped
+  ///< pixel buffer object or the image bytes.
+  int pbo;                      ///< Pixel buffer object slot, -1 for none.
+  ImageLoadCallback callback;   ///< Function called when finished.
+  void *data;                   ///< User data of the callback.
+  gint state;                   ///< Load state, atomic.
+};
+
+/**
+ * \struct ImageStream
+ * \brief A struct to define an image file read row by row.
+ */
+typedef struct
+{
+  void *reader;                 ///< Image reader.
+  GLubyte *pixels;              ///< Decoded pixels, NULL if reading row by
+  ///< row.
+  gsize size;                   ///< Size in bytes of the decoded pixels.
+  unsigned int row;             ///< Next row, top-down.
+} ImageStream;
+
+int image_decode (const char *name, unsigned int width, unsigned int height,
+                  GLubyte * pixels);
+ImageStream *image_stream_open (const char *name, unsigned int *width,
+                                unsigned int *height);
+int image_stream_read (ImageStream * stream, GLubyte * rows,
+                       unsigned int nrows);
+void image_stream_close (ImageStream * stream);
 Image *image_new (char *name);
+void image_free (Image * image);
+int image_write (const char *name, unsigned int width, unsigned int height,
+                 const GLubyte * pixels, unsigned int format);
+int image_save (Image * image, const char *name, unsigned int format);
+void image_set_cache (int enable);
+void image_downsample (const GLubyte * pixels, unsigned int width,
+                       unsigned int height, GLubyte * next);
 void image_destroy (Image * image);
+ShaderProgram *image_program_submit ();
+ShaderProgram *image_program ();
 int image_init (Image * image);
 void image_draw (Image * image, unsigned int window_width,
                  unsigned int window_height);
+ImageLoad *image_load_new (const char *name, ImageLoadCallback callback,
+                           void *data);
+unsigned int image_load_poll (ImageLoad * load);
+void image_load_destroy (ImageLoad * load);
+void image_load_finish ();
 
 #endif
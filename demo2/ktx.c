@@ -0,0 +1,1558 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <epoxy/gl.h>
+
+#include "ktx.h"
+
+#define KTX_HEADER 80           ///< Size in bytes of the KTX2 header.
+#define KTX_LEVEL_INDEX 24      ///< Size in bytes of a level index entry.
+#define KTX_DFD 60              ///< Maximum size in bytes of the data format
+///< descriptor.
+#define KTX_SELECT(mask, a, b) \
+  ((KtxLanes) (((mask) & (KtxMask) (a)) | (~(mask) & (KtxMask) (b))))
+///< Lanes of a where the mask lanes are set, lanes of b otherwise.
+
+static const unsigned char ktx_identifier[12] = {
+  0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'
+};
+///< Identifier of the KTX2 files.
+
+static const int ktx_etc_modifiers[8][2] = {
+  {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106},
+  {47, 183}
+};
+///< ETC1 intensity modifiers.
+
+static const int ktx_etc_distances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+///< ETC2 T and H modes distances.
+
+static const int ktx_eac_modifiers[16][8] = {
+  {-3, -6, -9, -15, 2, 5, 8, 14},
+  {-3, -7, -10, -13, 2, 6, 9, 12},
+  {-2, -5, -8, -13, 1, 4, 7, 12},
+  {-2, -4, -6, -13, 1, 3, 5, 12},
+  {-3, -6, -8, -12, 2, 5, 7, 11},
+  {-3, -7, -9, -11, 2, 6, 8, 10},
+  {-4, -7, -8, -11, 3, 6, 7, 10},
+  {-3, -5, -8, -11, 2, 4, 7, 10},
+  {-2, -6, -8, -10, 1, 5, 7, 9},
+  {-2, -5, -8, -10, 1, 4, 7, 9},
+  {-2, -4, -8, -10, 1, 3, 7, 9},
+  {-2, -5, -7, -10, 1, 4, 6, 9},
+  {-3, -4, -7, -10, 2, 3, 6, 9},
+  {-1, -2, -3, -10, 0, 1, 2, 9},
+  {-4, -6, -8, -9, 3, 5, 7, 8},
+  {-3, -5, -7, -9, 2, 4, 6, 8}
+};
+///< EAC alpha modifiers.
+
+static const guint16 ktx_bc7_partitions2[64] = {
+  0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+  0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+  0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+  0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+  0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+  0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+  0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+  0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22
+};
+///< BC7 2 subsets partitions, a bit per pixel set in the second subset.
+
+static const guint32 ktx_bc7_partitions3[64] = {
+  0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050,
+  0x5555a0a0, 0x5a5a5050, 0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090,
+  0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250, 0xa5945040, 0x0a425054,
+  0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+  0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414,
+  0x50a4a450, 0x6a5a0200, 0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424,
+  0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50, 0x500aa550, 0xaaaa4444,
+  0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+  0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580,
+  0xaa141414, 0x96960000, 0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000,
+  0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254
+};
+///< BC7 3 subsets partitions, the subset of every pixel in 2 bits.
+
+static const guint8 ktx_bc7_anchors[3][64] = {
+  {
+   15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+   15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+   15, 15, 6, 8, 2, 8, 15, 15, 2, 8, 2, 2, 2, 15, 15, 6,
+   6, 2, 6, 8, 15, 15, 2, 2, 15, 15, 15, 15, 15, 2, 2, 15},
+  {
+   3, 3, 15, 15, 8, 3, 15, 15, 8, 8, 6, 6, 6, 5, 3, 3,
+   3, 3, 8, 15, 3, 3, 6, 10, 5, 8, 8, 6, 8, 5, 15, 15,
+   8, 15, 3, 5, 6, 10, 8, 15, 15, 3, 15, 5, 15, 15, 15, 15,
+   3, 15, 5, 5, 5, 8, 5, 10, 5, 10, 8, 13, 15, 12, 3, 3},
+  {
+   15, 8, 8, 3, 15, 15, 3, 8, 15, 15, 15, 15, 15, 15, 15, 8,
+   15, 8, 15, 3, 15, 8, 15, 8, 3, 15, 6, 10, 15, 15, 10, 8,
+   15, 3, 15, 10, 10, 8, 9, 10, 6, 15, 8, 15, 3, 6, 6, 8,
+   15, 3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3, 15, 15, 8}
+};
+///< BC7 anchor pixels of the second subset of 2 subsets partitions and of the
+///< second and third subsets of 3 subsets partitions.
+
+/**
+ * Function to read a little endian 32 bits number.
+ *
+ * \return number.
+ */
+static inline guint32
+ktx_read32 (const guint8 * b)   ///< Bytes.
+{
+  guint32 x;
+  memcpy (&x, b, 4);
+  return GUINT32_FROM_LE (x);
+}
+
+/**
+ * Function to read a little endian 64 bits number.
+ *
+ * \return number.
+ */
+static inline guint64
+ktx_read64 (const guint8 * b)   ///< Bytes.
+{
+  guint64 x;
+  memcpy (&x, b, 8);
+  return GUINT64_FROM_LE (x);
+}
+
+/**
+ * Function to clamp a color component.
+ *
+ * \return color component in [0, 255].
+ */
+static inline guint8
+ktx_clamp (int x)               ///< Color component.
+{
+  return (guint8) CLAMP (x, 0, 255);
+}
+
+typedef float KtxLanes __attribute__ ((vector_size (4 * sizeof (float))));
+///< Vector of a component of 4 pixels. The components and their squared
+///< errors are exact integers in single precision.
+typedef gint32 KtxMask __attribute__ ((vector_size (4 * sizeof (gint32))));
+///< Vector of 4 pixel masks or indices.
+
+/**
+ * \struct KtxBlock
+ * \brief A struct to define the pixels of a 4x4 block encoded 4 at once.
+ */
+typedef struct
+{
+  KtxLanes rows[4][4];          ///< Components by rows, a lane per column.
+  KtxLanes columns[4][4];       ///< Components by columns, a lane per row.
+} KtxBlock;
+
+/**
+ * \struct KtxFormat
+ * \brief A struct to define a supported compressed format.
+ */
+typedef struct
+{
+  const char *name;             ///< Name.
+  guint32 vk_format;            ///< Vulkan format.
+  GLenum format;                ///< GL compressed internal format.
+  unsigned int block_size;      ///< Size in bytes of a block.
+  unsigned int model;           ///< Data format descriptor color model.
+  unsigned int alpha;           ///< 1 if the block has an alpha sample.
+} KtxFormat;
+
+static const KtxFormat ktx_formats[] = {
+  {"bc1", 131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 8, 128, 0},
+  {"bc1a", 133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8, 128, 1},
+  {"bc3", 137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16, 130, 1},
+  {"bc7", 145, GL_COMPRESSED_RGBA_BPTC_UNORM, 16, 133, 0},
+  {"etc2", 147, GL_COMPRESSED_RGB8_ETC2, 8, 161, 0},
+  {"etc2a", 151, GL_COMPRESSED_RGBA8_ETC2_EAC, 16, 161, 1},
+};
+///< Supported formats: BC1 RGB, BC1 RGBA, BC3, BC7, ETC2 RGB8 and ETC2 RGBA8.
+
+/**
+ * \struct KtxBc7Mode
+ * \brief A struct to define the layout of a BC7 block mode.
+ */
+typedef struct
+{
+  unsigned int subsets;         ///< Number of subsets.
+  unsigned int partition_bits;  ///< Bits of the partition number.
+  unsigned int rotation_bits;   ///< Bits of the component rotation.
+  unsigned int selector_bits;   ///< Bits of the index selector.
+  unsigned int color_bits;      ///< Bits of a color component of an endpoint.
+  unsigned int alpha_bits;      ///< Bits of the alpha of an endpoint.
+  unsigned int endpoint_pbits;  ///< 1 if every endpoint has a p-bit.
+  unsigned int shared_pbits;    ///< 1 if the endpoints of a subset share one.
+  unsigned int index_bits;      ///< Bits of an index.
+  unsigned int index2_bits;     ///< Bits of a secondary index, 0 for none.
+} KtxBc7Mode;
+
+static const KtxBc7Mode ktx_bc7_modes[8] = {
+  {3, 4, 0, 0, 4, 0, 1, 0, 3, 0},
+  {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+  {3, 6, 0, 0, 5, 0, 0, 0, 2, 0},
+  {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+  {1, 0, 2, 1, 5, 6, 0, 0, 2, 3},
+  {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+  {1, 0, 0, 0, 7, 7, 1, 0, 4, 0},
+  {2, 6, 0, 0, 5, 5, 1, 0, 2, 0}
+};
+///< BC7 block modes.
+
+static const guint8 ktx_bc7_weights2[4] = { 0, 21, 43, 64 };
+///< BC7 2 bits index weights.
+static const guint8 ktx_bc7_weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+///< BC7 3 bits index weights.
+static const guint8 ktx_bc7_weights4[16] = {
+  0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+///< BC7 4 bits index weights.
+
+/**
+ * Function to get a supported format by its Vulkan or GL format.
+ *
+ * \return pointer to the KtxFormat struct, NULL if not supported.
+ */
+static const KtxFormat *
+ktx_format (guint32 vk_format,  ///< Vulkan format, 0 to search the GL format.
+            GLenum format)      ///< GL compressed internal format.
+{
+  unsigned int i;
+  for (i = 0; i < G_N_ELEMENTS (ktx_formats); ++i)
+    if (vk_format ? ktx_formats[i].vk_format == vk_format
+        : ktx_formats[i].format == format)
+      return ktx_formats + i;
+  return NULL;
+}
+
+/**
+ * Function to check if the GL context can sample a compressed format. It has
+ *   to be called on the GL thread.
+ *
+ * \return 1 if the format is supported, 0 otherwise.
+ */
+static int
+ktx_supported (GLenum format)   ///< GL compressed internal format.
+{
+  int version, desktop;
+  version = epoxy_gl_version ();
+  desktop = epoxy_is_desktop_gl ();
+  switch (format)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+      if (epoxy_has_gl_extension ("GL_EXT_texture_compression_dxt1"))
+        return 1;
+      // fallthrough
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+      return epoxy_has_gl_extension ("GL_EXT_texture_compression_s3tc");
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+      if (desktop)
+        return version >= 42
+          || epoxy_has_gl_extension ("GL_ARB_texture_compression_bptc");
+      return epoxy_has_gl_extension ("GL_EXT_texture_compression_bptc");
+    case GL_COMPRESSED_RGB8_ETC2:
+    case GL_COMPRESSED_RGBA8_ETC2_EAC:
+      if (desktop)
+        return version >= 43
+          || epoxy_has_gl_extension ("GL_ARB_ES3_compatibility");
+      return version >= 30;
+    }
+  return 0;
+}
+
+/**
+ * Function to get the GL compressed internal format of a format name: "bc1",
+ *   "bc1a", "bc3", "bc7", "etc2" or "etc2a".
+ *
+ * \return GL compressed internal format, 0 if unknown.
+ */
+GLenum
+ktx_format_name (const char *name)      ///< Format name.
+{
+  unsigned int i;
+  for (i = 0; i < G_N_ELEMENTS (ktx_formats); ++i)
+    if (!strcmp (name, ktx_formats[i].name))
+      return ktx_formats[i].format;
+  return 0;
+}
+
+/**
+ * Function to map a KTX2 file with a compressed 2D texture.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+ktx_open (Ktx * ktx,            ///< Ktx struct.
+          const char *name)     ///< KTX2 file name.
+{
+  const KtxFormat *format;
+  const guint8 *bytes, *index;
+  const char *error_message;
+  guint64 offset, size;
+  gsize length;
+  unsigned int i, width, height;
+
+  ktx->mapped = g_mapped_file_new (name, FALSE, NULL);
+  if (!ktx->mapped)
+    {
+      error_message = "unable to map the file";
+      goto exit_on_error;
+    }
+  length = g_mapped_file_get_length (ktx->mapped);
+  bytes = (const guint8 *) g_mapped_file_get_contents (ktx->mapped);
+  if (length < KTX_HEADER || memcmp (bytes, ktx_identifier, 12))
+    {
+      error_message = "bad header";
+      goto exit_on_error;
+    }
+
+  // Only not supercompressed 2D textures without arrays or faces
+  format = ktx_format (ktx_read32 (bytes + 12), 0);
+  if (!format)
+    {
+      error_message = "unsupported format";
+      goto exit_on_error;
+    }
+  ktx->format = format->format;
+  ktx->block_size = format->block_size;
+  ktx->width = ktx_read32 (bytes + 20);
+  ktx->height = ktx_read32 (bytes + 24);
+  ktx->nlevels = MAX (1, ktx_read32 (bytes + 40));
+  if (!ktx->width || !ktx->height || ktx_read32 (bytes + 28) > 1
+      || ktx_read32 (bytes + 32) > 1 || ktx_read32 (bytes + 36) != 1
+      || ktx_read32 (bytes + 44) || ktx->nlevels > KTX_LEVELS
+      || length < KTX_HEADER + KTX_LEVEL_INDEX * ktx->nlevels)
+    {
+      error_message = "unsupported texture type";
+      goto exit_on_error;
+    }
+
+  // Level index, checking the size of every level
+  for (i = 0; i < ktx->nlevels; ++i)
+    {
+      index = bytes + KTX_HEADER + KTX_LEVEL_INDEX * i;
+      offset = ktx_read64 (index);
+      size = ktx_read64 (index + 8);
+      width = MAX (1, ktx->width >> i);
+      height = MAX (1, ktx->height >> i);
+      ktx->levels[i].offset = offset;
+      ktx->levels[i].size
+        = ((width + 3) / 4) * ((height + 3) / 4) * (gsize) ktx->block_size;
+      if (size < ktx->levels[i].size || offset > length
+          || size > length - offset)
+        {
+          error_message = "bad level";
+          goto exit_on_error;
+        }
+    }
+  ktx->top_down = 0;
+  return 1;
+
+exit_on_error:
+  printf ("ERROR! Ktx: %s: %s\n", name, error_message);
+  if (ktx->mapped)
+    g_mapped_file_unref (ktx->mapped);
+  ktx->mapped = NULL;
+  return 0;
+}
+
+/**
+ * Function to get the palette of a BC1 color block.
+ */
+static void
+ktx_bc1_palette (guint32 c0,    ///< First RGB565 color.
+                 guint32 c1,    ///< Second RGB565 color.
+                 int alpha,     ///< 1 to get the transparent color.
+                 int four,      ///< 1 to use always four colors.
+                 guint8 palette[4][4])  ///< Palette.
+{
+  guint32 c;
+  unsigned int i, j;
+  for (i = 0; i < 2; ++i)
+    {
+      c = i ? c1 : c0;
+      palette[i][0] = ((c >> 8) & 0xf8) | (c >> 13);
+      palette[i][1] = ((c >> 3) & 0xfc) | ((c >> 9) & 3);
+      palette[i][2] = ((c << 3) & 0xf8) | ((c >> 2) & 7);
+      palette[i][3] = 255;
+    }
+  for (j = 0; j < 3; ++j)
+    if (c0 > c1 || four)
+      {
+        palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+        palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+      }
+    else
+      {
+        palette[2][j] = (palette[0][j] + palette[1][j]) / 2;
+        palette[3][j] = 0;
+      }
+  palette[2][3] = 255;
+  palette[3][3] = (c0 > c1 || four || !alpha) ? 255 : 0;
+}
+
+/**
+ * Function to decode a BC1 color block.
+ */
+static void
+ktx_decode_bc1 (const guint8 * b,       ///< Block.
+                guint8 * rgba,  ///< Decoded 4x4 pixels, row by row.
+                int alpha,      ///< 1 to decode the transparent color.
+                int four)       ///< 1 to use always four colors.
+{
+  guint8 palette[4][4];
+  guint32 indices;
+  unsigned int i;
+
+  ktx_bc1_palette (b[0] | (b[1] << 8), b[2] | (b[3] << 8), alpha, four,
+                   palette);
+  indices = ktx_read32 (b + 4);
+  for (i = 0; i < 16; ++i)
+    memcpy (rgba + 4 * i, palette[(indices >> (2 * i)) & 3], 4);
+}
+
+/**
+ * Function to get the palette of a BC3 alpha block.
+ */
+static void
+ktx_bc3_palette (unsigned int a0,       ///< First alpha.
+                 unsigned int a1,       ///< Second alpha.
+                 guint8 * palette)      ///< Palette.
+{
+  unsigned int i;
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1)
+    for (i = 2; i < 8; ++i)
+      palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+  else
+    {
+      for (i = 2; i < 6; ++i)
+        palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+      palette[6] = 0;
+      palette[7] = 255;
+    }
+}
+
+/**
+ * Function to decode a BC3 block.
+ */
+static void
+ktx_decode_bc3 (const guint8 * b,       ///< Block.
+                guint8 * rgba)  ///< Decoded 4x4 pixels, row by row.
+{
+  guint8 palette[8];
+  guint64 indices;
+  unsigned int i;
+
+  ktx_decode_bc1 (b + 8, rgba, 0, 1);
+  ktx_bc3_palette (b[0], b[1], palette);
+  indices = ktx_read64 (b) >> 16;
+  for (i = 0; i < 16; ++i)
+    rgba[4 * i + 3] = palette[(indices >> (3 * i)) & 7];
+}
+
+/**
+ * Function to decode an ETC2 RGB block. The alpha components are not set.
+ */
+static void
+ktx_decode_etc2 (const guint8 * b,      ///< Block.
+                 guint8 * rgba) ///< Decoded 4x4 pixels, row by row.
+{
+  int base[2][3], paint[4][3], o[3], h[3], v[3];
+  guint32 hi, lo;
+  unsigned int i, j, k, x, y, idx, sub, cw[2];
+  int d, s[3];
+
+  hi = ((guint32) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+  lo = ((guint32) b[4] << 24) | (b[5] << 16) | (b[6] << 8) | b[7];
+  if (hi & 2)
+    {
+      // Differential mode, the overflows select the ETC2 modes
+      for (k = 0; k < 3; ++k)
+        {
+          base[0][k] = (hi >> (27 - 8 * k)) & 31;
+          d = (hi >> (24 - 8 * k)) & 7;
+          s[k] = base[0][k] + ((d ^ 4) - 4);
+        }
+      if (s[0] < 0 || s[0] > 31)
+        goto t_mode;
+      if (s[1] < 0 || s[1] > 31)
+        goto h_mode;
+      if (s[2] < 0 || s[2] > 31)
+        goto planar_mode;
+      for (k = 0; k < 3; ++k)
+        {
+          base[1][k] = (s[k] << 3) | (s[k] >> 2);
+          base[0][k] = (base[0][k] << 3) | (base[0][k] >> 2);
+        }
+    }
+  else
+    {
+      // Individual mode
+      for (k = 0; k < 3; ++k)
+        {
+          base[0][k] = ((hi >> (28 - 8 * k)) & 15) * 17;
+          base[1][k] = ((hi >> (24 - 8 * k)) & 15) * 17;
+        }
+    }
+
+  // ETC1 sub-blocks
+  cw[0] = (hi >> 5) & 7;
+  cw[1] = (hi >> 2) & 7;
+  for (x = 0; x < 4; ++x)
+    for (y = 0; y < 4; ++y)
+      {
+        i = 4 * x + y;
+        sub = (hi & 1) ? y >= 2 : x >= 2;
+        idx = (((lo >> (i + 16)) & 1) << 1) | ((lo >> i) & 1);
+        d = ktx_etc_modifiers[cw[sub]][idx & 1];
+        if (idx & 2)
+          d = -d;
+        for (k = 0; k < 3; ++k)
+          rgba[4 * (4 * y + x) + k] = ktx_clamp (base[sub][k] + d);
+      }
+  return;
+
+t_mode:
+  base[0][0] = (((hi >> 27) & 3) << 2) | ((hi >> 24) & 3);
+  base[0][1] = (hi >> 20) & 15;
+  base[0][2] = (hi >> 16) & 15;
+  base[1][0] = (hi >> 12) & 15;
+  base[1][1] = (hi >> 8) & 15;
+  base[1][2] = (hi >> 4) & 15;
+  d = ktx_etc_distances[(((hi >> 2) & 3) << 1) | (hi & 1)];
+  for (k = 0; k < 3; ++k)
+    {
+      paint[0][k] = base[0][k] * 17;
+      paint[2][k] = base[1][k] * 17;
+      paint[1][k] = ktx_clamp (paint[2][k] + d);
+      paint[3][k] = ktx_clamp (paint[2][k] - d);
+    }
+  goto paint;
+
+h_mode:
+  base[0][0] = (hi >> 27) & 15;
+  base[0][1] = (((hi >> 24) & 7) << 1) | ((hi >> 20) & 1);
+  base[0][2] = (((hi >> 19) & 1) << 3) | ((hi >> 15) & 7);
+  base[1][0] = (hi >> 11) & 15;
+  base[1][1] = (hi >> 7) & 15;
+  base[1][2] = (hi >> 3) & 15;
+  d = ktx_etc_distances[(((hi >> 2) & 1) << 2) | ((hi & 1) << 1)
+                        | (((base[0][0] << 8) | (base[0][1] << 4)
+                            | base[0][2]) >= ((base[1][0] << 8)
+                                              | (base[1][1] << 4)
+                                              | base[1][2]))];
+  for (k = 0; k < 3; ++k)
+    {
+      paint[0][k] = ktx_clamp (base[0][k] * 17 + d);
+      paint[1][k] = ktx_clamp (base[0][k] * 17 - d);
+      paint[2][k] = ktx_clamp (base[1][k] * 17 + d);
+      paint[3][k] = ktx_clamp (base[1][k] * 17 - d);
+    }
+
+paint:
+  for (x = 0; x < 4; ++x)
+    for (y = 0; y < 4; ++y)
+      {
+        i = 4 * x + y;
+        idx = (((lo >> (i + 16)) & 1) << 1) | ((lo >> i) & 1);
+        for (k = 0; k < 3; ++k)
+          rgba[4 * (4 * y + x) + k] = paint[idx][k];
+      }
+  return;
+
+planar_mode:
+  o[0] = (hi >> 25) & 63;
+  o[1] = (((hi >> 24) & 1) << 6) | ((hi >> 17) & 63);
+  o[2] = (((hi >> 16) & 1) << 5) | (((hi >> 11) & 3) << 3) | ((hi >> 7) & 7);
+  h[0] = (((hi >> 2) & 31) << 1) | (hi & 1);
+  h[1] = (lo >> 25) & 127;
+  h[2] = (lo >> 19) & 63;
+  v[0] = (lo >> 13) & 63;
+  v[1] = (lo >> 6) & 127;
+  v[2] = lo & 63;
+  for (k = 0; k < 3; k += 2)
+    {
+      o[k] = (o[k] << 2) | (o[k] >> 4);
+      h[k] = (h[k] << 2) | (h[k] >> 4);
+      v[k] = (v[k] << 2) | (v[k] >> 4);
+    }
+  o[1] = (o[1] << 1) | (o[1] >> 6);
+  h[1] = (h[1] << 1) | (h[1] >> 6);
+  v[1] = (v[1] << 1) | (v[1] >> 6);
+  for (y = 0; y < 4; ++y)
+    for (x = 0; x < 4; ++x)
+      for (k = 0; k < 3; ++k)
+        {
+          j = 4 * (4 * y + x) + k;
+          rgba[j] = ktx_clamp (((int) x * (h[k] - o[k])
+                                + (int) y * (v[k] - o[k]) + 4 * o[k] + 2)
+                               >> 2);
+        }
+}
+
+/**
+ * Function to decode an EAC alpha block.
+ */
+static void
+ktx_decode_eac (const guint8 * b,       ///< Block.
+                guint8 * rgba)  ///< Decoded 4x4 pixels, row by row.
+{
+  const int *modifiers;
+  guint64 indices;
+  unsigned int i, x, y;
+
+  modifiers = ktx_eac_modifiers[b[1] & 15];
+  indices = 0;
+  for (i = 2; i < 8; ++i)
+    indices = (indices << 8) | b[i];
+  for (x = 0; x < 4; ++x)
+    for (y = 0; y < 4; ++y)
+      {
+        i = 4 * x + y;
+        rgba[4 * (4 * y + x) + 3]
+          = ktx_clamp (b[0] + modifiers[(indices >> (45 - 3 * i)) & 7]
+                       * (b[1] >> 4));
+      }
+}
+
+/**
+ * Function to read bits of a BC7 block, least significant first.
+ *
+ * \return bits.
+ */
+static unsigned int
+ktx_bc7_bits (const guint8 * b, ///< Block.
+              unsigned int *position,   ///< Position of the first bit.
+              unsigned int n)   ///< Number of bits.
+{
+  unsigned int i, x;
+  for (i = x = 0; i < n; ++i, ++*position)
+    x |= ((b[*position >> 3] >> (*position & 7)) & 1) << i;
+  return x;
+}
+
+/**
+ * Function to interpolate a BC7 endpoints component.
+ *
+ * \return interpolated component.
+ */
+static inline guint8
+ktx_bc7_interpolate (unsigned int e0,   ///< First endpoint component.
+                     unsigned int e1,   ///< Second endpoint component.
+                     unsigned int index,        ///< Index.
+                     unsigned int bits) ///< Bits of the index.
+{
+  unsigned int w;
+  switch (bits)
+    {
+    case 2:
+      w = ktx_bc7_weights2[index];
+      break;
+    case 3:
+      w = ktx_bc7_weights3[index];
+      break;
+    default:
+      w = ktx_bc7_weights4[index];
+    }
+  return (guint8) (((64 - w) * e0 + w * e1 + 32) >> 6);
+}
+
+/**
+ * Function to decode a BC7 block. The blocks with a reserved mode are decoded
+ *   as transparent black.
+ */
+static void
+ktx_decode_bc7 (const guint8 * b,       ///< Block.
+                guint8 * rgba)  ///< Decoded 4x4 pixels, row by row.
+{
+  const KtxBc7Mode *mode;
+  unsigned int endpoints[3][2][4], indices[16], indices2[16];
+  unsigned int i, j, k, m, n, p = 0, position, partition, rotation, selector,
+    subset, value, bits, bits2;
+  guint8 x;
+
+  // Mode, the number of low zero bits
+  for (m = 0; m < 8 && !(b[0] & (1 << m));)
+    ++m;
+  if (m == 8)
+    {
+      memset (rgba, 0, 64);
+      return;
+    }
+  mode = ktx_bc7_modes + m;
+  position = m + 1;
+  partition = ktx_bc7_bits (b, &position, mode->partition_bits);
+  rotation = ktx_bc7_bits (b, &position, mode->rotation_bits);
+  selector = ktx_bc7_bits (b, &position, mode->selector_bits);
+
+  // Endpoints
+  for (k = 0; k < 3; ++k)
+    for (i = 0; i < mode->subsets; ++i)
+      for (j = 0; j < 2; ++j)
+        endpoints[i][j][k] = ktx_bc7_bits (b, &position, mode->color_bits);
+  for (i = 0; i < mode->subsets; ++i)
+    for (j = 0; j < 2; ++j)
+      endpoints[i][j][3] = mode->alpha_bits
+        ? ktx_bc7_bits (b, &position, mode->alpha_bits) : 255;
+  bits = mode->color_bits;
+  bits2 = mode->alpha_bits;
+  if (mode->endpoint_pbits || mode->shared_pbits)
+    {
+      for (i = 0; i < mode->subsets; ++i)
+        for (j = 0; j < 2; ++j)
+          {
+            if (mode->endpoint_pbits || !j)
+              p = ktx_bc7_bits (b, &position, 1);
+            for (k = 0; k < 3 + (mode->alpha_bits > 0); ++k)
+              endpoints[i][j][k] = (endpoints[i][j][k] << 1) | p;
+          }
+      ++bits;
+      if (bits2)
+        ++bits2;
+    }
+  for (i = 0; i < mode->subsets; ++i)
+    for (j = 0; j < 2; ++j)
+      {
+        for (k = 0; k < 3; ++k)
+          endpoints[i][j][k] = (endpoints[i][j][k] << (8 - bits))
+            | (endpoints[i][j][k] >> (2 * bits - 8));
+        if (bits2)
+          endpoints[i][j][3] = (endpoints[i][j][3] << (8 - bits2))
+            | (endpoints[i][j][3] >> (2 * bits2 - 8));
+      }
+
+  // Indices, the anchor pixel indices have an implicit high zero bit
+  for (i = 0; i < 16; ++i)
+    {
+      n = mode->index_bits;
+      if (!i)
+        --n;
+      else if (mode->subsets == 2 && i == ktx_bc7_anchors[0][partition])
+        --n;
+      else if (mode->subsets == 3 && (i == ktx_bc7_anchors[1][partition]
+                                      || i == ktx_bc7_anchors[2][partition]))
+        --n;
+      indices[i] = ktx_bc7_bits (b, &position, n);
+    }
+  for (i = 0; i < 16 && mode->index2_bits; ++i)
+    indices2[i] = ktx_bc7_bits (b, &position, mode->index2_bits - !i);
+
+  // Pixels
+  for (i = 0; i < 16; ++i)
+    {
+      switch (mode->subsets)
+        {
+        case 1:
+          subset = 0;
+          break;
+        case 2:
+          subset = (ktx_bc7_partitions2[partition] >> i) & 1;
+          break;
+        default:
+          subset = (ktx_bc7_partitions3[partition] >> (2 * i)) & 3;
+        }
+      for (k = 0; k < 4; ++k)
+        {
+          if (!mode->index2_bits)
+            {
+              value = indices[i];
+              bits = mode->index_bits;
+            }
+          else if ((k == 3) == !selector)
+            {
+              value = indices2[i];
+              bits = mode->index2_bits;
+            }
+          else
+            {
+              value = indices[i];
+              bits = mode->index_bits;
+            }
+          rgba[4 * i + k]
+            = ktx_bc7_interpolate (endpoints[subset][0][k],
+                                   endpoints[subset][1][k], value, bits);
+        }
+      if (rotation)
+        {
+          x = rgba[4 * i + 3];
+          rgba[4 * i + 3] = rgba[4 * i + rotation - 1];
+          rgba[4 * i + rotation - 1] = x;
+        }
+    }
+}
+
+/**
+ * Function to decode a mipmap level of a compressed texture to RGBA pixels. It
+ *   does not use GL, so it can be called from any thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+ktx_decode (Ktx * ktx,          ///< Ktx struct.
+            unsigned int level, ///< Mipmap level.
+            GLubyte * pixels)   ///< Pixels in the OpenGL order.
+{
+  guint8 rgba[64];
+  const guint8 *block;
+  unsigned int width, height, bx, by, x, y, w, h;
+
+  if (level >= ktx->nlevels)
+    return 0;
+  width = MAX (1, ktx->width >> level);
+  height = MAX (1, ktx->height >> level);
+  block = (const guint8 *) g_mapped_file_get_contents (ktx->mapped)
+    + ktx->levels[level].offset;
+  for (by = 0; by < height; by += 4)
+    for (bx = 0; bx < width; bx += 4, block += ktx->block_size)
+      {
+        switch (ktx->format)
+          {
+          case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            ktx_decode_bc1 (block, rgba, 0, 0);
+            break;
+          case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+            ktx_decode_bc1 (block, rgba, 1, 0);
+            break;
+          case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            ktx_decode_bc3 (block, rgba);
+            break;
+          case GL_COMPRESSED_RGBA_BPTC_UNORM:
+            ktx_decode_bc7 (block, rgba);
+            break;
+          case GL_COMPRESSED_RGB8_ETC2:
+            ktx_decode_etc2 (block, rgba);
+            for (x = 3; x < 64; x += 4)
+              rgba[x] = 255;
+            break;
+          default:
+            ktx_decode_etc2 (block + 8, rgba);
+            ktx_decode_eac (block, rgba);
+          }
+
+        // Copying the block rows, the texture rows are top-down
+        w = MIN (4, width - bx);
+        h = MIN (4, height - by);
+        for (y = 0; y < h; ++y)
+          memcpy (pixels + 4 * ((gsize) width * (height - 1 - by - y) + bx),
+                  rgba + 16 * y, 4 * w);
+      }
+  return 1;
+}
+
+/**
+ * Function to load the pixels of a block by rows and by columns.
+ */
+static inline void
+ktx_block_load (const guint8 * rgba,    ///< 4x4 pixels, row by row.
+                KtxBlock * block)       ///< KtxBlock struct.
+{
+  unsigned int x, y, k;
+  for (y = 0; y < 4; ++y)
+    for (x = 0; x < 4; ++x)
+      for (k = 0; k < 4; ++k)
+        block->rows[k][y][x] = block->columns[k][x][y]
+          = rgba[4 * (4 * y + x) + k];
+}
+
+/**
+ * Function to add the lanes of a vector.
+ *
+ * \return sum.
+ */
+static inline unsigned int
+ktx_lanes_sum (const KtxLanes * a)      ///< Vector.
+{
+  return (unsigned int) ((*a)[0] + (*a)[1] + (*a)[2] + (*a)[3]);
+}
+
+/**
+ * Function to get the minimum and the maximum lanes of 4 vectors where a mask
+ *   is set.
+ */
+static inline void
+ktx_lanes_range (const KtxLanes * a,    ///< Vectors.
+                 const KtxMask * mask,  ///< Masks.
+                 unsigned int *min,     ///< Minimum, 255 if no lane is set.
+                 unsigned int *max)     ///< Maximum, 0 if no lane is set.
+{
+  KtxLanes lo, hi, x;
+  unsigned int i;
+  lo = (KtxLanes) { 255.f, 255.f, 255.f, 255.f };
+  hi = (KtxLanes) { 0.f, 0.f, 0.f, 0.f };
+  for (i = 0; i < 4; ++i)
+    {
+      x = KTX_SELECT (mask[i] & (a[i] < lo), a[i], lo);
+      lo = x;
+      x = KTX_SELECT (mask[i] & (a[i] > hi), a[i], hi);
+      hi = x;
+    }
+  *min = (unsigned int) MIN (MIN (lo[0], lo[1]), MIN (lo[2], lo[3]));
+  *max = (unsigned int) MAX (MAX (hi[0], hi[1]), MAX (hi[2], hi[3]));
+}
+
+/**
+ * Function to get the nearest entries of a RGB palette of 4 pixels. The first
+ *   nearest entry is selected on ties.
+ */
+static inline void
+ktx_lanes_rgb (const KtxLanes * r,      ///< Red lanes.
+               const KtxLanes * g,      ///< Green lanes.
+               const KtxLanes * b,      ///< Blue lanes.
+               const float palette[][3],        ///< Palette.
+               unsigned int n,  ///< Number of palette entries.
+               KtxLanes * emin, ///< Squared errors of the nearest entries.
+               KtxMask * best)  ///< Nearest entries.
+{
+  KtxLanes d0, d1, d2, e;
+  KtxMask mask;
+  unsigned int j;
+  d0 = *r - palette[0][0];
+  d1 = *g - palette[0][1];
+  d2 = *b - palette[0][2];
+  *emin = d0 * d0 + d1 * d1 + d2 * d2;
+  *best = (KtxMask) { 0, 0, 0, 0 };
+  for (j = 1; j < n; ++j)
+    {
+      d0 = *r - palette[j][0];
+      d1 = *g - palette[j][1];
+      d2 = *b - palette[j][2];
+      e = d0 * d0 + d1 * d1 + d2 * d2;
+      mask = e < *emin;
+      *emin = KTX_SELECT (mask, e, *emin);
+      *best = (mask & (gint32) j) | (~mask & *best);
+    }
+}
+
+/**
+ * Function to get the nearest entries of an alpha palette of 4 pixels. The
+ *   first nearest entry is selected on ties.
+ */
+static inline void
+ktx_lanes_alpha (const KtxLanes * a,    ///< Alpha lanes.
+                 const float *palette,  ///< Palette.
+                 unsigned int n,        ///< Number of palette entries.
+                 KtxLanes * emin,       ///< Squared errors of the nearest.
+                 KtxMask * best)        ///< Nearest entries.
+{
+  KtxLanes d;
+  KtxMask mask;
+  unsigned int j;
+  d = *a - palette[0];
+  *emin = d * d;
+  *best = (KtxMask) { 0, 0, 0, 0 };
+  for (j = 1; j < n; ++j)
+    {
+      d = *a - palette[j];
+      d *= d;
+      mask = d < *emin;
+      *emin = KTX_SELECT (mask, d, *emin);
+      *best = (mask & (gint32) j) | (~mask & *best);
+    }
+}
+
+/**
+ * Function to encode a BC1 color block with the bounding box endpoints.
+ */
+static void
+ktx_encode_bc1 (const KtxBlock * block, ///< KtxBlock struct.
+                guint8 * b,     ///< Block.
+                int alpha,      ///< 1 to encode the transparent pixels.
+                int four)       ///< 1 to use always four colors.
+{
+  guint8 palette[4][4];
+  float colors[4][3];
+  KtxLanes emin;
+  KtxMask opaque[4], best;
+  guint32 c0, c1, indices;
+  unsigned int i, j, k, n, transparent, inset, lo[3], hi[3];
+
+  // Bounding box of the opaque pixels
+  transparent = 0;
+  for (i = 0; i < 4; ++i)
+    {
+      opaque[i] = block->rows[3][i] >= (alpha ? 128.f : 0.f);
+      for (j = 0; j < 4; ++j)
+        transparent |= !opaque[i][j];
+    }
+  for (k = 0; k < 3; ++k)
+    {
+      ktx_lanes_range (block->rows[k], opaque, lo + k, hi + k);
+      if (lo[k] > hi[k])
+        lo[k] = hi[k] = 0;
+      inset = (hi[k] - lo[k]) / 16;
+      hi[k] -= inset;
+      lo[k] += inset;
+    }
+  c0 = ((hi[0] >> 3) << 11) | ((hi[1] >> 2) << 5) | (hi[2] >> 3);
+  c1 = ((lo[0] >> 3) << 11) | ((lo[1] >> 2) << 5) | (lo[2] >> 3);
+
+  // Four colors if c0 > c1, three colors and transparent otherwise
+  if (transparent ? c0 > c1 : c0 < c1)
+    {
+      i = c0;
+      c0 = c1;
+      c1 = i;
+    }
+  ktx_bc1_palette (c0, c1, alpha, four, palette);
+  for (j = 0; j < 4; ++j)
+    for (k = 0; k < 3; ++k)
+      colors[j][k] = palette[j][k];
+  n = (c0 > c1 || four) ? 4 : 3;
+  indices = 0;
+  for (i = 0; i < 4; ++i)
+    {
+      ktx_lanes_rgb (block->rows[0] + i, block->rows[1] + i,
+                     block->rows[2] + i, colors, n, &emin, &best);
+      if (transparent)
+        best = (opaque[i] & best) | (~opaque[i] & 3);
+      for (j = 0; j < 4; ++j)
+        indices |= (guint32) best[j] << (2 * (4 * i + j));
+    }
+  b[0] = c0;
+  b[1] = c0 >> 8;
+  b[2] = c1;
+  b[3] = c1 >> 8;
+  for (i = 0; i < 4; ++i)
+    b[4 + i] = indices >> (8 * i);
+}
+
+/**
+ * Function to encode a BC3 block.
+ */
+static void
+ktx_encode_bc3 (const KtxBlock * block, ///< KtxBlock struct.
+                guint8 * b)     ///< Block.
+{
+  static const KtxMask all = { -1, -1, -1, -1 };
+  const KtxMask masks[4] = { all, all, all, all };
+  guint8 palette[8];
+  float alphas[8];
+  KtxLanes emin;
+  KtxMask best;
+  guint64 indices;
+  unsigned int i, j, a0, a1;
+
+  ktx_lanes_range (block->rows[3], masks, &a1, &a0);
+  ktx_bc3_palette (a0, a1, palette);
+  for (j = 0; j < 8; ++j)
+    alphas[j] = palette[j];
+  indices = 0;
+  for (i = 0; i < 4; ++i)
+    {
+      ktx_lanes_alpha (block->rows[3] + i, alphas, 8, &emin, &best);
+      for (j = 0; j < 4; ++j)
+        indices |= (guint64) best[j] << (3 * (4 * i + j));
+    }
+  b[0] = a0;
+  b[1] = a1;
+  for (i = 0; i < 6; ++i)
+    b[2 + i] = indices >> (8 * i);
+  ktx_encode_bc1 (block, b + 8, 0, 1);
+}
+
+/**
+ * Function to encode the pixel indices of an ETC1 sub-block with the best
+ *   modifiers table. The sub-block pixels are the lanes of two vectors of
+ *   rows, if flipped, or columns.
+ *
+ * \return squared error.
+ */
+static unsigned int
+ktx_encode_etc1_sub (const KtxLanes (*lanes)[4],        ///< Pixels.
+                     const int *base,   ///< Base color.
+                     unsigned int flip, ///< 1 for horizontal sub-blocks.
+                     unsigned int sub,  ///< Sub-block.
+                     unsigned int *cw,  ///< Modifiers table.
+                     guint32 * lo)      ///< Pixel indices.
+{
+  float colors[4][3];
+  KtxLanes emin[2];
+  KtxMask best[2], best_lanes[2];
+  unsigned int t, i, j, k, v, error, best_error;
+  int d;
+
+  best_error = G_MAXUINT;
+  best_lanes[0] = best_lanes[1] = (KtxMask) { 0, 0, 0, 0 };
+  for (t = 0; t < 8; ++t)
+    {
+      for (j = 0; j < 4; ++j)
+        {
+          d = ktx_etc_modifiers[t][j & 1];
+          if (j & 2)
+            d = -d;
+          for (k = 0; k < 3; ++k)
+            colors[j][k] = ktx_clamp (base[k] + d);
+        }
+      error = 0;
+      for (i = 0; i < 2; ++i)
+        {
+          v = 2 * sub + i;
+          ktx_lanes_rgb (lanes[0] + v, lanes[1] + v, lanes[2] + v, colors, 4,
+                         emin + i, best + i);
+          error += ktx_lanes_sum (emin + i);
+        }
+      if (error < best_error)
+        {
+          best_error = error;
+          best_lanes[0] = best[0];
+          best_lanes[1] = best[1];
+          *cw = t;
+        }
+    }
+
+  // The pixel indices are stored column by column
+  for (i = 0; i < 2; ++i)
+    for (j = 0; j < 4; ++j)
+      {
+        v = 2 * sub + i;
+        k = flip ? 4 * j + v : 4 * v + j;
+        *lo |= (((guint32) best_lanes[i][j] >> 1) << (k + 16))
+          | (((guint32) best_lanes[i][j] & 1) << k);
+      }
+  return best_error;
+}
+
+/**
+ * Function to encode an ETC2 RGB block in the ETC1 individual or
+ *   differential modes.
+ */
+static void
+ktx_encode_etc2 (const KtxBlock * block,        ///< KtxBlock struct.
+                 guint8 * b)    ///< Block.
+{
+  const KtxLanes (*lanes)[4];
+  KtxLanes x;
+  int base[2][3], q[2][3];
+  guint32 hi, lo, best_hi, best_lo;
+  unsigned int flip, sub, k, diff, cw[2], error, best_error, sum[2][3];
+
+  best_error = G_MAXUINT;
+  best_hi = best_lo = 0;
+  for (flip = 0; flip < 2; ++flip)
+    {
+      // Mean colors of the sub-blocks, vertical sub-blocks are the first and
+      // last two columns, horizontal ones the first and last two rows
+      lanes = flip ? block->rows : block->columns;
+      for (sub = 0; sub < 2; ++sub)
+        for (k = 0; k < 3; ++k)
+          {
+            x = lanes[k][2 * sub] + lanes[k][2 * sub + 1];
+            sum[sub][k] = ktx_lanes_sum (&x);
+          }
+      diff = 1;
+      for (k = 0; k < 3; ++k)
+        {
+          q[0][k] = (sum[0][k] * 31 + 1020) / 2040;
+          q[1][k] = (sum[1][k] * 31 + 1020) / 2040;
+          if (q[1][k] - q[0][k] < -4 || q[1][k] - q[0][k] > 3)
+            diff = 0;
+        }
+
+      // Differential mode if the colors are close, individual mode otherwise
+      hi = flip;
+      if (diff)
+        {
+          hi |= 2;
+          for (k = 0; k < 3; ++k)
+            {
+              hi |= ((guint32) q[0][k] << (27 - 8 * k))
+                | (((q[1][k] - q[0][k]) & 7) << (24 - 8 * k));
+              base[0][k] = (q[0][k] << 3) | (q[0][k] >> 2);
+              base[1][k] = (q[1][k] << 3) | (q[1][k] >> 2);
+            }
+        }
+      else
+        for (k = 0; k < 3; ++k)
+          {
+            q[0][k] = (sum[0][k] * 15 + 1020) / 2040;
+            q[1][k] = (sum[1][k] * 15 + 1020) / 2040;
+            hi |= ((guint32) q[0][k] << (28 - 8 * k))
+              | ((guint32) q[1][k] << (24 - 8 * k));
+            base[0][k] = q[0][k] * 17;
+            base[1][k] = q[1][k] * 17;
+          }
+      lo = 0;
+      error = 0;
+      for (sub = 0; sub < 2; ++sub)
+        error += ktx_encode_etc1_sub (lanes, base[sub], flip, sub, cw + sub,
+                                      &lo);
+      hi |= (cw[0] << 5) | (cw[1] << 2);
+      if (error < best_error)
+        {
+          best_error = error;
+          best_hi = hi;
+          best_lo = lo;
+        }
+    }
+  for (k = 0; k < 4; ++k)
+    {
+      b[k] = best_hi >> (24 - 8 * k);
+      b[4 + k] = best_lo >> (24 - 8 * k);
+    }
+}
+
+/**
+ * Function to encode an EAC alpha block with the best modifiers table.
+ */
+static void
+ktx_encode_eac (const KtxBlock * block,  ///< KtxBlock struct.
+                guint8 * b)     ///< Block.
+{
+  static const KtxMask all = { -1, -1, -1, -1 };
+  const KtxMask masks[4] = { all, all, all, all };
+  const int *modifiers;
+  float alphas[8];
+  KtxLanes emin;
+  KtxMask best[4], best_lanes[4];
+  guint64 indices;
+  unsigned int i, j, t, min, max, range, mult, error, best_error, best_mult,
+    best_table;
+  int base, best_base;
+
+  ktx_lanes_range (block->columns[3], masks, &min, &max);
+  best_error = G_MAXUINT;
+  best_base = best_mult = best_table = 0;
+  for (t = 0; t < 16; ++t)
+    {
+      modifiers = ktx_eac_modifiers[t];
+      range = modifiers[7] - modifiers[3];
+      mult = CLAMP ((max - min + range - 1) / range, 1, 15);
+      base = CLAMP ((int) (min + max) / 2
+                    - (modifiers[3] + modifiers[7]) * (int) mult / 2, 0, 255);
+      for (j = 0; j < 8; ++j)
+        alphas[j] = ktx_clamp (base + modifiers[j] * (int) mult);
+      error = 0;
+      for (i = 0; i < 4; ++i)
+        {
+          ktx_lanes_alpha (block->columns[3] + i, alphas, 8, &emin, best + i);
+          error += ktx_lanes_sum (&emin);
+        }
+      if (error < best_error)
+        {
+          best_error = error;
+          memcpy (best_lanes, best, sizeof (best));
+          best_base = base;
+          best_mult = mult;
+          best_table = t;
+        }
+    }
+
+  // The pixel indices are stored column by column
+  indices = 0;
+  for (i = 0; i < 4; ++i)
+    for (j = 0; j < 4; ++j)
+      indices |= (guint64) best_lanes[i][j] << (45 - 3 * (4 * i + j));
+  b[0] = best_base;
+  b[1] = (best_mult << 4) | best_table;
+  for (i = 0; i < 6; ++i)
+    b[2 + i] = indices >> (40 - 8 * i);
+}
+
+/**
+ * Function to get a 4x4 pixels block of an image, repeating the edge pixels
+ *   out of the image.
+ */
+static void
+ktx_fetch (const GLubyte * pixels,      ///< Pixels in the OpenGL order.
+           unsigned int width,  ///< Width.
+           unsigned int height, ///< Height.
+           unsigned int bx,     ///< Column of the first block pixel.
+           unsigned int by,     ///< Row of the first block pixel, top-down.
+           guint8 * rgba)       ///< 4x4 pixels, row by row.
+{
+  const GLubyte *row;
+  unsigned int x, y;
+  for (y = 0; y < 4; ++y)
+    {
+      row = pixels + 4 * (gsize) width * (height - 1 - MIN (by + y,
+                                                             height - 1));
+      for (x = 0; x < 4; ++x)
+        memcpy (rgba + 4 * (4 * y + x), row + 4 * MIN (bx + x, width - 1), 4);
+    }
+}
+
+/**
+ * Function to get the size in bytes of a compressed texture level.
+ *
+ * \return size in bytes, 0 if the format is not supported.
+ */
+gsize
+ktx_level_size (GLenum format,  ///< GL compressed internal format.
+                unsigned int width,     ///< Level width.
+                unsigned int height)    ///< Level height.
+{
+  const KtxFormat *f;
+  f = ktx_format (0, format);
+  if (!f)
+    return 0;
+  return ((width + 3) / 4) * ((height + 3) / 4) * (gsize) f->block_size;
+}
+
+/**
+ * Function to encode rows of blocks of a texture level. BC7 can not be
+ *   encoded. It does not use GL, so it can be called from any thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+ktx_encode (GLenum format,      ///< GL compressed internal format.
+            const GLubyte * pixels,     ///< Pixels in the OpenGL order.
+            unsigned int width, ///< Width.
+            unsigned int height,        ///< Height.
+            unsigned int row0,  ///< First block row, top-down.
+            unsigned int row1,  ///< Last block row plus one.
+            guint8 * blocks)    ///< Level blocks.
+{
+  guint8 rgba[64];
+  KtxBlock block;
+  const KtxFormat *f;
+  guint8 *b;
+  unsigned int bx, by, nx;
+
+  f = ktx_format (0, format);
+  if (!f || format == GL_COMPRESSED_RGBA_BPTC_UNORM)
+    return 0;
+  nx = (width + 3) / 4;
+  b = blocks + row0 * (gsize) nx * f->block_size;
+  for (by = row0; by < row1; ++by)
+    for (bx = 0; bx < nx; ++bx, b += f->block_size)
+      {
+        ktx_fetch (pixels, width, height, 4 * bx, 4 * by, rgba);
+        ktx_block_load (rgba, &block);
+        switch (format)
+          {
+          case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            ktx_encode_bc1 (&block, b, 0, 0);
+            break;
+          case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+            ktx_encode_bc1 (&block, b, 1, 0);
+            break;
+          case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            ktx_encode_bc3 (&block, b);
+            break;
+          case GL_COMPRESSED_RGB8_ETC2:
+            ktx_encode_etc2 (&block, b);
+            break;
+          default:
+            ktx_encode_eac (&block, b);
+            ktx_encode_etc2 (&block, b + 8);
+          }
+      }
+  return 1;
+}
+
+/**
+ * Function to write a little endian 32 bits number.
+ */
+static inline void
+ktx_write32 (guint8 * b,        ///< Bytes.
+             guint32 x)         ///< Number.
+{
+  b[0] = x;
+  b[1] = x >> 8;
+  b[2] = x >> 16;
+  b[3] = x >> 24;
+}
+
+/**
+ * Function to write a little endian 64 bits number.
+ */
+static inline void
+ktx_write64 (guint8 * b,        ///< Bytes.
+             guint64 x)         ///< Number.
+{
+  ktx_write32 (b, (guint32) x);
+  ktx_write32 (b + 4, (guint32) (x >> 32));
+}
+
+/**
+ * Function to write a compressed texture in a KTX2 file. The levels are
+ *   stored from the smallest to the largest, aligned to the block size.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+ktx_write (const char *name,    ///< KTX2 file name.
+           GLenum format,       ///< GL compressed internal format.
+           unsigned int width,  ///< Width.
+           unsigned int height, ///< Height.
+           unsigned int nlevels,        ///< Number of mipmap levels.
+           guint8 ** levels)    ///< Level blocks, the largest first.
+{
+  static const guint8 padding[16] = { 0 };
+  guint8 header[KTX_HEADER + KTX_LEVEL_INDEX * KTX_LEVELS];
+  guint8 dfd[KTX_DFD];
+  gsize offsets[KTX_LEVELS], sizes[KTX_LEVELS];
+  const KtxFormat *f;
+  FILE *file;
+  gsize offset, index_size, dfd_size;
+  unsigned int i, nsamples, color;
+  int ok;
+
+  f = ktx_format (0, format);
+  if (!f || !nlevels || nlevels > KTX_LEVELS)
+    return 0;
+
+  // Data format descriptor, with alpha and color samples
+  nsamples = (f->alpha && f->block_size == 16) ? 2 : 1;
+  dfd_size = 28 + 16 * nsamples;
+  memset (dfd, 0, sizeof (dfd));
+  ktx_write32 (dfd, dfd_size);
+  ktx_write32 (dfd + 8, 2 | ((24 + 16 * nsamples) << 16));
+  ktx_write32 (dfd + 12, f->model | (1 << 8) | (1 << 16));
+  ktx_write32 (dfd + 16, 3 | (3 << 8));
+  ktx_write32 (dfd + 20, f->block_size);
+  color = (f->model == 161) ? 2 : 0;
+  for (i = 0; i < nsamples; ++i)
+    {
+      if (nsamples == 2)
+        ktx_write32 (dfd + 28 + 16 * i,
+                     (64 * i) | (63 << 16) | ((i ? color : 15) << 24));
+      else
+        ktx_write32 (dfd + 28, ((8 * f->block_size - 1) << 16)
+                     | ((f->alpha ? 15 : color) << 24));
+      ktx_write32 (dfd + 40 + 16 * i, 0xffffffff);
+    }
+
+  // Header and level index
+  index_size = KTX_HEADER + KTX_LEVEL_INDEX * nlevels;
+  memset (header, 0, sizeof (header));
+  memcpy (header, ktx_identifier, 12);
+  ktx_write32 (header + 12, f->vk_format);
+  ktx_write32 (header + 16, 1);
+  ktx_write32 (header + 20, width);
+  ktx_write32 (header + 24, height);
+  ktx_write32 (header + 36, 1);
+  ktx_write32 (header + 40, nlevels);
+  ktx_write32 (header + 48, index_size);
+  ktx_write32 (header + 52, dfd_size);
+  offset = index_size + dfd_size;
+  for (i = nlevels; i-- > 0;)
+    {
+      offset = (offset + f->block_size - 1) / f->block_size * f->block_size;
+      sizes[i] = ktx_level_size (format, MAX (1, width >> i),
+                                 MAX (1, height >> i));
+      offsets[i] = offset;
+      offset += sizes[i];
+    }
+  for (i = 0; i < nlevels; ++i)
+    {
+      ktx_write64 (header + KTX_HEADER + KTX_LEVEL_INDEX * i, offsets[i]);
+      ktx_write64 (header + KTX_HEADER + KTX_LEVEL_INDEX * i + 8, sizes[i]);
+      ktx_write64 (header + KTX_HEADER + KTX_LEVEL_INDEX * i + 16, sizes[i]);
+    }
+
+  file = fopen (name, "wb");
+  if (!file)
+    return 0;
+  ok = fwrite (header, 1, index_size, file) == index_size
+    && fwrite (dfd, 1, dfd_size, file) == dfd_size;
+  offset = index_size + dfd_size;
+  for (i = nlevels; ok && i-- > 0;)
+    {
+      ok = fwrite (padding, 1, offsets[i] - offset, file)
+        == offsets[i] - offset
+        && fwrite (levels[i], 1, sizes[i], file) == sizes[i];
+      offset = offsets[i] + sizes[i];
+    }
+  if (fclose (file))
+    ok = 0;
+  return ok;
+}
+
+/**
+ * Function to upload a compressed texture to the bound 2D texture. The
+ *   compressed mipmap levels are uploaded if the GL context supports the
+ *   format, the levels are decoded otherwise. The storage can be immutable. It
+ *   has to be called on the GL thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+ktx_upload (Ktx * ktx,          ///< Ktx struct.
+            int storage)        ///< 1 to allocate immutable storage.
+{
+  const guint8 *bytes;
+  GLubyte *pixels;
+  gsize size;
+  unsigned int i, nlevels, full, width, height;
+  int max_level;
+
+  // Without GL_TEXTURE_MAX_LEVEL only a full mipmap chain is complete
+  max_level = epoxy_is_desktop_gl () || epoxy_gl_version () >= 30;
+  full = 1;
+  while (MAX (ktx->width, ktx->height) >> full)
+    ++full;
+  nlevels = (max_level || ktx->nlevels == full) ? ktx->nlevels : 1;
+
+  bytes = (const guint8 *) g_mapped_file_get_contents (ktx->mapped);
+  if (ktx_supported (ktx->format))
+    {
+      if (storage)
+        glTexStorage2D (GL_TEXTURE_2D, nlevels, ktx->format, ktx->width,
+                        ktx->height);
+      for (i = 0; i < nlevels; ++i)
+        {
+          width = MAX (1, ktx->width >> i);
+          height = MAX (1, ktx->height >> i);
+          if (storage)
+            glCompressedTexSubImage2D (GL_TEXTURE_2D, i, 0, 0, width, height,
+                                       ktx->format, ktx->levels[i].size,
+                                       bytes + ktx->levels[i].offset);
+          else
+            glCompressedTexImage2D (GL_TEXTURE_2D, i, ktx->format, width,
+                                    height, 0, ktx->levels[i].size,
+                                    bytes + ktx->levels[i].offset);
+        }
+      ktx->top_down = 1;
+    }
+  else
+    {
+      if (storage)
+        glTexStorage2D (GL_TEXTURE_2D, nlevels, GL_RGBA8, ktx->width,
+                        ktx->height);
+      size = 4 * (gsize) ktx->width * ktx->height;
+      pixels = (GLubyte *) g_slice_alloc (size);
+      for (i = 0; i < nlevels; ++i)
+        {
+          if (!ktx_decode (ktx, i, pixels))
+            {
+              g_slice_free1 (size, pixels);
+              return 0;
+            }
+          width = MAX (1, ktx->width >> i);
+          height = MAX (1, ktx->height >> i);
+          if (storage)
+            glTexSubImage2D (GL_TEXTURE_2D, i, 0, 0, width, height, GL_RGBA,
+                             GL_UNSIGNED_BYTE, pixels);
+          else
+            glTexImage2D (GL_TEXTURE_2D, i, GL_RGBA, width, height, 0,
+                          GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+      g_slice_free1 (size, pixels);
+      ktx->top_down = 0;
+    }
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                   (nlevels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  if (max_level)
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, nlevels - 1);
+  return 1;
+}
+
+/**
+ * Function to free the memory used by a compressed texture.
+ */
+void
+ktx_close (Ktx * ktx)           ///< Ktx struct.
+{
+  if (ktx->mapped)
+    g_mapped_file_unref (ktx->mapped);
+}
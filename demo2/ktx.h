@@ -0,0 +1,45 @@
+#ifndef KTX__H
+#define KTX__H 1
+
+#define KTX_LEVELS 16           ///< Maximum number of mipmap levels.
+
+/**
+ * \struct KtxLevel
+ * \brief A struct to define a mipmap level of a compressed texture.
+ */
+typedef struct
+{
+  gsize offset;                 ///< Offset in bytes in the file.
+  gsize size;                   ///< Size in bytes.
+} KtxLevel;
+
+/**
+ * \struct Ktx
+ * \brief A struct to define a compressed texture mapped from a KTX2 file.
+ */
+typedef struct
+{
+  KtxLevel levels[KTX_LEVELS];  ///< Mipmap levels, the largest first.
+  GMappedFile *mapped;          ///< File mapping.
+  GLenum format;                ///< Compressed internal format.
+  unsigned int width;           ///< Width.
+  unsigned int height;          ///< Height.
+  unsigned int nlevels;         ///< Number of mipmap levels.
+  unsigned int block_size;      ///< Size in bytes of a 4x4 pixels block.
+  unsigned int top_down;        ///< 1 if the uploaded texture rows are
+  ///< top-down, 0 if they are in the OpenGL order.
+} Ktx;
+
+GLenum ktx_format_name (const char *name);
+int ktx_open (Ktx * ktx, const char *name);
+int ktx_decode (Ktx * ktx, unsigned int level, GLubyte * pixels);
+gsize ktx_level_size (GLenum format, unsigned int width, unsigned int height);
+int ktx_encode (GLenum format, const GLubyte * pixels, unsigned int width,
+                unsigned int height, unsigned int row0, unsigned int row1,
+                guint8 * blocks);
+int ktx_write (const char *name, GLenum format, unsigned int width,
+               unsigned int height, unsigned int nlevels, guint8 ** levels);
+int ktx_upload (Ktx * ktx, int storage);
+void ktx_close (Ktx * ktx);
+
+#endif
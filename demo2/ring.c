@@ -0,0 +1,218 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <epoxy/gl.h>
+
+#include "state.h"
+#include "ring.h"
+
+/**
+ * Function to enter a segment of a ring buffer. A fence is set at the end of
+ *   every left segment and the previous fence of every entered segment is
+ *   waited.
+ */
+static void
+ring_enter (Ring * ring,        ///< Ring struct data.
+            unsigned int segment)       ///< Segment.
+{
+  GLsync *fence;
+  while (ring->segment != segment)
+    {
+      if (ring->mode != RING_MODE_SUBDATA)
+        ring->fences[ring->segment]
+          = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      ring->segment = (ring->segment + 1) % RING_SEGMENTS;
+      fence = ring->fences + ring->segment;
+      if (*fence)
+        {
+          glClientWaitSync (*fence, GL_SYNC_FLUSH_COMMANDS_BIT, RING_TIMEOUT);
+          glDeleteSync (*fence);
+          *fence = NULL;
+        }
+    }
+}
+
+/**
+ * Function to init a streaming ring buffer. The buffer is written in a
+ *   persistent mapping if buffer storage is available, in unsynchronized
+ *   mapped ranges if fences and mapped ranges are available, and with
+ *   glBufferSubData, orphaning the buffer when it wraps, otherwise.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+ring_init (Ring * ring,         ///< Ring struct data.
+           GLenum target,       ///< Buffer target.
+           GLsizeiptr size)     ///< Size in bytes.
+{
+  const char *error_message;
+  int version, desktop, sync, map, storage;
+  unsigned int i;
+
+#if DEBUG
+  printf ("ring_init: start\n");
+  fflush (stdout);
+#endif
+
+  // Checking the available buffer functions
+  version = epoxy_gl_version ();
+  desktop = epoxy_is_desktop_gl ();
+  if (desktop)
+    {
+      sync = version >= 32 || epoxy_has_gl_extension ("GL_ARB_sync");
+      map = version >= 30
+        || epoxy_has_gl_extension ("GL_ARB_map_buffer_range");
+      storage = version >= 44
+        || epoxy_has_gl_extension ("GL_ARB_buffer_storage");
+    }
+  else
+    {
+      sync = map = version >= 30;
+      storage = epoxy_has_gl_extension ("GL_EXT_buffer_storage");
+    }
+  if (sync && map && storage)
+    ring->mode = RING_MODE_PERSISTENT;
+  else if (sync && map)
+    ring->mode = RING_MODE_MAP;
+  else
+    ring->mode = RING_MODE_SUBDATA;
+
+  ring->target = target;
+  ring->segment_size = size / RING_SEGMENTS;
+  ring->size = RING_SEGMENTS * ring->segment_size;
+  ring->offset = 0;
+  ring->segment = 0;
+  for (i = 0; i < RING_SEGMENTS; ++i)
+    ring->fences[i] = NULL;
+  ring->mapped = ring->staging = NULL;
+  glGenBuffers (1, &ring->buffer);
+  state_bind_buffer (target, ring->buffer);
+  if (ring->mode == RING_MODE_PERSISTENT)
+    {
+      glBufferStorage (target, ring->size, NULL,
+                       GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT
+                       | GL_MAP_COHERENT_BIT);
+      ring->mapped
+        = (GLubyte *) glMapBufferRange (target, 0, ring->size,
+                                        GL_MAP_WRITE_BIT
+                                        | GL_MAP_PERSISTENT_BIT
+                                        | GL_MAP_COHERENT_BIT);
+      if (!ring->mapped)
+        {
+          error_message = "unable to map the ring buffer";
+          goto exit_on_error;
+        }
+    }
+  else
+    {
+      glBufferData (target, ring->size, NULL, GL_STREAM_DRAW);
+      if (ring->mode == RING_MODE_SUBDATA)
+        ring->staging = (GLubyte *) g_slice_alloc (ring->segment_size);
+    }
+
+#if DEBUG
+  printf ("ring_init: end\n");
+  fflush (stdout);
+#endif
+  return 1;
+
+exit_on_error:
+  printf ("ERROR! Ring: %s\n", error_message);
+#if DEBUG
+  printf ("ring_init: end\n");
+  fflush (stdout);
+#endif
+  return 0;
+}
+
+/**
+ * Function to get memory to write in a ring buffer. The buffer is bound to
+ *   its target. A write can not be larger than a segment and it is placed in
+ *   only one segment.
+ *
+ * \return pointer to the memory to write, NULL on error.
+ */
+void *
+ring_map (Ring * ring,          ///< Ring struct data.
+          GLsizeiptr size,      ///< Size in bytes.
+          GLsizeiptr align,     ///< Alignment in bytes of the offset.
+          GLintptr * offset)    ///< Offset of the written bytes in the buffer.
+{
+  GLintptr o;
+
+  if (size > ring->segment_size)
+    return NULL;
+  state_bind_buffer (ring->target, ring->buffer);
+
+  // A write does not cross the end of a segment, so the fence set when the
+  // segment is left follows every draw reading it. Wrapping to the start if
+  // the write does not fit at the end
+  o = (ring->offset + align - 1) / align * align;
+  if (o / ring->segment_size != (o + size - 1) / ring->segment_size)
+    o = ((o / ring->segment_size + 1) * ring->segment_size + align - 1)
+      / align * align;
+  if (o + size > ring->size
+      || o / ring->segment_size != (o + size - 1) / ring->segment_size)
+    {
+      ring_enter (ring, 0);
+      o = 0;
+      if (ring->mode == RING_MODE_SUBDATA)
+        glBufferData (ring->target, ring->size, NULL, GL_STREAM_DRAW);
+    }
+  ring_enter (ring, o / ring->segment_size);
+  ring->offset = o + size;
+  *offset = o;
+
+  switch (ring->mode)
+    {
+    case RING_MODE_PERSISTENT:
+      return ring->mapped + o;
+    case RING_MODE_MAP:
+      return glMapBufferRange (ring->target, o, size,
+                               GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+                               | GL_MAP_INVALIDATE_RANGE_BIT);
+    default:
+      return ring->staging;
+    }
+}
+
+/**
+ * Function to finish a write in a ring buffer.
+ */
+void
+ring_unmap (Ring * ring,        ///< Ring struct data.
+            GLintptr offset,    ///< Offset of the written bytes in the buffer.
+            GLsizeiptr size)    ///< Size in bytes.
+{
+  switch (ring->mode)
+    {
+    case RING_MODE_MAP:
+      glUnmapBuffer (ring->target);
+      break;
+    case RING_MODE_SUBDATA:
+      glBufferSubData (ring->target, offset, size, ring->staging);
+    }
+}
+
+/**
+ * Function to free the memory used by a ring buffer.
+ */
+void
+ring_destroy (Ring * ring)      ///< Ring struct data.
+{
+  unsigned int i;
+  for (i = 0; i < RING_SEGMENTS; ++i)
+    if (ring->fences[i])
+      glDeleteSync (ring->fences[i]);
+  if (ring->mapped)
+    {
+      state_bind_buffer (ring->target, ring->buffer);
+      glUnmapBuffer (ring->target);
+    }
+  if (ring->staging)
+    g_slice_free1 (ring->segment_size, ring->staging);
+  state_delete_buffers (1, &ring->buffer);
+}
@@ -0,0 +1,44 @@
+#ifndef RING__H
+#define RING__H 1
+
+#define RING_SEGMENTS 3         ///< Number of fenced segments of a ring buffer.
+#define RING_TIMEOUT 1000000000 ///< Maximum wait of a fence in nanoseconds.
+
+/**
+ * \enum RingMode
+ * \brief Modes to write in a ring buffer.
+ */
+enum RingMode
+{
+  RING_MODE_SUBDATA = 0,        ///< Copying with glBufferSubData.
+  RING_MODE_MAP = 1,            ///< Mapping unsynchronized ranges.
+  RING_MODE_PERSISTENT = 2,     ///< Writing in a persistent mapping.
+};
+
+/**
+ * \struct Ring
+ * \brief A struct to define a streaming ring buffer. The buffer is split in
+ *   segments, a fence is set when the writes leave a segment and it is waited
+ *   before writing again in the segment.
+ */
+typedef struct
+{
+  GLsync fences[RING_SEGMENTS]; ///< Fences of the segments.
+  GLubyte *mapped;              ///< Persistent mapping.
+  GLubyte *staging;             ///< Staging memory to copy with glBufferSubData.
+  GLenum target;                ///< Buffer target.
+  GLuint buffer;                ///< Buffer object.
+  GLsizeiptr size;              ///< Size in bytes.
+  GLsizeiptr segment_size;      ///< Size in bytes of a segment.
+  GLintptr offset;              ///< Offset of the next free byte.
+  unsigned int mode;            ///< Mode to write in the buffer.
+  unsigned int segment;         ///< Current segment.
+} Ring;
+
+int ring_init (Ring * ring, GLenum target, GLsizeiptr size);
+void *ring_map (Ring * ring, GLsizeiptr size, GLsizeiptr align,
+                GLintptr * offset);
+void ring_unmap (Ring * ring, GLintptr offset, GLsizeiptr size);
+void ring_destroy (Ring * ring);
+
+#endif
@@ -0,0 +1,341 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <png.h>
+#include <epoxy/gl.h>
+
+#include "state.h"
+#include "ktx.h"
+#include "shader.h"
+#include "image.h"
+#include "sequence.h"
+
+/**
+ * Function to decode a frame on a worker thread.
+ */
+static void
+sequence_decode (gpointer data, ///< SequenceBuffer struct data.
+                 gpointer user_data G_GNUC_UNUSED)      ///< unused.
+{
+  SequenceBuffer *buffer;
+  Sequence *sequence;
+  gint64 t0;
+  int ok;
+
+  buffer = (SequenceBuffer *) data;
+  sequence = buffer->sequence;
+  t0 = g_get_monotonic_time ();
+  ok = image_decode (sequence->names[buffer->frame], sequence->image->width,
+                     sequence->image->height, buffer->pixels);
+  g_mutex_lock (&sequence->mutex);
+  sequence->decode_time += 1e-6 * (g_get_monotonic_time () - t0);
+  ++sequence->stats.frames_decoded;
+  g_mutex_unlock (&sequence->mutex);
+  g_atomic_int_set (&buffer->state,
+                    ok ? SEQUENCE_BUFFER_READY : SEQUENCE_BUFFER_FAILED);
+}
+
+/**
+ * Function to queue the decode of the frames following a frame in the free
+ *   buffers of the ring.
+ */
+static void
+sequence_prefetch (Sequence * sequence, ///< Sequence struct data.
+                   unsigned int first)  ///< First frame to decode.
+{
+  SequenceBuffer *buffer;
+  unsigned int i, frame;
+
+  for (i = 0; i < SEQUENCE_PREFETCH; ++i)
+    {
+      frame = first + i;
+      if (frame >= sequence->nframes)
+        {
+          if (!sequence->loop)
+            break;
+          frame %= sequence->nframes;
+        }
+      buffer = sequence->buffers + frame % SEQUENCE_PREFETCH;
+      if (buffer->frame == frame
+          || g_atomic_int_get (&buffer->state) == SEQUENCE_BUFFER_DECODING)
+        continue;
+      buffer->frame = frame;
+      g_atomic_int_set (&buffer->state, SEQUENCE_BUFFER_DECODING);
+      if (!sequence->pool || !g_thread_pool_push (sequence->pool, buffer, NULL))
+        sequence_decode (buffer, NULL);
+    }
+}
+
+/**
+ * Function to create an image sequence. The first frame is read on the
+ *   calling thread and the next frames are decoded on worker threads. All the
+ *   frames have to be equal sized. It has to be called on the GL thread.
+ *
+ * \return pointer to the Sequence struct data on success, NULL on error.
+ */
+Sequence *
+sequence_new (char **names,     ///< Array of frame file names.
+              unsigned int nframes,     ///< Number of frames.
+              double fps,       ///< Target frame rate.
+              unsigned int loop)        ///< 1 to play in loop.
+{
+  Sequence *sequence;
+  Image *image;
+  const char *error_message;
+  unsigned int i;
+
+#if DEBUG
+  printf ("sequence_new: start\n");
+  fflush (stdout);
+#endif
+
+  // Reading the first frame
+  if (!nframes || fps <= 0.)
+    {
+      error_message = "bad sequence";
+      goto exit_on_error;
+    }
+  image = image_new (names[0]);
+  if (!image)
+    {
+      error_message = "unable to open the first frame";
+      goto exit_on_error;
+    }
+  if (image->ktx)
+    {
+      image_free (image);
+      error_message = "compressed frames are not supported";
+      goto exit_on_error;
+    }
+  if (!image_init (image))
+    {
+      image_free (image);
+      error_message = "unable to init the first frame";
+      goto exit_on_error;
+    }
+
+  sequence = (Sequence *) g_slice_alloc0 (sizeof (Sequence));
+  sequence->image = image;
+  sequence->names = (char **) g_slice_alloc (nframes * sizeof (char *));
+  for (i = 0; i < nframes; ++i)
+    sequence->names[i] = g_strdup (names[i]);
+  sequence->nframes = nframes;
+  sequence->fps = fps;
+  sequence->loop = loop;
+  g_mutex_init (&sequence->mutex);
+
+  // Ring of textures, the first one is the image texture, only the base
+  // level is updated
+  sequence->textures[0] = image->id_texture;
+  state_bind_texture (image->id_texture);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glGenTextures (SEQUENCE_TEXTURES - 1, sequence->textures + 1);
+  for (i = 1; i < SEQUENCE_TEXTURES; ++i)
+    {
+      state_bind_texture (sequence->textures[i]);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, image->width, image->height,
+                    0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+
+  // Ring of decoded frames
+  for (i = 0; i < SEQUENCE_PREFETCH; ++i)
+    {
+      sequence->buffers[i].sequence = sequence;
+      sequence->buffers[i].pixels = (GLubyte *) g_slice_alloc (image->size);
+      sequence->buffers[i].frame = nframes;
+      sequence->buffers[i].state = SEQUENCE_BUFFER_EMPTY;
+    }
+  sequence->pool = g_thread_pool_new (sequence_decode, NULL,
+                                      MIN (SEQUENCE_PREFETCH,
+                                           g_get_num_processors ()), FALSE,
+                                      NULL);
+  sequence->stats.frames_shown = 1;
+  sequence_prefetch (sequence, 1);
+
+#if DEBUG
+  printf ("sequence_new: end\n");
+  fflush (stdout);
+#endif
+  return sequence;
+
+exit_on_error:
+  printf ("ERROR! Sequence: %s\n", error_message);
+#if DEBUG
+  printf ("sequence_new: end\n");
+  fflush (stdout);
+#endif
+  return NULL;
+}
+
+/**
+ * Function to start to play an image sequence from the shown frame.
+ */
+void
+sequence_play (Sequence * sequence)     ///< Sequence struct data.
+{
+  sequence->start_time = g_get_monotonic_time ()
+    - (gint64) (1e6 * sequence->frame / sequence->fps);
+}
+
+/**
+ * Function to show the frame of the playing time. If the frame is not decoded
+ *   the newest decoded frame before it is shown, or the shown frame is repeated
+ *   if there is none. The frames between the shown frame and the new one are
+ *   dropped. It has to be called on the GL thread.
+ */
+void
+sequence_update (Sequence * sequence)   ///< Sequence struct data.
+{
+  SequenceBuffer *buffer, *newest;
+  gint64 t0;
+  unsigned int i, frame, offset, distance, target;
+
+  if (!sequence->start_time)
+    goto prefetch;
+
+  // Frame of the playing time
+  frame = (unsigned int) (1e-6 * (g_get_monotonic_time ()
+                                  - sequence->start_time) * sequence->fps);
+  if (frame >= sequence->nframes)
+    {
+      if (sequence->loop)
+        frame %= sequence->nframes;
+      else
+        frame = sequence->nframes - 1;
+    }
+  if (frame == sequence->frame)
+    goto prefetch;
+
+  // Newest decoded frame not after the frame of the playing time
+  target = (frame + sequence->nframes - sequence->frame) % sequence->nframes;
+  newest = NULL;
+  for (i = distance = 0; i < SEQUENCE_PREFETCH; ++i)
+    {
+      buffer = sequence->buffers + i;
+      if (buffer->frame >= sequence->nframes
+          || g_atomic_int_get (&buffer->state) == SEQUENCE_BUFFER_DECODING)
+        continue;
+      offset = (buffer->frame + sequence->nframes - sequence->frame)
+        % sequence->nframes;
+      if (offset <= target && offset > distance)
+        {
+          newest = buffer;
+          distance = offset;
+        }
+    }
+  if (!newest)
+    {
+      ++sequence->stats.frames_repeated;
+      sequence_prefetch (sequence, frame);
+      return;
+    }
+
+  // Older decoded frames are dropped and their buffers freed
+  for (i = 0; i < SEQUENCE_PREFETCH; ++i)
+    {
+      buffer = sequence->buffers + i;
+      if (buffer != newest && buffer->frame < sequence->nframes
+          && g_atomic_int_get (&buffer->state) != SEQUENCE_BUFFER_DECODING
+          && (buffer->frame + sequence->nframes - sequence->frame)
+          % sequence->nframes < distance)
+        {
+          buffer->frame = sequence->nframes;
+          g_atomic_int_set (&buffer->state, SEQUENCE_BUFFER_EMPTY);
+        }
+    }
+  sequence->stats.frames_dropped += distance - 1;
+  if (g_atomic_int_get (&newest->state) == SEQUENCE_BUFFER_FAILED)
+    ++sequence->stats.frames_dropped;
+  else
+    {
+      // Uploading in the next texture of the ring
+      t0 = g_get_monotonic_time ();
+      sequence->texture = (sequence->texture + 1) % SEQUENCE_TEXTURES;
+      state_bind_texture (sequence->textures[sequence->texture]);
+      glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, sequence->image->width,
+                       sequence->image->height, GL_RGBA, GL_UNSIGNED_BYTE,
+                       newest->pixels);
+      sequence->image->id_texture = sequence->textures[sequence->texture];
+      sequence->upload_time += 1e-6 * (g_get_monotonic_time () - t0);
+      ++sequence->stats.frames_shown;
+    }
+  sequence->frame = newest->frame;
+  newest->frame = sequence->nframes;
+  g_atomic_int_set (&newest->state, SEQUENCE_BUFFER_EMPTY);
+
+  // Decoding from the frame of the playing time if it was not ready
+  if (distance < target)
+    {
+      sequence_prefetch (sequence, frame);
+      return;
+    }
+
+prefetch:
+  sequence_prefetch (sequence, sequence->frame + 1);
+}
+
+/**
+ * Function to draw the frame of the playing time of an image sequence.
+ */
+void
+sequence_draw (Sequence * sequence,     ///< Sequence struct data.
+               unsigned int window_width,       ///< Window width.
+               unsigned int window_height)      ///< Window height.
+{
+  sequence_update (sequence);
+  image_draw (sequence->image, window_width, window_height);
+}
+
+/**
+ * Function to get the playback counters of an image sequence.
+ */
+void
+sequence_stats (Sequence * sequence,    ///< Sequence struct data.
+                SequenceStats * stats)  ///< SequenceStats struct data.
+{
+  g_mutex_lock (&sequence->mutex);
+  *stats = sequence->stats;
+  stats->decode_time = stats->frames_decoded
+    ? sequence->decode_time / stats->frames_decoded : 0.;
+  g_mutex_unlock (&sequence->mutex);
+  stats->upload_time = (stats->frames_shown > 1)
+    ? sequence->upload_time / (stats->frames_shown - 1) : 0.;
+}
+
+/**
+ * Function to free the memory used by an image sequence.
+ */
+void
+sequence_destroy (Sequence * sequence)  ///< Sequence struct data.
+{
+  unsigned int i;
+
+#if DEBUG
+  printf ("sequence_destroy: start\n");
+  fflush (stdout);
+#endif
+
+  // Waiting for the decoding frames
+  if (sequence->pool)
+    g_thread_pool_free (sequence->pool, TRUE, TRUE);
+  for (i = 0; i < SEQUENCE_PREFETCH; ++i)
+    g_slice_free1 (sequence->image->size, sequence->buffers[i].pixels);
+  sequence->image->id_texture = sequence->textures[0];
+  state_delete_textures (SEQUENCE_TEXTURES - 1, sequence->textures + 1);
+  image_destroy (sequence->image);
+  g_slice_free1 (sizeof (Image), sequence->image);
+  for (i = 0; i < sequence->nframes; ++i)
+    g_free (sequence->names[i]);
+  g_slice_free1 (sequence->nframes * sizeof (char *), sequence->names);
+  g_mutex_clear (&sequence->mutex);
+  g_slice_free1 (sizeof (Sequence), sequence);
+
+#if DEBUG
+  printf ("sequence_destroy: end\n");
+  fflush (stdout);
+#endif
+}
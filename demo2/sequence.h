@@ -0,0 +1,79 @@
+#ifndef SEQUENCE__H
+#define SEQUENCE__H 1
+
+#define SEQUENCE_PREFETCH 4     ///< Number of frames decoded in advance.
+#define SEQUENCE_TEXTURES 2     ///< Number of textures of the upload ring.
+
+/**
+ * \enum SequenceBufferState
+ * \brief States of a decoded frame buffer.
+ */
+enum SequenceBufferState
+{
+  SEQUENCE_BUFFER_EMPTY = 0,    ///< Free.
+  SEQUENCE_BUFFER_DECODING = 1, ///< Decoding on a worker thread.
+  SEQUENCE_BUFFER_READY = 2,    ///< Decoded.
+  SEQUENCE_BUFFER_FAILED = 3,   ///< Decoding failed.
+};
+
+/**
+ * \struct SequenceStats
+ * \brief A struct to define the playback counters of an image sequence.
+ */
+typedef struct
+{
+  guint64 frames_shown;         ///< Shown frames.
+  guint64 frames_dropped;       ///< Frames skipped to keep the frame rate.
+  guint64 frames_repeated;      ///< Renders repeating a frame not yet decoded.
+  guint64 frames_decoded;       ///< Decoded frames.
+  double decode_time;           ///< Mean decode time in seconds.
+  double upload_time;           ///< Mean upload time in seconds.
+} SequenceStats;
+
+typedef struct _Sequence Sequence;
+
+/**
+ * \struct SequenceBuffer
+ * \brief A struct to define a buffer with a frame decoded on a worker thread.
+ */
+typedef struct
+{
+  Sequence *sequence;           ///< Sequence struct data.
+  GLubyte *pixels;              ///< Decoded pixels.
+  unsigned int frame;           ///< Frame number.
+  gint state;                   ///< Buffer state, atomic.
+} SequenceBuffer;
+
+/**
+ * \struct _Sequence
+ * \brief A struct to define an image sequence played as a flipbook.
+ */
+struct _Sequence
+{
+  SequenceBuffer buffers[SEQUENCE_PREFETCH];    ///< Ring of decoded frames.
+  GLuint textures[SEQUENCE_TEXTURES];   ///< Ring of frame textures.
+  SequenceStats stats;          ///< Playback counters.
+  GMutex mutex;                 ///< Lock of the decode counters.
+  Image *image;                 ///< Image drawing the frames.
+  char **names;                 ///< Frame file names.
+  GThreadPool *pool;            ///< Pool of threads decoding frames.
+  double fps;                   ///< Target frame rate.
+  double decode_time;           ///< Sum of the decode times in seconds.
+  double upload_time;           ///< Sum of the upload times in seconds.
+  gint64 start_time;            ///< Time of the first frame, 0 if stopped.
+  unsigned int nframes;         ///< Number of frames.
+  unsigned int frame;           ///< Shown frame.
+  unsigned int texture;         ///< Texture of the shown frame.
+  unsigned int loop;            ///< 1 to play in loop.
+};
+
+Sequence *sequence_new (char **names, unsigned int nframes, double fps,
+                        unsigned int loop);
+void sequence_play (Sequence * sequence);
+void sequence_update (Sequence * sequence);
+void sequence_draw (Sequence * sequence, unsigned int window_width,
+                    unsigned int window_height);
+void sequence_stats (Sequence * sequence, SequenceStats * stats);
+void sequence_destroy (Sequence * sequence);
+
+#endif
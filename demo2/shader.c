@@ -0,0 +1,595 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <epoxy/gl.h>
+
+#include "state.h"
+#include "shader.h"
+
+static GHashTable *shader_registry = NULL;
+///< Linked shader programs by key, NULL if there is none.
+static int shader_current_dialect = -1;
+///< GLSL dialect of the context, -1 if not checked.
+static int shader_parallel = 0;
+///< 1 if the shaders are compiled in parallel by the driver.
+static int shader_binary = -1;
+///< 1 if program binaries are available, -1 if not checked.
+static int shader_cache = 1;    ///< 1 to use the program binary cache files.
+static ShaderStats shader_statistics;
+///< Compile and cache counters with the sums of the times.
+
+/**
+ * \struct ShaderCacheHeader
+ * \brief A struct to define the header of a program binary cache file. It is
+ *   followed by the program binary.
+ */
+typedef struct
+{
+  char magic[8];                ///< File identifier.
+  guint32 version;              ///< Cache format version.
+  guint32 format;               ///< Program binary format.
+  guint64 size;                 ///< Size in bytes of the program binary.
+} ShaderCacheHeader;
+
+static const char shader_cache_magic[8] = "GOGLPROG";
+///< Identifier of the program binary cache files.
+
+/**
+ * Function to get the GLSL dialect of the current context. It is checked once
+ *   while the registry holds programs, enabling the parallel shader compile of
+ *   the driver if available.
+ *
+ * \return GLSL dialect (ShaderDialect).
+ */
+unsigned int
+shader_dialect ()
+{
+  if (shader_current_dialect < 0)
+    {
+      if (strstr ((const char *) glGetString (GL_VERSION), "OpenGL ES"))
+        shader_current_dialect = SHADER_DIALECT_ES;
+      else if (epoxy_gl_version () >= 33)
+        shader_current_dialect = SHADER_DIALECT_V3;
+      else
+        shader_current_dialect = SHADER_DIALECT_V2;
+
+      // Letting the driver use all its compiler threads
+      shader_parallel = 1;
+      if (epoxy_has_gl_extension ("GL_KHR_parallel_shader_compile"))
+        glMaxShaderCompilerThreadsKHR (0xffffffff);
+      else if (epoxy_has_gl_extension ("GL_ARB_parallel_shader_compile"))
+        glMaxShaderCompilerThreadsARB (0xffffffff);
+      else
+        shader_parallel = 0;
+    }
+  return (unsigned int) shader_current_dialect;
+}
+
+/**
+ * Function to check if the program binaries of the current context can be
+ *   got and loaded.
+ *
+ * \return 1 if program binaries are available, 0 otherwise.
+ */
+static int
+shader_binary_check ()
+{
+  GLint k;
+  int version;
+  if (shader_binary < 0)
+    {
+      version = epoxy_gl_version ();
+      if (epoxy_is_desktop_gl ())
+        shader_binary = version >= 41
+          || epoxy_has_gl_extension ("GL_ARB_get_program_binary");
+      else
+        shader_binary = version >= 30;
+      if (shader_binary)
+        {
+          // Some drivers support the functions without any binary format
+          glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &k);
+          shader_binary = k > 0;
+        }
+    }
+  return shader_binary;
+}
+
+/**
+ * Function to get the program binary cache file name of a program. It is
+ *   keyed by the driver vendor, renderer and version, and by the program
+ *   sources.
+ *
+ * \return cache file name, it has to be freed with g_free.
+ */
+static char *
+shader_cache_name (const char *key,     ///< Registry key.
+                   const char **vs_sources,     ///< Vertex shader sources.
+                   unsigned int nvs,    ///< Number of vertex shader sources.
+                   const char **fs_sources,     ///< Fragment shader sources.
+                   unsigned int nfs)    ///< Number of fragment shader sources.
+{
+  GChecksum *checksum;
+  char *name, *file;
+  unsigned int i;
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (const guchar *) glGetString (GL_VENDOR), -1);
+  g_checksum_update (checksum, (const guchar *) "|", 1);
+  g_checksum_update (checksum, (const guchar *) glGetString (GL_RENDERER), -1);
+  g_checksum_update (checksum, (const guchar *) "|", 1);
+  g_checksum_update (checksum, (const guchar *) glGetString (GL_VERSION), -1);
+  g_checksum_update (checksum, (const guchar *) "|", 1);
+  g_checksum_update (checksum, (const guchar *) key, -1);
+  for (i = 0; i < nvs; ++i)
+    {
+      g_checksum_update (checksum, (const guchar *) "|", 1);
+      g_checksum_update (checksum, (const guchar *) vs_sources[i], -1);
+    }
+  for (i = 0; i < nfs; ++i)
+    {
+      g_checksum_update (checksum, (const guchar *) "|", 1);
+      g_checksum_update (checksum, (const guchar *) fs_sources[i], -1);
+    }
+  name = g_strdup_printf ("shader-%s.bin", g_checksum_get_string (checksum));
+  file = g_build_filename (g_get_user_cache_dir (), "gtkopengl", name, NULL);
+  g_free (name);
+  g_checksum_free (checksum);
+  return file;
+}
+
+/**
+ * Function to load a program from a program binary cache file. The driver
+ *   can reject the binary, then the program has to be compiled.
+ *
+ * \return 1 if the program is linked, 0 otherwise.
+ */
+static int
+shader_cache_read (GLuint program,      ///< Program identifier.
+                   const char *file)    ///< Cache file name.
+{
+  GMappedFile *mapped;
+  const ShaderCacheHeader *header;
+  gsize size;
+  GLint k;
+
+  mapped = g_mapped_file_new (file, FALSE, NULL);
+  if (!mapped)
+    return 0;
+  size = g_mapped_file_get_length (mapped);
+  header = (const ShaderCacheHeader *) g_mapped_file_get_contents (mapped);
+  k = 0;
+  if (size > sizeof (ShaderCacheHeader)
+      && !memcmp (header->magic, shader_cache_magic, sizeof (header->magic))
+      && header->version == SHADER_CACHE_VERSION
+      && header->size == size - sizeof (ShaderCacheHeader))
+    {
+      glProgramBinary (program, header->format, header + 1,
+                       (GLsizei) header->size);
+      glGetProgramiv (program, GL_LINK_STATUS, &k);
+    }
+  g_mapped_file_unref (mapped);
+  return k;
+}
+
+/**
+ * Function to write the binary of a linked program in a cache file.
+ */
+static void
+shader_cache_write (GLuint program,     ///< Program identifier.
+                    const char *file)   ///< Cache file name.
+{
+  ShaderCacheHeader *header;
+  char *buffer, *dir;
+  gsize size;
+  GLenum format;
+  GLint k;
+
+  glGetProgramiv (program, GL_PROGRAM_BINARY_LENGTH, &k);
+  if (k <= 0)
+    return;
+  size = sizeof (ShaderCacheHeader) + k;
+  buffer = (char *) g_malloc0 (size);
+  header = (ShaderCacheHeader *) buffer;
+  glGetProgramBinary (program, k, &k, &format, header + 1);
+  if (k > 0)
+    {
+      memcpy (header->magic, shader_cache_magic, sizeof (header->magic));
+      header->version = SHADER_CACHE_VERSION;
+      header->format = format;
+      header->size = k;
+      size = sizeof (ShaderCacheHeader) + k;
+      dir = g_path_get_dirname (file);
+      g_mkdir_with_parents (dir, 0755);
+      if (!g_file_set_contents (file, buffer, size, NULL))
+        printf ("ERROR! Shader: unable to write the cache %s\n", file);
+      g_free (dir);
+    }
+  g_free (buffer);
+}
+
+/**
+ * Function to submit the compile of a shader. The compile status is not
+ *   queried, so the driver can compile it in background, a compile error is
+ *   reported with the shader log when the program is waited.
+ *
+ * \return shader identifier.
+ */
+static GLuint
+shader_compile (GLenum type,    ///< Shader type.
+                const char **sources,   ///< Array of source strings.
+                unsigned int n) ///< Number of source strings.
+{
+  GLuint shader;
+  shader = glCreateShader (type);
+  glShaderSource (shader, n, sources, NULL);
+  glCompileShader (shader);
+  return shader;
+}
+
+/**
+ * Function to print the info log of a shader or a program.
+ */
+static void
+shader_log (const char *key,    ///< Program registry key.
+            const char *label,  ///< Log label.
+            GLuint id,          ///< Shader or program identifier.
+            int program)        ///< 1 for a program, 0 for a shader.
+{
+  char *log;
+  GLint k;
+  if (program)
+    glGetProgramiv (id, GL_INFO_LOG_LENGTH, &k);
+  else
+    glGetShaderiv (id, GL_INFO_LOG_LENGTH, &k);
+  if (k <= 1)
+    return;
+  log = (char *) g_malloc (k);
+  if (program)
+    glGetProgramInfoLog (id, k, NULL, log);
+  else
+    glGetShaderInfoLog (id, k, NULL, log);
+  printf ("ERROR! Shader %s: %s log:\n%s\n", key, label, log);
+  g_free (log);
+}
+
+/**
+ * Function to print the logs of the shaders that failed to compile and of the
+ *   program if it failed to link.
+ */
+static void
+shader_program_log (ShaderProgram * program)    ///< Shader program.
+{
+  GLint k;
+  unsigned int i;
+  for (i = 0; i < 2; ++i)
+    if (program->shaders[i])
+      {
+        glGetShaderiv (program->shaders[i], GL_COMPILE_STATUS, &k);
+        if (!k)
+          shader_log (program->key, i ? "fragment shader" : "vertex shader",
+                      program->shaders[i], 0);
+      }
+  glGetProgramiv (program->id, GL_LINK_STATUS, &k);
+  if (!k)
+    shader_log (program->key, "program", program->id, 1);
+}
+
+/**
+ * Function to detach and delete the shaders of a submitted program.
+ */
+static void
+shader_program_delete_shaders (ShaderProgram * program) ///< Shader program.
+{
+  unsigned int i;
+  for (i = 0; i < 2; ++i)
+    if (program->shaders[i])
+      {
+        glDetachShader (program->id, program->shaders[i]);
+        glDeleteShader (program->shaders[i]);
+        program->shaders[i] = 0;
+      }
+}
+
+/**
+ * Function to submit a shader program of the current context. On the first
+ *   request of a name the program is loaded from a program binary cache file,
+ *   or its compile and link are submitted without waiting for them if the
+ *   binary is not valid. Next requests return the same program adding a
+ *   reference. The sources have to be written in the dialect returned by
+ *   shader_dialect. A program with more than SHADER_LOCATIONS attributes or
+ *   uniforms fails. The program has to be waited with shader_program_wait
+ *   before using it. It has to be called on the GL thread.
+ *
+ * \return pointer to the ShaderProgram struct data.
+ */
+ShaderProgram *
+shader_program_submit (const char *name,        ///< Program name.
+                       const char **vs_sources, ///< Vertex shader sources.
+                       unsigned int nvs,
+                       ///< Number of vertex shader sources.
+                       const char **fs_sources, ///< Fragment shader sources.
+                       unsigned int nfs,
+                       ///< Number of fragment shader sources.
+                       const char **attributes,
+                       ///< NULL terminated array of attribute names.
+                       const char **uniforms)
+                       ///< NULL terminated array of uniform names.
+{
+  ShaderProgram *program;
+  char *key;
+  gint64 t0;
+  GLuint vs, fs;
+
+  // Looking for the program in the registry
+  key = g_strdup_printf ("%s/%u", name, shader_dialect ());
+  if (!shader_registry)
+    shader_registry = g_hash_table_new (g_str_hash, g_str_equal);
+  program = (ShaderProgram *) g_hash_table_lookup (shader_registry, key);
+  if (program)
+    {
+      g_free (key);
+      ++program->nrefs;
+      return program;
+    }
+
+#if DEBUG
+  printf ("shader_program_submit: start\n");
+  fflush (stdout);
+#endif
+
+  program = (ShaderProgram *) g_slice_alloc (sizeof (ShaderProgram));
+  program->key = key;
+  program->attribute_names = g_strdupv ((gchar **) attributes);
+  program->uniform_names = g_strdupv ((gchar **) uniforms);
+  program->file = NULL;
+  program->shaders[0] = program->shaders[1] = 0;
+  program->nrefs = 1;
+  program->state = SHADER_PROGRAM_SUBMITTED;
+  program->id = glCreateProgram ();
+  g_hash_table_insert (shader_registry, program->key, program);
+
+  // Rejecting more names than locations, the program fails when it is waited
+  if (g_strv_length (program->attribute_names) > SHADER_LOCATIONS
+      || g_strv_length (program->uniform_names) > SHADER_LOCATIONS)
+    {
+      printf ("ERROR! Shader %s: more than %u attributes or uniforms\n",
+              key, SHADER_LOCATIONS);
+      program->state = SHADER_PROGRAM_FAILED;
+    }
+
+  // Loading the program binary from the cache file, it is not compiled
+  t0 = g_get_monotonic_time ();
+  if (program->state == SHADER_PROGRAM_SUBMITTED
+      && g_atomic_int_get (&shader_cache) && shader_binary_check ())
+    {
+      program->file = shader_cache_name (key, vs_sources, nvs, fs_sources,
+                                         nfs);
+      if (shader_cache_read (program->id, program->file))
+        {
+          shader_statistics.cache_time += 1e-6 * (g_get_monotonic_time ()
+                                                  - t0);
+          ++shader_statistics.cache_hits;
+          g_free (program->file);
+          program->file = NULL;
+          program->state = SHADER_PROGRAM_LOADED;
+        }
+      else
+        glProgramParameteri (program->id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                             GL_TRUE);
+    }
+
+  // Submitting the compile and link, the shaders are kept until the program is
+  // waited to print their logs on error
+  if (program->state == SHADER_PROGRAM_SUBMITTED)
+    {
+      program->time = t0;
+      fs = shader_compile (GL_FRAGMENT_SHADER, fs_sources, nfs);
+      vs = shader_compile (GL_VERTEX_SHADER, vs_sources, nvs);
+      glAttachShader (program->id, fs);
+      glAttachShader (program->id, vs);
+      glLinkProgram (program->id);
+      program->shaders[0] = vs;
+      program->shaders[1] = fs;
+    }
+
+#if DEBUG
+  printf ("shader_program_submit: end\n");
+  fflush (stdout);
+#endif
+  return program;
+}
+
+/**
+ * Function to check without blocking if the link of a submitted shader
+ *   program is finished. Without parallel shader compile it is always true and
+ *   shader_program_wait can block.
+ *
+ * \return 1 if the program is linked, 0 if it is linking.
+ */
+int
+shader_program_ready (ShaderProgram * program)  ///< Shader program.
+{
+  GLint k;
+  if (program->state != SHADER_PROGRAM_SUBMITTED || !shader_parallel)
+    return 1;
+  glGetProgramiv (program->id, GL_COMPLETION_STATUS_KHR, &k);
+  return k;
+}
+
+/**
+ * Function to wait for the link of a submitted shader program and to get its
+ *   locations. The binary of a compiled program is saved in its cache file. It
+ *   has to be called on the GL thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+shader_program_wait (ShaderProgram * program)   ///< Shader program.
+{
+  const char *error_message;
+  GLint k;
+  unsigned int i;
+
+  switch (program->state)
+    {
+    case SHADER_PROGRAM_LINKED:
+      return 1;
+    case SHADER_PROGRAM_FAILED:
+      return 0;
+    }
+
+#if DEBUG
+  printf ("shader_program_wait: start\n");
+  fflush (stdout);
+#endif
+
+  // Link status, it blocks until the driver finishes
+  glGetProgramiv (program->id, GL_LINK_STATUS, &k);
+  if (!k)
+    {
+      error_message = "unable to compile or link the program";
+      goto exit_on_error;
+    }
+  shader_program_delete_shaders (program);
+  if (program->state == SHADER_PROGRAM_SUBMITTED)
+    {
+      shader_statistics.compile_time
+        += 1e-6 * (g_get_monotonic_time () - program->time);
+      ++shader_statistics.compiles;
+      if (program->file)
+        shader_cache_write (program->id, program->file);
+    }
+
+  // Locations
+  for (i = 0; program->attribute_names[i]; ++i)
+    {
+      program->attributes[i] = glGetAttribLocation (program->id,
+                                                    program->attribute_names
+                                                    [i]);
+      if (program->attributes[i] == -1)
+        {
+          error_message = "could not bind an attribute";
+          goto exit_on_error;
+        }
+    }
+  for (i = 0; program->uniform_names[i]; ++i)
+    {
+      program->uniforms[i] = glGetUniformLocation (program->id,
+                                                   program->uniform_names[i]);
+      if (program->uniforms[i] == -1)
+        {
+          error_message = "could not bind a uniform";
+          goto exit_on_error;
+        }
+    }
+  program->state = SHADER_PROGRAM_LINKED;
+  g_free (program->file);
+  program->file = NULL;
+
+#if DEBUG
+  printf ("shader_program_wait: end\n");
+  fflush (stdout);
+#endif
+  return 1;
+
+exit_on_error:
+  printf ("ERROR! Shader %s: %s\n", program->key, error_message);
+  shader_program_log (program);
+  shader_program_delete_shaders (program);
+  program->state = SHADER_PROGRAM_FAILED;
+#if DEBUG
+  printf ("shader_program_wait: end\n");
+  fflush (stdout);
+#endif
+  return 0;
+}
+
+/**
+ * Function to get a linked shader program of the current context. It submits
+ *   the program and waits for it. It has to be called on the GL thread.
+ *
+ * \return pointer to the ShaderProgram struct data on success, NULL on error.
+ */
+ShaderProgram *
+shader_program_get (const char *name,   ///< Program name.
+                    const char **vs_sources,    ///< Vertex shader sources.
+                    unsigned int nvs,   ///< Number of vertex shader sources.
+                    const char **fs_sources,    ///< Fragment shader sources.
+                    unsigned int nfs,   ///< Number of fragment shader sources.
+                    const char **attributes,
+                    ///< NULL terminated array of attribute names.
+                    const char **uniforms)
+                    ///< NULL terminated array of uniform names.
+{
+  ShaderProgram *program;
+  program = shader_program_submit (name, vs_sources, nvs, fs_sources, nfs,
+                                   attributes, uniforms);
+  if (!shader_program_wait (program))
+    {
+      shader_program_release (program);
+      return NULL;
+    }
+  return program;
+}
+
+/**
+ * Function to release a reference of a shader program. The program is deleted
+ *   when the last reference is released, and the registry is freed when it is
+ *   empty, so a new context checks its dialect again. It has to be called on
+ *   the GL thread.
+ */
+void
+shader_program_release (ShaderProgram * program)        ///< Shader program.
+{
+  if (!program || --program->nrefs)
+    return;
+  g_hash_table_remove (shader_registry, program->key);
+  shader_program_delete_shaders (program);
+  state_delete_program (program->id);
+  g_strfreev (program->uniform_names);
+  g_strfreev (program->attribute_names);
+  g_free (program->file);
+  g_free (program->key);
+  g_slice_free1 (sizeof (ShaderProgram), program);
+  if (!g_hash_table_size (shader_registry))
+    {
+      g_hash_table_destroy (shader_registry);
+      shader_registry = NULL;
+      shader_current_dialect = shader_binary = -1;
+    }
+}
+
+/**
+ * Function to get the number of shader programs in the registry.
+ *
+ * \return number of shader programs.
+ */
+unsigned int
+shader_programs ()
+{
+  return shader_registry ? g_hash_table_size (shader_registry) : 0;
+}
+
+/**
+ * Function to enable or disable the program binary cache files.
+ */
+void
+shader_set_cache (int enable)   ///< 1 to enable, 0 to disable.
+{
+  g_atomic_int_set (&shader_cache, enable);
+}
+
+/**
+ * Function to get the compile and program binary cache counters.
+ */
+void
+shader_stats (ShaderStats * stats)      ///< ShaderStats struct data.
+{
+  *stats = shader_statistics;
+  stats->compile_time = stats->compiles
+    ? shader_statistics.compile_time / stats->compiles : 0.;
+  stats->cache_time = stats->cache_hits
+    ? shader_statistics.cache_time / stats->cache_hits : 0.;
+}
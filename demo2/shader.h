@@ -0,0 +1,84 @@
+#ifndef SHADER__H
+#define SHADER__H 1
+
+#define SHADER_LOCATIONS 8
+///< Maximum number of attribute or uniform locations of a shader program.
+#define SHADER_CACHE_VERSION 1  ///< Version of the program binary cache files.
+
+/**
+ * \enum ShaderDialect
+ * \brief GLSL dialects of the shader sources.
+ */
+enum ShaderDialect
+{
+  SHADER_DIALECT_V2 = 0,        ///< GLSL 1.20, OpenGL 2.1.
+  SHADER_DIALECT_V3 = 1,        ///< GLSL 3.30 core, OpenGL 3.3 or newer.
+  SHADER_DIALECT_ES = 2,        ///< GLSL ES 1.00, OpenGL ES 2.0 or newer.
+};
+
+/**
+ * \enum ShaderProgramState
+ * \brief States of a shader program.
+ */
+enum ShaderProgramState
+{
+  SHADER_PROGRAM_SUBMITTED = 0, ///< Compile and link submitted.
+  SHADER_PROGRAM_LOADED = 1,    ///< Loaded from a program binary.
+  SHADER_PROGRAM_LINKED = 2,    ///< Linked with the locations.
+  SHADER_PROGRAM_FAILED = 3,    ///< Compile or link failed.
+};
+
+/**
+ * \struct ShaderStats
+ * \brief A struct to define the compile and program binary cache counters.
+ */
+typedef struct
+{
+  unsigned int compiles;        ///< Programs compiled from the sources.
+  unsigned int cache_hits;      ///< Programs loaded from the cache files.
+  double compile_time;          ///< Mean compile and link time in seconds.
+  double cache_time;            ///< Mean cache load time in seconds.
+} ShaderStats;
+
+/**
+ * \struct ShaderProgram
+ * \brief A struct to define a linked shader program shared by reference.
+ */
+typedef struct
+{
+  char *key;                    ///< Registry key (name and dialect).
+  char **attribute_names;       ///< NULL terminated array of attribute names.
+  char **uniform_names;         ///< NULL terminated array of uniform names.
+  char *file;                   ///< Cache file to write when linked, NULL for
+  ///< none.
+  gint64 time;                  ///< Submit time.
+  GLint attributes[SHADER_LOCATIONS];   ///< Attribute locations.
+  GLint uniforms[SHADER_LOCATIONS];     ///< Uniform locations.
+  GLuint id;                    ///< Program identifier.
+  GLuint shaders[2];            ///< Vertex and fragment shader identifiers
+  ///< until the program is waited, 0 for none.
+  unsigned int nrefs;           ///< Number of references.
+  unsigned int state;           ///< Program state (ShaderProgramState).
+} ShaderProgram;
+
+unsigned int shader_dialect ();
+ShaderProgram *shader_program_submit (const char *name,
+                                      const char **vs_sources,
+                                      unsigned int nvs,
+                                      const char **fs_sources,
+                                      unsigned int nfs,
+                                      const char **attributes,
+                                      const char **uniforms);
+int shader_program_ready (ShaderProgram * program);
+int shader_program_wait (ShaderProgram * program);
+ShaderProgram *shader_program_get (const char *name,
+                                   const char **vs_sources, unsigned int nvs,
+                                   const char **fs_sources, unsigned int nfs,
+                                   const char **attributes,
+                                   const char **uniforms);
+void shader_program_release (ShaderProgram * program);
+unsigned int shader_programs ();
+void shader_set_cache (int enable);
+void shader_stats (ShaderStats * stats);
+
+#endif
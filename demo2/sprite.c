@@ -0,0 +1,366 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include <epoxy/gl.h>
+
+#include "state.h"
+#include "ktx.h"
+#include "shader.h"
+#include "image.h"
+#include "ring.h"
+#include "sprite.h"
+
+/**
+ * Function to draw the batched sprite quads with a draw call per atlas
+ *   texture. The quads are streamed through the ring buffer.
+ */
+static void
+sprite_batch_flush (Sprites * sprites)  ///< Sprites struct data.
+{
+  SpriteAtlas *atlas;
+  void *data;
+  GLsizeiptr size, stride;
+  GLintptr offset;
+  unsigned int i;
+
+  stride = 4 * sizeof (SpriteVertex);
+  state_use_program (sprites->program->id);
+  state_uniform_matrix4fv (sprites->uniform_matrix, sprites->matrix);
+  state_uniform1i (sprites->uniform_texture, 0);
+  state_active_texture (GL_TEXTURE0);
+  state_bind_buffer (GL_ELEMENT_ARRAY_BUFFER, sprites->ibo);
+  state_attributes (STATE_ATTRIBUTE (sprites->attribute_position)
+                    | STATE_ATTRIBUTE (sprites->attribute_texture));
+  for (i = 0; i < sprites->natlases; ++i)
+    {
+      atlas = sprites->atlases + i;
+      if (!atlas->nsprites)
+        continue;
+      size = atlas->nsprites * stride;
+      data = ring_map (&sprites->ring, size, stride, &offset);
+      if (data)
+        {
+          memcpy (data, atlas->vertices, size);
+          ring_unmap (&sprites->ring, offset, size);
+          state_bind_texture (atlas->texture);
+          glVertexAttribPointer (sprites->attribute_position, 2, GL_FLOAT,
+                                 GL_FALSE, sizeof (SpriteVertex),
+                                 (void *) (offset
+                                           + G_STRUCT_OFFSET (SpriteVertex,
+                                                              position)));
+          glVertexAttribPointer (sprites->attribute_texture, 2, GL_FLOAT,
+                                 GL_FALSE, sizeof (SpriteVertex),
+                                 (void *) (offset
+                                           + G_STRUCT_OFFSET (SpriteVertex,
+                                                              texture)));
+          glDrawElements (GL_TRIANGLES, 6 * atlas->nsprites,
+                          GL_UNSIGNED_SHORT, 0);
+          sprites->stats.sprites += atlas->nsprites;
+          ++sprites->stats.draws;
+        }
+      atlas->nsprites = 0;
+    }
+}
+
+/**
+ * Function to init a sprite batch. It has to be called on the GL thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+sprite_init (Sprites * sprites) ///< Sprites struct data.
+{
+  const char *error_message;
+  GLushort *elements;
+  GLint k;
+  GLuint i;
+
+#if DEBUG
+  printf ("sprite_init: start\n");
+  fflush (stdout);
+#endif
+
+  // Shared texture program
+  sprites->program = image_program ();
+  if (!sprites->program)
+    {
+      error_message = "unable to get the texture program";
+      goto exit_on_error;
+    }
+  sprites->attribute_position
+    = sprites->program->attributes[IMAGE_ATTRIBUTE_POSITION];
+  sprites->attribute_texture
+    = sprites->program->attributes[IMAGE_ATTRIBUTE_TEXTURE];
+  sprites->uniform_texture = sprites->program->uniforms[IMAGE_UNIFORM_TEXTURE];
+  sprites->uniform_matrix = sprites->program->uniforms[IMAGE_UNIFORM_MATRIX];
+
+  // Sprite quads buffers, the batches are streamed in a ring buffer holding
+  // a batch per segment and the indices are the same for every batch
+  if (!ring_init (&sprites->ring, GL_ARRAY_BUFFER,
+                  RING_SEGMENTS * SPRITE_BATCH * 4 * sizeof (SpriteVertex)))
+    {
+      error_message = "unable to create the ring buffer";
+      goto exit_on_error;
+    }
+  elements = (GLushort *) g_slice_alloc (6 * SPRITE_BATCH * sizeof (GLushort));
+  for (i = 0; i < SPRITE_BATCH; ++i)
+    {
+      elements[6 * i] = 4 * i;
+      elements[6 * i + 1] = 4 * i + 1;
+      elements[6 * i + 2] = 4 * i + 2;
+      elements[6 * i + 3] = 4 * i + 2;
+      elements[6 * i + 4] = 4 * i + 1;
+      elements[6 * i + 5] = 4 * i + 3;
+    }
+  glGenBuffers (1, &sprites->ibo);
+  state_bind_buffer (GL_ELEMENT_ARRAY_BUFFER, sprites->ibo);
+  glBufferData (GL_ELEMENT_ARRAY_BUFFER, 6 * SPRITE_BATCH * sizeof (GLushort),
+                elements, GL_STATIC_DRAW);
+  g_slice_free1 (6 * SPRITE_BATCH * sizeof (GLushort), elements);
+
+  // Atlas textures, added when needed
+  glGetIntegerv (GL_MAX_TEXTURE_SIZE, &k);
+  sprites->atlas_size = MIN (SPRITE_ATLAS_SIZE, k);
+  sprites->natlases = 0;
+  memset (&sprites->stats, 0, sizeof (SpriteStats));
+  sprite_batch_begin (sprites, 1, 1);
+
+#if DEBUG
+  printf ("sprite_init: end\n");
+  fflush (stdout);
+#endif
+  return 1;
+
+exit_on_error:
+  printf ("ERROR! Sprite: %s\n", error_message);
+  shader_program_release (sprites->program);
+#if DEBUG
+  printf ("sprite_init: end\n");
+  fflush (stdout);
+#endif
+  return 0;
+}
+
+/**
+ * Function to find a place for an image in an atlas texture.
+ *
+ * \return 1 if the image fits, 0 otherwise.
+ */
+static int
+sprite_atlas_fit (SpriteAtlas * atlas,  ///< SpriteAtlas struct data.
+                  unsigned int size,    ///< Side in pixels of the atlas.
+                  unsigned int width,   ///< Image width.
+                  unsigned int height,  ///< Image height.
+                  unsigned int *pen_x,  ///< x coordinate of the place.
+                  unsigned int *pen_y,  ///< y coordinate of the place.
+                  unsigned int *row_height)     ///< Height of the row.
+{
+  // Packing in the atlas rows leaving 1 pixel gap to avoid filtering bleeds
+  *pen_x = atlas->pen_x;
+  *pen_y = atlas->pen_y;
+  *row_height = atlas->row_height;
+  if (*pen_x + width + 1 > size)
+    {
+      *pen_x = 0;
+      *pen_y += *row_height;
+      *row_height = 0;
+    }
+  return *pen_y + height + 1 <= size;
+}
+
+/**
+ * Function to pack an image in an atlas texture. The image bytes have to be
+ *   in memory, so compressed textures can not be packed. The atlases are
+ *   tried in order and a new atlas is added if the image does not fit. It has
+ *   to be called on the GL thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+sprite_frame_add (Sprites * sprites,    ///< Sprites struct data.
+                  Image * image,        ///< Image struct data.
+                  SpriteFrame * frame)  ///< SpriteFrame struct data.
+{
+  SpriteAtlas *atlas;
+  const char *error_message;
+  unsigned int i, size, pen_x, pen_y, row_height;
+
+  size = sprites->atlas_size;
+  if (!image->image)
+    {
+      error_message = "the image bytes are not in memory";
+      goto exit_on_error;
+    }
+  if (image->width + 1 > size || image->height + 1 > size)
+    {
+      error_message = "the image is larger than the atlas";
+      goto exit_on_error;
+    }
+  for (i = 0; i < sprites->natlases; ++i)
+    if (sprite_atlas_fit (sprites->atlases + i, size, image->width,
+                          image->height, &pen_x, &pen_y, &row_height))
+      break;
+  atlas = sprites->atlases + i;
+  if (i == sprites->natlases)
+    {
+      if (sprites->natlases == SPRITE_MAX_ATLASES)
+        {
+          error_message = "the atlases are full";
+          goto exit_on_error;
+        }
+      ++sprites->natlases;
+      atlas->vertices = (SpriteVertex *)
+        g_slice_alloc (4 * SPRITE_BATCH * sizeof (SpriteVertex));
+      atlas->pen_x = atlas->pen_y = atlas->row_height = atlas->nsprites = 0;
+      glGenTextures (1, &atlas->texture);
+      state_bind_texture (atlas->texture);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA,
+                    GL_UNSIGNED_BYTE, NULL);
+      sprite_atlas_fit (atlas, size, image->width, image->height, &pen_x,
+                        &pen_y, &row_height);
+    }
+
+  // Copying the image, the rows are in the OpenGL order
+  state_bind_texture (atlas->texture);
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+  glTexSubImage2D (GL_TEXTURE_2D, 0, pen_x, pen_y, image->width,
+                   image->height, GL_RGBA, GL_UNSIGNED_BYTE, image->image);
+  frame->s0 = ((GLfloat) pen_x) / size;
+  frame->t0 = ((GLfloat) pen_y) / size;
+  frame->s1 = ((GLfloat) (pen_x + image->width)) / size;
+  frame->t1 = ((GLfloat) (pen_y + image->height)) / size;
+  frame->width = image->width;
+  frame->height = image->height;
+  frame->atlas = i;
+  atlas->pen_x = pen_x + image->width + 1;
+  atlas->pen_y = pen_y;
+  atlas->row_height = MAX (row_height, image->height + 1);
+  ++sprites->stats.frames;
+  return 1;
+
+exit_on_error:
+  printf ("ERROR! Sprite: %s\n", error_message);
+  return 0;
+}
+
+/**
+ * Function to start a batch of sprites drawn with a draw call per atlas
+ *   texture.
+ */
+void
+sprite_batch_begin (Sprites * sprites,  ///< Sprites struct data.
+                    unsigned int window_width,  ///< Window width.
+                    unsigned int window_height) ///< Window height.
+{
+  unsigned int i;
+  memset (sprites->matrix, 0, 16 * sizeof (GLfloat));
+  sprites->matrix[0] = 2.f / window_width;
+  sprites->matrix[5] = 2.f / window_height;
+  sprites->matrix[10] = sprites->matrix[15] = 1.f;
+  sprites->matrix[12] = sprites->matrix[13] = -1.f;
+  for (i = 0; i < sprites->natlases; ++i)
+    sprites->atlases[i].nsprites = 0;
+}
+
+/**
+ * Function to add a sprite to the batch.
+ */
+void
+sprite_batch_add (Sprites * sprites,    ///< Sprites struct data.
+                  const SpriteFrame * frame,    ///< Sprite image.
+                  float x,      ///< x window coordinate of the center.
+                  float y,      ///< y window coordinate of the center.
+                  float scale,  ///< Scale factor.
+                  float angle)  ///< Counterclockwise rotation in radians.
+{
+  SpriteAtlas *atlas;
+  SpriteVertex *vertex;
+  float c, s, wc, ws, hc, hs;
+
+  atlas = sprites->atlases + frame->atlas;
+  if (atlas->nsprites == SPRITE_BATCH)
+    sprite_batch_flush (sprites);
+  c = 0.5f * scale * cosf (angle);
+  s = 0.5f * scale * sinf (angle);
+  wc = frame->width * c;
+  ws = frame->width * s;
+  hc = frame->height * c;
+  hs = frame->height * s;
+
+  // Corners in the order of the indices: bottom-left, bottom-right, top-left
+  // and top-right
+  vertex = atlas->vertices + 4 * atlas->nsprites++;
+  vertex[0].position[0] = x - wc + hs;
+  vertex[0].position[1] = y - ws - hc;
+  vertex[0].texture[0] = frame->s0;
+  vertex[0].texture[1] = frame->t0;
+  vertex[1].position[0] = x + wc + hs;
+  vertex[1].position[1] = y + ws - hc;
+  vertex[1].texture[0] = frame->s1;
+  vertex[1].texture[1] = frame->t0;
+  vertex[2].position[0] = x - wc - hs;
+  vertex[2].position[1] = y - ws + hc;
+  vertex[2].texture[0] = frame->s0;
+  vertex[2].texture[1] = frame->t1;
+  vertex[3].position[0] = x + wc - hs;
+  vertex[3].position[1] = y + ws + hc;
+  vertex[3].texture[0] = frame->s1;
+  vertex[3].texture[1] = frame->t1;
+}
+
+/**
+ * Function to draw all the sprites added to the batch.
+ */
+void
+sprite_batch_end (Sprites * sprites)    ///< Sprites struct data.
+{
+  sprite_batch_flush (sprites);
+}
+
+/**
+ * Function to get the counters of a sprite batch.
+ */
+void
+sprite_stats (Sprites * sprites,        ///< Sprites struct data.
+              SpriteStats * stats)      ///< SpriteStats struct data.
+{
+  *stats = sprites->stats;
+  stats->atlases = sprites->natlases;
+}
+
+/**
+ * Function to free the memory used by a sprite batch.
+ */
+void
+sprite_destroy (Sprites * sprites)      ///< Sprites struct data.
+{
+  unsigned int i;
+
+#if DEBUG
+  printf ("sprite_destroy: start\n");
+  fflush (stdout);
+#endif
+
+  for (i = 0; i < sprites->natlases; ++i)
+    {
+      state_delete_textures (1, &sprites->atlases[i].texture);
+      g_slice_free1 (4 * SPRITE_BATCH * sizeof (SpriteVertex),
+                     sprites->atlases[i].vertices);
+    }
+  state_delete_buffers (1, &sprites->ibo);
+  ring_destroy (&sprites->ring);
+  shader_program_release (sprites->program);
+
+#if DEBUG
+  printf ("sprite_destroy: end\n");
+  fflush (stdout);
+#endif
+}
@@ -0,0 +1,90 @@
+#ifndef SPRITE__H
+#define SPRITE__H 1
+
+#define SPRITE_ATLAS_SIZE 2048  ///< Side in pixels of a sprite atlas texture.
+#define SPRITE_MAX_ATLASES 8    ///< Maximum number of sprite atlas textures.
+#define SPRITE_BATCH 4096       ///< Maximum number of sprites in a draw call.
+
+/**
+ * \struct SpriteVertex
+ * \brief A struct to define a vertex of a sprite quad.
+ */
+typedef struct
+{
+  GLfloat position[2];          ///< Position (x, y) in window pixels.
+  GLfloat texture[2];           ///< Texture (s, t) in the atlas.
+} SpriteVertex;
+
+/**
+ * \struct SpriteFrame
+ * \brief A struct to define an image packed in a sprite atlas.
+ */
+typedef struct
+{
+  GLfloat s0;                   ///< Left texture coordinate in the atlas.
+  GLfloat t0;                   ///< Bottom texture coordinate in the atlas.
+  GLfloat s1;                   ///< Right texture coordinate in the atlas.
+  GLfloat t1;                   ///< Top texture coordinate in the atlas.
+  unsigned int width;           ///< Width in pixels.
+  unsigned int height;          ///< Height in pixels.
+  unsigned int atlas;           ///< Atlas texture.
+} SpriteFrame;
+
+/**
+ * \struct SpriteAtlas
+ * \brief A struct to define a sprite atlas texture.
+ */
+typedef struct
+{
+  SpriteVertex *vertices;       ///< Batched sprite quads using the atlas.
+  GLuint texture;               ///< Atlas texture.
+  unsigned int pen_x;           ///< x coordinate of the next free place.
+  unsigned int pen_y;           ///< y coordinate of the current row.
+  unsigned int row_height;      ///< Height of the current row.
+  unsigned int nsprites;        ///< Number of batched sprite quads.
+} SpriteAtlas;
+
+/**
+ * \struct SpriteStats
+ * \brief A struct to define the sprite batch counters.
+ */
+typedef struct
+{
+  guint64 sprites;              ///< Drawn sprites.
+  guint64 draws;                ///< Draw calls.
+  unsigned int frames;          ///< Images packed in the atlases.
+  unsigned int atlases;         ///< Number of atlas textures.
+} SpriteStats;
+
+/**
+ * \struct Sprites
+ * \brief A struct to define a batch of sprites drawn with a draw call per
+ *   atlas texture.
+ */
+typedef struct
+{
+  SpriteAtlas atlases[SPRITE_MAX_ATLASES];      ///< Atlas textures.
+  SpriteStats stats;            ///< Sprite batch counters.
+  GLfloat matrix[16];           ///< Projection matrix from window pixels.
+  Ring ring;                    ///< Ring buffer streaming the sprite quads.
+  GLint attribute_position;     ///< Sprite variable position.
+  GLint attribute_texture;      ///< Sprite variable texture position.
+  GLint uniform_texture;        ///< Sprite texture constant.
+  GLint uniform_matrix;         ///< Projection matrix constant.
+  GLuint ibo;                   ///< Sprite quads indices buffer object.
+  ShaderProgram *program;       ///< Shared texture program.
+  unsigned int atlas_size;      ///< Side in pixels of the atlas textures.
+  unsigned int natlases;        ///< Number of atlas textures.
+} Sprites;
+
+int sprite_init (Sprites * sprites);
+int sprite_frame_add (Sprites * sprites, Image * image, SpriteFrame * frame);
+void sprite_batch_begin (Sprites * sprites, unsigned int window_width,
+                         unsigned int window_height);
+void sprite_batch_add (Sprites * sprites, const SpriteFrame * frame, float x,
+                       float y, float scale, float angle);
+void sprite_batch_end (Sprites * sprites);
+void sprite_stats (Sprites * sprites, SpriteStats * stats);
+void sprite_destroy (Sprites * sprites);
+
+#endif
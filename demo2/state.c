@@ -0,0 +1,392 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <epoxy/gl.h>
+
+#include "state.h"
+
+#define STATE_UNKNOWN ((GLuint) -1)     ///< Value of a not tracked binding.
+#define STATE_BUFFERS 3         ///< Number of tracked buffer targets.
+#define STATE_ATTRIBUTES 16     ///< Number of tracked vertex attributes.
+
+/**
+ * \struct StateUniform
+ * \brief A struct to define the shadow value of a uniform.
+ */
+typedef struct
+{
+  guint64 key;                  ///< Hash key (program and location).
+  GLfloat value[16];            ///< Last value.
+} StateUniform;
+
+/**
+ * \struct State
+ * \brief A struct to define the tracked GL state.
+ */
+typedef struct
+{
+  GHashTable *uniforms;         ///< Shadow values of the uniforms.
+  StateStats stats;             ///< Counters of the current frame.
+  StateStats last;              ///< Counters of the last frame.
+  GLuint buffers[STATE_BUFFERS];        ///< Bound buffers.
+  GLuint textures[STATE_TEXTURE_UNITS]; ///< Bound 2D textures.
+  GLuint program;               ///< Current program.
+  GLuint array;                 ///< Bound vertex array.
+  GLenum unit;                  ///< Active texture unit, 0 if unknown.
+  GLenum blend_source;          ///< Blend source factor, 0 if unknown.
+  GLenum blend_destination;     ///< Blend destination factor, 0 if unknown.
+  guint32 attributes;           ///< Enabled generic vertex attributes mask.
+  int attributes_known;         ///< 1 if the enabled attributes are known.
+  int blend;                    ///< 1 if blending is enabled, -1 if unknown.
+  int depth_test;               ///< 1 if depth test is enabled, -1 if unknown.
+} State;
+
+static State state = {.uniforms = NULL };       ///< Tracked GL state.
+
+/**
+ * Function to count a GL state call.
+ *
+ * \return 1 if the call has to be issued, 0 if it is redundant.
+ */
+static inline int
+state_count (int issue)         ///< 1 if the call has to be issued.
+{
+  if (issue)
+    ++state.stats.issued;
+  else
+    ++state.stats.skipped;
+  return issue;
+}
+
+/**
+ * Function to forget the tracked GL state. It has to be called when a context
+ *   is created or when the state is changed without the state functions.
+ */
+void
+state_reset ()
+{
+  unsigned int i;
+  for (i = 0; i < STATE_BUFFERS; ++i)
+    state.buffers[i] = STATE_UNKNOWN;
+  for (i = 0; i < STATE_TEXTURE_UNITS; ++i)
+    state.textures[i] = STATE_UNKNOWN;
+  state.program = state.array = STATE_UNKNOWN;
+  state.unit = state.blend_source = state.blend_destination = 0;
+  state.attributes_known = 0;
+  state.blend = state.depth_test = -1;
+  if (state.uniforms)
+    g_hash_table_remove_all (state.uniforms);
+  else
+    state.uniforms = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+                                            g_free);
+}
+
+/**
+ * Function to start the counters of a new frame.
+ */
+void
+state_frame ()
+{
+  state.last = state.stats;
+  state.stats.issued = state.stats.skipped = 0;
+}
+
+/**
+ * Function to get the counters of the GL state calls of the last frame.
+ */
+void
+state_stats (StateStats * stats)        ///< StateStats struct data.
+{
+  *stats = state.last;
+}
+
+/**
+ * Function to use a program.
+ */
+void
+state_use_program (GLuint program)      ///< Program identifier.
+{
+  if (state_count (state.program != program))
+    {
+      glUseProgram (program);
+      state.program = program;
+    }
+}
+
+/**
+ * Function to bind a vertex array. The element buffer and the enabled
+ *   attributes are vertex array state, so they are forgotten.
+ */
+void
+state_bind_vertex_array (GLuint array)  ///< Vertex array identifier.
+{
+  if (state_count (state.array != array))
+    {
+      glBindVertexArray (array);
+      state.array = array;
+      state.buffers[1] = STATE_UNKNOWN;
+      state.attributes_known = 0;
+    }
+}
+
+/**
+ * Function to get the tracking slot of a buffer target.
+ *
+ * \return slot, -1 if the target is not tracked.
+ */
+static inline int
+state_buffer_slot (GLenum target)       ///< Buffer target.
+{
+  switch (target)
+    {
+    case GL_ARRAY_BUFFER:
+      return 0;
+    case GL_ELEMENT_ARRAY_BUFFER:
+      return 1;
+    case GL_PIXEL_UNPACK_BUFFER:
+      return 2;
+    default:
+      return -1;
+    }
+}
+
+/**
+ * Function to bind a buffer.
+ */
+void
+state_bind_buffer (GLenum target,       ///< Buffer target.
+                   GLuint buffer)       ///< Buffer identifier.
+{
+  int slot;
+  slot = state_buffer_slot (target);
+  if (slot < 0)
+    glBindBuffer (target, buffer);
+  else if (state_count (state.buffers[slot] != buffer))
+    {
+      glBindBuffer (target, buffer);
+      state.buffers[slot] = buffer;
+    }
+}
+
+/**
+ * Function to select the active texture unit.
+ */
+void
+state_active_texture (GLenum unit)      ///< Texture unit (GL_TEXTURE0...).
+{
+  if (state_count (state.unit != unit))
+    {
+      glActiveTexture (unit);
+      state.unit = unit;
+    }
+}
+
+/**
+ * Function to bind a 2D texture in the active texture unit.
+ */
+void
+state_bind_texture (GLuint texture)     ///< Texture identifier.
+{
+  unsigned int i;
+  i = state.unit - GL_TEXTURE0;
+  if (!state.unit || i >= STATE_TEXTURE_UNITS)
+    glBindTexture (GL_TEXTURE_2D, texture);
+  else if (state_count (state.textures[i] != texture))
+    {
+      glBindTexture (GL_TEXTURE_2D, texture);
+      state.textures[i] = texture;
+    }
+}
+
+/**
+ * Function to set the enabled generic vertex attribute arrays. The arrays of
+ *   the mask are enabled and the rest are disabled.
+ */
+void
+state_attributes (guint32 mask) ///< Mask of STATE_ATTRIBUTE bits.
+{
+  guint32 changed;
+  unsigned int i;
+  // Unknown state: the first STATE_ATTRIBUTES arrays are set
+  changed = state.attributes_known ? state.attributes ^ mask
+    : STATE_ATTRIBUTE (STATE_ATTRIBUTES) - 1;
+  for (i = 0; i < STATE_ATTRIBUTES; ++i)
+    if (state_count (changed & STATE_ATTRIBUTE (i)))
+      {
+        if (mask & STATE_ATTRIBUTE (i))
+          glEnableVertexAttribArray (i);
+        else
+          glDisableVertexAttribArray (i);
+      }
+  state.attributes = mask;
+  state.attributes_known = 1;
+}
+
+/**
+ * Function to enable or disable the blending or the depth test.
+ */
+void
+state_enable (GLenum cap,       ///< GL_BLEND or GL_DEPTH_TEST.
+              int enable)       ///< 1 to enable, 0 to disable.
+{
+  int *current;
+  switch (cap)
+    {
+    case GL_BLEND:
+      current = &state.blend;
+      break;
+    case GL_DEPTH_TEST:
+      current = &state.depth_test;
+      break;
+    default:
+      current = NULL;
+    }
+  if (current && !state_count (*current != enable))
+    return;
+  if (enable)
+    glEnable (cap);
+  else
+    glDisable (cap);
+  if (current)
+    *current = enable;
+}
+
+/**
+ * Function to set the blend factors.
+ */
+void
+state_blend_func (GLenum source,        ///< Source factor.
+                  GLenum destination)   ///< Destination factor.
+{
+  if (state_count (state.blend_source != source
+                   || state.blend_destination != destination))
+    {
+      glBlendFunc (source, destination);
+      state.blend_source = source;
+      state.blend_destination = destination;
+    }
+}
+
+/**
+ * Function to check if a uniform of the current program has to be set. The
+ *   shadow value is updated.
+ *
+ * \return 1 if the value changed, 0 otherwise.
+ */
+static int
+state_uniform (GLint location,  ///< Uniform location.
+               const void *value,       ///< Value.
+               gsize size)      ///< Size in bytes of the value.
+{
+  StateUniform *uniform;
+  guint64 key;
+  if (state.program == STATE_UNKNOWN)
+    return state_count (1);
+  key = ((guint64) state.program << 32) | (guint32) location;
+  uniform = (StateUniform *) g_hash_table_lookup (state.uniforms, &key);
+  if (!uniform)
+    {
+      uniform = (StateUniform *) g_malloc (sizeof (StateUniform));
+      uniform->key = key;
+      g_hash_table_insert (state.uniforms, &uniform->key, uniform);
+    }
+  else if (!memcmp (uniform->value, value, size))
+    return state_count (0);
+  memcpy (uniform->value, value, size);
+  return state_count (1);
+}
+
+/**
+ * Function to set an integer uniform of the current program.
+ */
+void
+state_uniform1i (GLint location,        ///< Uniform location.
+                 GLint value)   ///< Value.
+{
+  if (state_uniform (location, &value, sizeof (GLint)))
+    glUniform1i (location, value);
+}
+
+/**
+ * Function to set a vec3 uniform of the current program.
+ */
+void
+state_uniform3fv (GLint location,       ///< Uniform location.
+                  const GLfloat * value)        ///< Value.
+{
+  if (state_uniform (location, value, 3 * sizeof (GLfloat)))
+    glUniform3fv (location, 1, value);
+}
+
+/**
+ * Function to set a mat4 uniform of the current program.
+ */
+void
+state_uniform_matrix4fv (GLint location,        ///< Uniform location.
+                         const GLfloat * value) ///< Value.
+{
+  if (state_uniform (location, value, 16 * sizeof (GLfloat)))
+    glUniformMatrix4fv (location, 1, GL_FALSE, value);
+}
+
+/**
+ * Function to delete buffers. The deleted buffers are unbound.
+ */
+void
+state_delete_buffers (GLsizei n,        ///< Number of buffers.
+                      const GLuint * buffers)   ///< Buffer identifiers.
+{
+  GLsizei i;
+  unsigned int j;
+  for (i = 0; i < n; ++i)
+    for (j = 0; j < STATE_BUFFERS; ++j)
+      if (state.buffers[j] == buffers[i])
+        state.buffers[j] = 0;
+  glDeleteBuffers (n, buffers);
+}
+
+/**
+ * Function to delete textures. The deleted textures are unbound.
+ */
+void
+state_delete_textures (GLsizei n,       ///< Number of textures.
+                       const GLuint * textures) ///< Texture identifiers.
+{
+  GLsizei i;
+  unsigned int j;
+  for (i = 0; i < n; ++i)
+    for (j = 0; j < STATE_TEXTURE_UNITS; ++j)
+      if (state.textures[j] == textures[i])
+        state.textures[j] = 0;
+  glDeleteTextures (n, textures);
+}
+
+/**
+ * Function to remove the shadow values of the uniforms of a program.
+ *
+ * \return TRUE if the shadow value belongs to the program.
+ */
+static gboolean
+state_uniform_remove (gpointer key,     ///< Hash key.
+                      gpointer value G_GNUC_UNUSED,     ///< unused.
+                      gpointer program) ///< Program identifier.
+{
+  return (*(guint64 *) key >> 32) == GPOINTER_TO_UINT (program);
+}
+
+/**
+ * Function to delete a program. Its uniform shadow values are removed.
+ */
+void
+state_delete_program (GLuint program)   ///< Program identifier.
+{
+  if (state.uniforms)
+    g_hash_table_foreach_remove (state.uniforms, state_uniform_remove,
+                                 GUINT_TO_POINTER (program));
+  if (state.program == program)
+    state.program = STATE_UNKNOWN;
+  glDeleteProgram (program);
+}
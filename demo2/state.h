@@ -0,0 +1,36 @@
+#ifndef STATE__H
+#define STATE__H 1
+
+#define STATE_TEXTURE_UNITS 8   ///< Number of tracked texture units.
+#define STATE_ATTRIBUTE(location) (1u << (location))
+///< Bit of a generic vertex attribute in an enabled attributes mask.
+
+/**
+ * \struct StateStats
+ * \brief A struct to define the counters of the GL state calls of a frame.
+ */
+typedef struct
+{
+  unsigned int issued;          ///< GL calls issued.
+  unsigned int skipped;         ///< Redundant GL calls skipped.
+} StateStats;
+
+void state_reset ();
+void state_frame ();
+void state_stats (StateStats * stats);
+void state_use_program (GLuint program);
+void state_bind_vertex_array (GLuint array);
+void state_bind_buffer (GLenum target, GLuint buffer);
+void state_active_texture (GLenum unit);
+void state_bind_texture (GLuint texture);
+void state_attributes (guint32 mask);
+void state_enable (GLenum cap, int enable);
+void state_blend_func (GLenum source, GLenum destination);
+void state_uniform1i (GLint location, GLint value);
+void state_uniform3fv (GLint location, const GLfloat * value);
+void state_uniform_matrix4fv (GLint location, const GLfloat * value);
+void state_delete_buffers (GLsizei n, const GLuint * buffers);
+void state_delete_textures (GLsizei n, const GLuint * textures);
+void state_delete_program (GLuint program);
+
+#endif
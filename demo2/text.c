@@ -4,126 +4,1030 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <png.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_MODULE_H
 #include <epoxy/gl.h>
 
+#include "state.h"
+#include "ktx.h"
+#include "shader.h"
 #include "image.h"
+#include "ring.h"
 #include "text.h"
 
+#if FREETYPE_MAJOR * 100 + FREETYPE_MINOR >= 211
+#define TEXT_HAVE_SDF 1
+#else
+#define TEXT_HAVE_SDF 0
+#endif
+///< FreeType SDF renderer available.
+
 /**
- * Function to init the variables used to draw text.
+ * \struct TextPrewarm
+ * \brief A struct to define the work of a thread rasterizing glyphs.
+ */
+typedef struct
+{
+  Text *text;                   ///< Text struct data.
+  const gunichar *ranges;       ///< Array of character ranges (first, last).
+  unsigned int nranges;         ///< Number of character ranges.
+  unsigned int thread;          ///< Thread number.
+  unsigned int nthreads;        ///< Number of threads.
+  unsigned int nglyphs;         ///< Number of rasterized glyphs.
+} TextPrewarm;
+
+/**
+ * \struct TextCacheHeader
+ * \brief A struct to define the header of a glyph atlas cache file. It is
+ *   followed by the TextCachePage array, the TextGlyph array and the pixels of
+ *   the atlas pages. All the sizes are multiple of 8 bytes, so the TextGlyph
+ *   array is aligned in the mapped file.
+ */
+typedef struct
+{
+  char magic[8];                ///< File identifier.
+  guint32 version;              ///< Cache format version.
+  guint32 mode;                 ///< Mode to rasterize the glyphs.
+  guint32 pixel_size;           ///< Pixel size of the face.
+  guint32 atlas_size;           ///< Side in pixels of the atlas pages.
+  guint32 nglyphs;              ///< Number of glyphs.
+  guint32 npages;               ///< Number of atlas pages.
+  gint32 ascender;              ///< Height over the baseline in pixels.
+  gint32 descender;             ///< Depth under the baseline in pixels.
+  gint32 line_height;           ///< Distance between baselines in pixels, 0 if
+  ///< unknown.
+  guint32 padding;              ///< Padding to a multiple of 8 bytes.
+  gint64 font_mtime;            ///< Modification time of the font file.
+} TextCacheHeader;
+
+/**
+ * \struct TextCachePage
+ * \brief A struct to define the packing state of a cached atlas page.
+ */
+typedef struct
+{
+  guint32 pen_x;                ///< x coordinate of the next free place.
+  guint32 pen_y;                ///< y coordinate of the current row.
+  guint32 row_height;           ///< Height of the current row.
+  guint32 padding;              ///< Padding to a multiple of 8 bytes.
+} TextCachePage;
+
+static const char text_cache_magic[8] = "GOGLTEXT";
+///< Identifier of the glyph atlas cache files.
+
+/**
+ * Function to draw glyph quads stored in a vertex buffer object.
+ */
+static void
+text_draw_quads (Text * text,   ///< Text struct data.
+                 GLuint vbo,    ///< Vertex buffer object with the quads.
+                 GLuint texture,        ///< Atlas page texture.
+                 unsigned int first,    ///< First glyph quad.
+                 unsigned int nglyphs)  ///< Number of glyph quads.
+{
+  unsigned int i, n;
+
+  state_use_program (text->program->id);
+  state_active_texture (GL_TEXTURE0);
+  state_bind_texture (texture);
+  state_uniform1i (text->uniform_text, 0);
+
+  // Each glyph is an instance of a quad expanded in the vertex shader
+  if (text->instanced)
+    {
+      state_attributes (STATE_ATTRIBUTE (text->attribute_corner)
+                        | STATE_ATTRIBUTE (text->attribute_rect)
+                        | STATE_ATTRIBUTE (text->attribute_texture)
+                        | STATE_ATTRIBUTE (text->attribute_color));
+      state_bind_buffer (GL_ARRAY_BUFFER, text->vbo_corner);
+      glVertexAttribPointer (text->attribute_corner, 2, GL_FLOAT, GL_FALSE, 0,
+                             0);
+      state_bind_buffer (GL_ARRAY_BUFFER, vbo);
+      glVertexAttribPointer (text->attribute_rect, 4, GL_FLOAT, GL_FALSE,
+                             sizeof (TextInstance),
+                             (void *) (first * sizeof (TextInstance)
+                                       + G_STRUCT_OFFSET (TextInstance,
+                                                          rect)));
+      glVertexAttribDivisor (text->attribute_rect, 1);
+      glVertexAttribPointer (text->attribute_texture, 4, GL_FLOAT, GL_FALSE,
+                             sizeof (TextInstance),
+                             (void *) (first * sizeof (TextInstance)
+                                       + G_STRUCT_OFFSET (TextInstance,
+                                                          texture)));
+      glVertexAttribDivisor (text->attribute_texture, 1);
+      glVertexAttribPointer (text->attribute_color, 4, GL_UNSIGNED_BYTE,
+                             GL_TRUE, sizeof (TextInstance),
+                             (void *) (first * sizeof (TextInstance)
+                                       + G_STRUCT_OFFSET (TextInstance,
+                                                          color)));
+      glVertexAttribDivisor (text->attribute_color, 1);
+      glDrawArraysInstanced (GL_TRIANGLE_STRIP, 0, 4, nglyphs);
+      glVertexAttribDivisor (text->attribute_color, 0);
+      glVertexAttribDivisor (text->attribute_texture, 0);
+      glVertexAttribDivisor (text->attribute_rect, 0);
+      return;
+    }
+
+  // Else 4 vertices per glyph
+  state_bind_buffer (GL_ARRAY_BUFFER, vbo);
+  state_bind_buffer (GL_ELEMENT_ARRAY_BUFFER, text->ibo);
+  state_attributes (STATE_ATTRIBUTE (text->attribute_position)
+                    | STATE_ATTRIBUTE (text->attribute_color));
+  for (i = 0; i < nglyphs; i += n)
+    {
+      n = MIN (nglyphs - i, TEXT_BATCH_GLYPHS);
+      glVertexAttribPointer (text->attribute_position, 4, GL_FLOAT, GL_FALSE,
+                             sizeof (TextVertex),
+                             (void *) (4 * (first + i) * sizeof (TextVertex)
+                                       + G_STRUCT_OFFSET (TextVertex,
+                                                          position)));
+      glVertexAttribPointer (text->attribute_color, 4, GL_UNSIGNED_BYTE,
+                             GL_TRUE, sizeof (TextVertex),
+                             (void *) (4 * (first + i) * sizeof (TextVertex)
+                                       + G_STRUCT_OFFSET (TextVertex, color)));
+      glDrawElements (GL_TRIANGLES, 6 * n, GL_UNSIGNED_SHORT, 0);
+    }
+}
+
+/**
+ * Function to get the size in bytes of the vertex data of a glyph quad.
+ *
+ * \return size in bytes.
+ */
+static inline GLsizeiptr
+text_stride (Text * text)       ///< Text struct data.
+{
+  if (text->instanced)
+    return sizeof (TextInstance);
+  return 4 * sizeof (TextVertex);
+}
+
+/**
+ * Function to write the vertex data of glyph quads.
+ */
+static void
+text_write (Text * text,        ///< Text struct data.
+            void *data,         ///< Vertex data.
+            TextInstance * instances,   ///< Array of glyph quads.
+            unsigned int n)     ///< Number of glyph quads.
+{
+  TextVertex *vertex;
+  unsigned int i, j;
+
+  if (text->instanced)
+    {
+      memcpy (data, instances, n * sizeof (TextInstance));
+      return;
+    }
+
+  // Expanding the quads to 4 vertices (top-left, top-right, bottom-left,
+  // bottom-right)
+  for (i = 0, vertex = (TextVertex *) data; i < n; ++i, vertex += 4)
+    for (j = 0; j < 4; ++j)
+      {
+        vertex[j].position[0] = instances[i].rect[(j & 1) ? 2 : 0];
+        vertex[j].position[1] = instances[i].rect[(j & 2) ? 3 : 1];
+        vertex[j].position[2] = instances[i].texture[(j & 1) ? 2 : 0];
+        vertex[j].position[3] = instances[i].texture[(j & 2) ? 3 : 1];
+        memcpy (vertex[j].color, instances[i].color, 4);
+      }
+}
+
+/**
+ * Function to store glyph quads in a vertex buffer object.
+ */
+static void
+text_upload (Text * text,       ///< Text struct data.
+             GLuint vbo,        ///< Vertex buffer object.
+             TextInstance * instances,  ///< Array of glyph quads.
+             unsigned int n,    ///< Number of glyph quads.
+             GLenum usage)      ///< Buffer usage.
+{
+  void *data;
+  gsize size;
+
+  state_bind_buffer (GL_ARRAY_BUFFER, vbo);
+  if (text->instanced)
+    {
+      glBufferData (GL_ARRAY_BUFFER, n * sizeof (TextInstance), instances,
+                    usage);
+      return;
+    }
+  size = n * text_stride (text);
+  data = g_slice_alloc (size);
+  text_write (text, data, instances, n);
+  glBufferData (GL_ARRAY_BUFFER, size, data, usage);
+  g_slice_free1 (size, data);
+}
+
+/**
+ * Function to draw the batched glyph quads with a draw call per atlas page.
+ *   The quads are streamed through the ring buffer.
+ */
+static void
+text_batch_flush (Text * text)  ///< Text struct data.
+{
+  TextPage *page;
+  void *data;
+  GLsizeiptr size, stride;
+  GLintptr offset;
+  unsigned int i;
+
+  stride = text_stride (text);
+  for (i = 0; i < text->npages; ++i)
+    {
+      page = text->pages + i;
+      if (!page->nglyphs)
+        continue;
+      size = page->nglyphs * stride;
+      data = ring_map (&text->ring, size, stride, &offset);
+      if (data)
+        {
+          text_write (text, data, page->instances, page->nglyphs);
+          ring_unmap (&text->ring, offset, size);
+          text_draw_quads (text, text->ring.buffer, page->texture,
+                           offset / stride, page->nglyphs);
+        }
+      page->nglyphs = 0;
+    }
+}
+
+/**
+ * Function to set a glyph quad.
+ */
+static void
+text_quad (TextInstance * instance,     ///< Glyph quad.
+           TextGlyph * glyph,   ///< TextGlyph struct data.
+           float x,             ///< x pen coordinate.
+           float y,             ///< y pen coordinate.
+           float sx,            ///< x scale factor.
+           float sy,            ///< y scale factor.
+           const GLubyte * color)       ///< RGBA color.
+{
+  instance->rect[0] = x + glyph->left * sx;
+  instance->rect[1] = y + glyph->top * sy;
+  instance->rect[2] = instance->rect[0] + glyph->width * sx;
+  instance->rect[3] = instance->rect[1] - glyph->rows * sy;
+  instance->texture[0] = glyph->s0;
+  instance->texture[1] = glyph->t0;
+  instance->texture[2] = glyph->s1;
+  instance->texture[3] = glyph->t1;
+  memcpy (instance->color, color, 4);
+}
+
+/**
+ * Function to convert a float RGBA color to bytes.
+ */
+static inline void
+text_color (GLubyte * c,        ///< RGBA bytes.
+            const GLfloat * color)      ///< RGBA floats.
+{
+  unsigned int i;
+  for (i = 0; i < 4; ++i)
+    c[i] = (GLubyte) (255.f * CLAMP (color[i], 0.f, 1.f) + 0.5f);
+}
+
+/**
+ * Function to add an atlas page, empty or with the pixels of the mapped cache
+ *   file. The page texture is created by text_atlas_upload on the GL thread.
+ *
+ * \return pointer to the TextPage struct data.
+ */
+static TextPage *
+text_page_new (Text * text,     ///< Text struct data.
+               const GLubyte * mapped)
+               ///< Page pixels in the mapped cache file, NULL for an empty page.
+{
+  TextPage *page;
+  page = text->pages + text->npages++;
+  page->pixels = mapped ? NULL : (GLubyte *) g_slice_alloc0 (TEXT_PAGE_BYTES);
+  page->mapped = mapped;
+  page->instances = (TextInstance *) g_slice_alloc (TEXT_BATCH_GLYPHS
+                                                    * sizeof (TextInstance));
+  page->last_used = ++text->clock;
+  page->texture = 0;
+  page->pen_x = page->pen_y = page->row_height = 0;
+  page->dirty_y0 = 0;
+  page->dirty_y1 = TEXT_ATLAS_SIZE;
+  page->nglyphs = 0;
+  return page;
+}
+
+/**
+ * Function to free the memory used by an atlas page.
+ */
+static void
+text_page_free (TextPage * page)        ///< TextPage struct data.
+{
+  if (page->texture)
+    state_delete_textures (1, &page->texture);
+  g_slice_free1 (TEXT_BATCH_GLYPHS * sizeof (TextInstance), page->instances);
+  if (page->pixels)
+    g_slice_free1 (TEXT_PAGE_BYTES, page->pixels);
+}
+
+/**
+ * Function to get the CPU copy of the pixels of an atlas page. A page read
+ *   from the cache file is copied from the mapping on the first write.
+ *
+ * \return pointer to the page pixels.
+ */
+static GLubyte *
+text_page_pixels (TextPage * page)      ///< TextPage struct data.
+{
+  if (!page->pixels)
+    {
+      page->pixels = (GLubyte *) g_slice_alloc (TEXT_PAGE_BYTES);
+      memcpy (page->pixels, page->mapped, TEXT_PAGE_BYTES);
+    }
+  return page->pixels;
+}
+
+/**
+ * Function to check if a glyph of an atlas page has to be removed.
+ *
+ * \return TRUE if the glyph is in the page, FALSE otherwise.
+ */
+static gboolean
+text_page_glyph (gpointer key G_GNUC_UNUSED,    ///< unused.
+                 gpointer glyph,        ///< TextGlyph struct data.
+                 gpointer page) ///< Pointer to the page number.
+{
+  return ((TextGlyph *) glyph)->page == *(unsigned int *) page;
+}
+
+/**
+ * Function to get the least recently used atlas page.
+ *
+ * \return page number.
+ */
+static unsigned int
+text_page_lru (Text * text)     ///< Text struct data.
+{
+  unsigned int i, lru;
+  for (i = 1, lru = 0; i < text->npages; ++i)
+    if (text->pages[i].last_used < text->pages[lru].last_used)
+      lru = i;
+  return lru;
+}
+
+/**
+ * Function to clear an atlas page. The page keeps its texture, it is uploaded
+ *   again with the next glyphs.
+ */
+static void
+text_page_evict (Text * text,   ///< Text struct data.
+                 unsigned int i)        ///< Page number.
+{
+  TextPage *page;
+  page = text->pages + i;
+  g_hash_table_foreach_remove (text->glyphs, text_page_glyph, &i);
+  if (page->pixels)
+    memset (page->pixels, 0, TEXT_PAGE_BYTES);
+  else
+    page->pixels = (GLubyte *) g_slice_alloc0 (TEXT_PAGE_BYTES);
+  page->pen_x = page->pen_y = page->row_height = 0;
+  page->dirty_y0 = 0;
+  page->dirty_y1 = TEXT_ATLAS_SIZE;
+  page->nglyphs = 0;
+  ++text->stats.evictions;
+  ++text->generation;
+}
+
+/**
+ * Function to remove an atlas page. The last page takes its place.
+ */
+static void
+text_page_remove (Text * text,  ///< Text struct data.
+                  unsigned int i)       ///< Page number.
+{
+  GHashTableIter iter;
+  gpointer glyph;
+  unsigned int last;
+
+  g_hash_table_foreach_remove (text->glyphs, text_page_glyph, &i);
+  text_page_free (text->pages + i);
+  last = --text->npages;
+  if (i != last)
+    {
+      text->pages[i] = text->pages[last];
+      g_hash_table_iter_init (&iter, text->glyphs);
+      while (g_hash_table_iter_next (&iter, NULL, &glyph))
+        if (((TextGlyph *) glyph)->page == last)
+          ((TextGlyph *) glyph)->page = i;
+    }
+  ++text->stats.evictions;
+  ++text->generation;
+}
+
+/**
+ * Function to clear the glyph atlas removing all the pages.
+ */
+static void
+text_atlas_reset (Text * text)  ///< Text struct data.
+{
+  unsigned int i;
+  g_hash_table_remove_all (text->glyphs);
+  for (i = 0; i < text->npages; ++i)
+    text_page_free (text->pages + i);
+  text->npages = 0;
+  ++text->generation;
+  if (text->cache)
+    {
+      g_mapped_file_unref (text->cache);
+      text->cache = NULL;
+    }
+}
+
+/**
+ * Function to open a font face.
  *
  * \return 1 on success, 0 on error.
  */
-int
-text_init (Text * text)         ///< Text struct data.
+static int
+text_face_open (Text * text,    ///< Text struct data.
+                FT_Library * ft,        ///< FreeType library.
+                FT_Face * face) ///< FreeType face.
+{
+  const char *error_message;
+  FT_UInt spread;
+
+  if (!*ft && FT_Init_FreeType (ft))
+    {
+      *ft = NULL;
+      error_message = "could not init freetype library";
+      goto exit_on_error;
+    }
+  if (text->mode == TEXT_MODE_SDF)
+    {
+      spread = TEXT_SDF_SPREAD;
+      if (FT_Property_Set (*ft, "sdf", "spread", &spread)
+          || FT_Property_Set (*ft, "bsdf", "spread", &spread))
+        {
+          error_message = "could not set the SDF spread";
+          goto exit_on_error;
+        }
+    }
+  if (FT_New_Face (*ft, FONT, 0, face))
+    {
+      *face = NULL;
+      error_message = "could not open font";
+      goto exit_on_error;
+    }
+  FT_Select_Charmap (*face, ft_encoding_unicode);
+  FT_Set_Pixel_Sizes (*face, 0, text->pixel_size);
+  return 1;
+
+exit_on_error:
+  printf ("ERROR! Text: %s\n", error_message);
+  return 0;
+}
+
+/**
+ * Function to read the line metrics of a face. It has to be called with the
+ *   mutex locked.
+ */
+static void
+text_line_metrics (Text * text, ///< Text struct data.
+                   FT_Face face)        ///< FreeType face.
+{
+  FT_Size_Metrics *metrics;
+  metrics = &face->size->metrics;
+  text->ascender = metrics->ascender >> 6;
+  text->descender = -(metrics->descender >> 6);
+  text->line_height = metrics->height >> 6;
+}
+
+/**
+ * Function to open the font face of the GL thread. It is only done when a
+ *   glyph has to be rasterized or the line metrics are not in the cache.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+text_face (Text * text)         ///< Text struct data.
+{
+  if (text->face)
+    return 1;
+  if (!text_face_open (text, &text->ft, &text->face))
+    return 0;
+  g_mutex_lock (&text->mutex);
+  text_line_metrics (text, text->face);
+  g_mutex_unlock (&text->mutex);
+  return 1;
+}
+
+/**
+ * Function to get the atlas hash key of a character.
+ *
+ * \return hash key.
+ */
+static inline guint64
+text_glyph_key (Text * text,    ///< Text struct data.
+                gunichar c)     ///< Character.
+{
+  return ((guint64) text->mode << 48) | ((guint64) text->pixel_size << 32) | c;
+}
+
+/**
+ * Function to rasterize a glyph in the glyph slot of a face.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+text_rasterize (Text * text,    ///< Text struct data.
+                FT_Face face,   ///< FreeType face.
+                FT_UInt index)  ///< Glyph index.
+{
+  // The SDF renderer works from the outline
+#if TEXT_HAVE_SDF
+  if (text->mode == TEXT_MODE_SDF)
+    {
+      if (FT_Load_Glyph (face, index, FT_LOAD_DEFAULT)
+          || FT_Render_Glyph (face->glyph, FT_RENDER_MODE_SDF))
+        return 0;
+    }
+  else
+#endif
+  if (FT_Load_Glyph (face, index, FT_LOAD_RENDER))
+    return 0;
+  return face->glyph->bitmap.width + 1 <= TEXT_ATLAS_SIZE
+    && face->glyph->bitmap.rows + 1 <= TEXT_ATLAS_SIZE;
+}
+
+/**
+ * Function to find a place for a glyph bitmap in an atlas page.
+ *
+ * \return 1 if the bitmap fits, 0 otherwise.
+ */
+static int
+text_page_fit (TextPage * page, ///< TextPage struct data.
+               unsigned int width,      ///< Bitmap width.
+               unsigned int rows,       ///< Bitmap rows.
+               unsigned int *pen_x,     ///< x coordinate of the place.
+               unsigned int *pen_y,     ///< y coordinate of the place.
+               unsigned int *row_height)        ///< Height of the row.
+{
+  // Packing in the page rows leaving 1 pixel gap to avoid filtering bleeds
+  *pen_x = page->pen_x;
+  *pen_y = page->pen_y;
+  *row_height = page->row_height;
+  if (*pen_x + width + 1 > TEXT_ATLAS_SIZE)
+    {
+      *pen_x = 0;
+      *pen_y += *row_height;
+      *row_height = 0;
+    }
+  return *pen_y + rows + 1 <= TEXT_ATLAS_SIZE;
+}
+
+/**
+ * Function to pack a rasterized glyph in the CPU copy of an atlas page. The
+ *   pages are tried in order and a new page is added if the glyph does not fit
+ *   and the budget allows it. The changed rows are uploaded by
+ *   text_atlas_upload.
+ *
+ * \return pointer to the TextGlyph struct data on success, NULL if the atlas
+ *   is full.
+ */
+static TextGlyph *
+text_atlas_insert (Text * text, ///< Text struct data.
+                   guint64 key, ///< Hash key.
+                   FT_GlyphSlot slot)   ///< Glyph slot with the bitmap.
+{
+  TextGlyph *glyph;
+  TextPage *page;
+  unsigned int i, width, rows, pen_x, pen_y, row_height;
+
+  width = slot->bitmap.width;
+  rows = slot->bitmap.rows;
+  for (i = 0; i < text->npages; ++i)
+    if (text_page_fit (text->pages + i, width, rows, &pen_x, &pen_y,
+                       &row_height))
+      break;
+  if (i == text->npages)
+    {
+      if (text->npages >= text->max_pages)
+        return NULL;
+      text_page_new (text, NULL);
+      text_page_fit (text->pages + i, width, rows, &pen_x, &pen_y,
+                     &row_height);
+    }
+  page = text->pages + i;
+  if (width && rows)
+    {
+      text_page_pixels (page);
+      for (i = 0; i < rows; ++i)
+        memcpy (page->pixels + (pen_y + i) * TEXT_ATLAS_SIZE + pen_x,
+                slot->bitmap.buffer + i * slot->bitmap.pitch, width);
+      page->dirty_y0 = MIN (page->dirty_y0, pen_y);
+      page->dirty_y1 = MAX (page->dirty_y1, pen_y + rows);
+    }
+
+  // Saving the glyph metrics
+  glyph = (TextGlyph *) g_slice_alloc (sizeof (TextGlyph));
+  glyph->key = key;
+  glyph->s0 = ((GLfloat) pen_x) / TEXT_ATLAS_SIZE;
+  glyph->t0 = ((GLfloat) pen_y) / TEXT_ATLAS_SIZE;
+  glyph->s1 = ((GLfloat) (pen_x + width)) / TEXT_ATLAS_SIZE;
+  glyph->t1 = ((GLfloat) (pen_y + rows)) / TEXT_ATLAS_SIZE;
+  glyph->left = slot->bitmap_left;
+  glyph->top = slot->bitmap_top;
+  glyph->advance_x = slot->advance.x >> 6;
+  glyph->advance_y = slot->advance.y >> 6;
+  glyph->width = width;
+  glyph->rows = rows;
+  glyph->page = page - text->pages;
+  g_hash_table_insert (text->glyphs, &glyph->key, glyph);
+  page->pen_x = pen_x + width + 1;
+  page->pen_y = pen_y;
+  page->row_height = MAX (row_height, rows + 1);
+  page->last_used = ++text->clock;
+  return glyph;
+}
+
+/**
+ * Function to create the missing page textures and to upload the changed rows
+ *   of the atlas pages. The pages read from the cache file are uploaded from
+ *   the mapping. It has to be called on the GL thread.
+ */
+static void
+text_atlas_upload (Text * text) ///< Text struct data.
+{
+  const GLubyte *pixels;
+  TextPage *page;
+  unsigned int i;
+
+  state_active_texture (GL_TEXTURE0);
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+  for (i = 0; i < text->npages; ++i)
+    {
+      page = text->pages + i;
+      pixels = page->pixels ? page->pixels : page->mapped;
+      if (!page->texture)
+        {
+          glGenTextures (1, &page->texture);
+          state_bind_texture (page->texture);
+          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                           GL_CLAMP_TO_EDGE);
+          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                           GL_CLAMP_TO_EDGE);
+          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+          glTexImage2D (GL_TEXTURE_2D, 0, text->format, TEXT_ATLAS_SIZE,
+                        TEXT_ATLAS_SIZE, 0, text->format, GL_UNSIGNED_BYTE,
+                        pixels);
+        }
+      else if (page->dirty_y0 < page->dirty_y1)
+        {
+          state_bind_texture (page->texture);
+          glTexSubImage2D (GL_TEXTURE_2D, 0, 0, page->dirty_y0,
+                           TEXT_ATLAS_SIZE, page->dirty_y1 - page->dirty_y0,
+                           text->format, GL_UNSIGNED_BYTE,
+                           pixels + page->dirty_y0 * TEXT_ATLAS_SIZE);
+        }
+      page->dirty_y0 = TEXT_ATLAS_SIZE;
+      page->dirty_y1 = 0;
+    }
+}
+
+/**
+ * Function to get a glyph from the atlas, rasterizing and uploading it on the
+ *   first use. If the atlas is full, the least recently used page is cleared.
+ *
+ * \return pointer to the TextGlyph struct data on success, NULL on error.
+ */
+static TextGlyph *
+text_glyph (Text * text,        ///< Text struct data.
+            gunichar c)         ///< Character.
+{
+  TextGlyph *glyph;
+  guint64 key;
+
+  key = text_glyph_key (text, c);
+  glyph = (TextGlyph *) g_hash_table_lookup (text->glyphs, &key);
+  if (glyph)
+    {
+      ++text->stats.hits;
+      text->pages[glyph->page].last_used = ++text->clock;
+      return glyph;
+    }
+  ++text->stats.misses;
+  if (!text_face (text)
+      || !text_rasterize (text, text->face, FT_Get_Char_Index (text->face, c)))
+    return NULL;
+  glyph = text_atlas_insert (text, key, text->face->glyph);
+  if (!glyph)
+    {
+      // The batched quads use the old page contents
+      text_batch_flush (text);
+      text_page_evict (text, text_page_lru (text));
+      glyph = text_atlas_insert (text, key, text->face->glyph);
+    }
+  text_atlas_upload (text);
+  return glyph;
+}
+
+/**
+ * Function to free a glyph of the atlas.
+ */
+static void
+text_glyph_free (gpointer glyph)        ///< TextGlyph struct data.
+{
+  g_slice_free1 (sizeof (TextGlyph), glyph);
+}
+
+/**
+ * Function to open the font face to measure text and to read the line
+ *   metrics. It is only done when a glyph has to be measured or the line
+ *   metrics are not in the cache. It has to be called with the mutex locked.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+text_measure_face (Text * text) ///< Text struct data.
+{
+  if (text->measure_face)
+    return 1;
+  if (!text_face_open (text, &text->measure_ft, &text->measure_face))
+    return 0;
+  text_line_metrics (text, text->measure_face);
+  return 1;
+}
+
+/**
+ * Function to get the metrics of a glyph, measuring it on the first use. The
+ *   glyph is loaded without rendering and the ink box is the pixel box of its
+ *   hinted outline. It does not use GL and it has to be called with the mutex
+ *   locked.
+ *
+ * \return pointer to the TextMetrics struct data on success, NULL on error.
+ */
+static TextMetrics *
+text_metrics (Text * text,      ///< Text struct data.
+              gunichar c)       ///< Character.
+{
+  TextMetrics *metrics;
+  FT_GlyphSlot slot;
+  FT_Glyph_Metrics *m;
+  guint64 key;
+
+  key = text_glyph_key (text, c);
+  metrics = (TextMetrics *) g_hash_table_lookup (text->metrics, &key);
+  if (metrics)
+    return metrics;
+  if (!text_measure_face (text)
+      || FT_Load_Glyph (text->measure_face,
+                        FT_Get_Char_Index (text->measure_face, c),
+                        FT_LOAD_DEFAULT))
+    return NULL;
+  slot = text->measure_face->glyph;
+  m = &slot->metrics;
+  metrics = (TextMetrics *) g_slice_alloc (sizeof (TextMetrics));
+  metrics->key = key;
+  metrics->left = m->horiBearingX >> 6;
+  metrics->top = (m->horiBearingY + 63) >> 6;
+  metrics->advance_x = slot->advance.x >> 6;
+  metrics->advance_y = slot->advance.y >> 6;
+  metrics->width = ((m->horiBearingX + m->width + 63) >> 6) - metrics->left;
+  metrics->rows = metrics->top - ((m->horiBearingY - m->height) >> 6);
+  g_hash_table_insert (text->metrics, &metrics->key, metrics);
+  return metrics;
+}
+
+/**
+ * Function to free the metrics of a glyph.
+ */
+static void
+text_metrics_free (gpointer metrics)    ///< TextMetrics struct data.
+{
+  g_slice_free1 (sizeof (TextMetrics), metrics);
+}
+
+/**
+ * Function to submit the text program of a glyph mode to the shader registry
+ *   without waiting for its compile. The program has to be released with
+ *   shader_program_release.
+ *
+ * \return pointer to the ShaderProgram struct data.
+ */
+ShaderProgram *
+text_program_submit (unsigned int mode) ///< Mode to rasterize the glyphs.
 {
   const char *fs_source =
     "uniform sampler2D text;"
-    "uniform vec4 color;"
-    "out vec2 textcoord;"
+    "in vec2 textcoord;"
+    "in vec4 textcolor;"
     "void main ()"
-    "{gl_FragColor=vec4(1.,1.,1.,texture2D(text,textcoord).a)*color;}";
+    "{float a=TEXTURE(text,textcoord).ALPHA;\n"
+    "#ifdef SDF\n"
+    "a=smoothstep(.5-SMOOTHING(a),.5+SMOOTHING(a),a);\n"
+    "#endif\n"
+    "FRAGCOLOR=vec4(textcolor.rgb,textcolor.a*a);}";
+  const char *sdf_source = "#define SDF\n#define SMOOTHING(d) (.7*fwidth(d))\n";
   const char *vs_source =
     "in vec4 position;"
+    "in vec4 color;"
     "out vec2 textcoord;"
-    "void main (){gl_Position=vec4(position.xy,0.,1.);textcoord=position.zw;}";
-  const char *vertex_name = "position";
-  const char *color_name = "color";
-  const char *text_name = "text";
+    "out vec4 textcolor;"
+    "void main ()"
+    "{gl_Position=vec4(position.xy,0.,1.);textcoord=position.zw;"
+    "textcolor=color;}";
+  const char *vs_instanced_source =
+    "in vec2 corner;"
+    "in vec4 rect;"
+    "in vec4 texture_rect;"
+    "in vec4 color;"
+    "out vec2 textcoord;"
+    "out vec4 textcolor;"
+    "void main ()"
+    "{gl_Position=vec4(mix(rect.xy,rect.zw,corner),0.,1.);"
+    "textcoord=mix(texture_rect.xy,texture_rect.zw,corner);textcolor=color;}";
+  const char *attributes[] = { "position", "color", NULL };
+  const char *instanced_attributes[] = {
+    "corner", "rect", "texture_rect", "color", NULL
+  };
+  const char *uniforms[] = { "text", NULL };
   // GLSL version
-  const char *version;
-  const char *fs_sources[2];
+  const char *fs_sources[4];
   const char *vs_sources[2];
-  const char *error_message;
-  GLint k;
-  GLuint vs, fs;
-
-  // Select shaders
-  if (strstr ((const char *) glGetString (GL_VERSION), "OpenGL ES"))
-    version = "#version 100\n#define in attribute\n#define out varying\n"
-	      "precision mediump float;";
-  else if (epoxy_gl_version () >= 33)
-    version = "#version 330 core\n";
-  else
-    version = "#version 120\n#define in attribute\n#define out varying\n";
-  fs_sources[0] = version;
-  fs_sources[1] = fs_source;
-  vs_sources[0] = version;
-  vs_sources[1] = vs_source;
+  const char **names;
 
-  fs = glCreateShader (GL_FRAGMENT_SHADER);
-  glShaderSource (fs, 2, fs_sources, NULL);
-  glCompileShader (fs);
-  glGetShaderiv (fs, GL_COMPILE_STATUS, &k);
-  if (!k)
+  vs_sources[1] = vs_source;
+  fs_sources[1] = (mode == TEXT_MODE_SDF) ? sdf_source : "";
+  names = attributes;
+  switch (shader_dialect ())
     {
-      error_message = "unable to compile the text fragment shader";
-      goto exit_on_error;
+    case SHADER_DIALECT_ES:
+      vs_sources[0] = "#version 100\n#define in attribute\n"
+        "#define out varying\n";
+      fs_sources[0] = "#version 100\n";
+      fs_sources[2] = "precision mediump float;\n"
+        "#define in varying\n#define FRAGCOLOR gl_FragColor\n"
+        "#define TEXTURE texture2D\n#define ALPHA a\n";
+      // Screen derivatives are an extension in OpenGL ES 2.0
+      if (mode == TEXT_MODE_SDF)
+        {
+          if (epoxy_has_gl_extension ("GL_OES_standard_derivatives"))
+            fs_sources[1]
+              = "#extension GL_OES_standard_derivatives : enable\n"
+              "#define SDF\n#define SMOOTHING(d) (.7*fwidth(d))\n";
+          else
+            fs_sources[1] = "#define SDF\n#define SMOOTHING(d) .1\n";
+        }
+      break;
+    case SHADER_DIALECT_V3:
+      vs_sources[0] = "#version 330 core\n";
+      vs_sources[1] = vs_instanced_source;
+      names = instanced_attributes;
+      fs_sources[0] = "#version 330 core\n";
+      fs_sources[2] = "out vec4 fcolor;\n"
+        "#define FRAGCOLOR fcolor\n#define TEXTURE texture\n#define ALPHA r\n";
+      break;
+    default:
+      vs_sources[0] = "#version 120\n#define in attribute\n"
+        "#define out varying\n";
+      fs_sources[0] = "#version 120\n";
+      fs_sources[2] = "#define in varying\n"
+        "#define FRAGCOLOR gl_FragColor\n#define TEXTURE texture2D\n"
+        "#define ALPHA a\n";
     }
+  fs_sources[3] = fs_source;
+  return shader_program_submit ((mode == TEXT_MODE_SDF) ? "text-sdf" : "text",
+                                vs_sources, 2, fs_sources, 4, names,
+                                uniforms);
+}
 
-  vs = glCreateShader (GL_VERTEX_SHADER);
-  glShaderSource (vs, 2, vs_sources, NULL);
-  glCompileShader (vs);
-  glGetShaderiv (vs, GL_COMPILE_STATUS, &k);
-  if (!k)
+/**
+ * Function to init the variables used to draw text with a glyph mode.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+text_init_mode (Text * text,    ///< Text struct data.
+                unsigned int mode)      ///< Mode to rasterize the glyphs.
+{
+  const GLfloat corners[8] = {
+    0.f, 0.f,
+    1.f, 0.f,
+    0.f, 1.f,
+    1.f, 1.f
+  };
+  const char *error_message;
+  GStatBuf font_stat;
+  GLushort *elements;
+  GLuint i;
+
+  // Select the glyph texture format
+  if (mode == TEXT_MODE_SDF && !TEXT_HAVE_SDF)
     {
-      error_message = "unable to compile the text vertex shader";
+      error_message = "SDF glyphs need FreeType 2.11 or newer";
       goto exit_on_error;
     }
-
-  text->program = glCreateProgram ();
-  glAttachShader (text->program, fs);
-  glAttachShader (text->program, vs);
-  glLinkProgram (text->program);
-  glDetachShader (text->program, vs);
-  glDetachShader (text->program, fs);
-  glDeleteShader (vs);
-  glDeleteShader (fs);
-  glGetProgramiv (text->program, GL_LINK_STATUS, &k);
-  if (!k)
+  text->mode = mode;
+  switch (shader_dialect ())
     {
-      error_message = "unable to link the program text";
-      goto exit_on_error;
+    case SHADER_DIALECT_V3:
+      // GL_ALPHA textures are not available in the core profile
+      text->instanced = 1;
+      text->format = GL_RED;
+      break;
+    default:
+      text->instanced = 0;
+      text->format = GL_ALPHA;
     }
 
-  text->attribute_position = glGetAttribLocation (text->program, vertex_name);
-  if (text->attribute_position == -1)
+  // Shared text program of the mode
+  text->program = text_program_submit (mode);
+  if (!shader_program_wait (text->program))
     {
-      error_message = "could not bind position attribute";
+      shader_program_release (text->program);
+      error_message = "unable to get the text program";
       goto exit_on_error;
     }
-  text->uniform_text = glGetUniformLocation (text->program, text_name);
-  if (text->uniform_text == -1)
+  if (text->instanced)
     {
-      error_message = "could not bind text uniform";
-      goto exit_on_error;
+      text->attribute_corner = text->program->attributes[0];
+      text->attribute_rect = text->program->attributes[1];
+      text->attribute_texture = text->program->attributes[2];
+      text->attribute_color = text->program->attributes[3];
     }
-  text->uniform_color = glGetUniformLocation (text->program, color_name);
-  if (text->uniform_color == -1)
+  else
     {
-      error_message = "could not bind color uniform";
-      goto exit_on_error;
+      text->attribute_position = text->program->attributes[0];
+      text->attribute_color = text->program->attributes[1];
     }
+  text->uniform_text = text->program->uniforms[0];
 
-  // Initing FreeType
-  if (FT_Init_FreeType (&text->ft))
+  // The font is opened when a glyph is not in the atlas or the line metrics
+  // are not in the cache
+  if (g_stat (FONT, &font_stat))
     {
-      error_message = "could not init freetype library";
+      shader_program_release (text->program);
+      error_message = "could not open font";
       goto exit_on_error;
     }
-  if (FT_New_Face (text->ft, FONT, 0, &text->face))
+  text->font_mtime = font_stat.st_mtime;
+  text->cache = NULL;
+  text->ft = text->measure_ft = NULL;
+  text->face = text->measure_face = NULL;
+  text->ascender = text->descender = text->line_height = 0;
+  if (mode == TEXT_MODE_SDF)
+    text->pixel_size = TEXT_SDF_PIXEL_SIZE;
+  else
+    text->pixel_size = TEXT_PIXEL_SIZE;
+  text->scale = ((float) TEXT_PIXEL_SIZE) / text->pixel_size;
+
+  // Glyph quads buffers, the batches are streamed in a ring buffer holding
+  // a batch per segment
+  if (!ring_init (&text->ring, GL_ARRAY_BUFFER,
+                  RING_SEGMENTS * TEXT_BATCH_GLYPHS * 4 * sizeof (TextVertex)))
     {
-      error_message = "could not open font";
+      shader_program_release (text->program);
+      error_message = "unable to create the ring buffer";
       goto exit_on_error;
     }
-  FT_Select_Charmap (text->face, ft_encoding_unicode);
-  FT_Set_Pixel_Sizes (text->face, 0, 12);
-
-  glGenBuffers (1, &text->vbo);
+  if (text->instanced)
+    {
+      glGenBuffers (1, &text->vbo_corner);
+      state_bind_buffer (GL_ARRAY_BUFFER, text->vbo_corner);
+      glBufferData (GL_ARRAY_BUFFER, sizeof (corners), corners,
+                    GL_STATIC_DRAW);
+    }
+  else
+    {
+      // The indices are the same for every batch
+      elements = (GLushort *) g_slice_alloc (6 * TEXT_BATCH_GLYPHS
+                                             * sizeof (GLushort));
+      for (i = 0; i < TEXT_BATCH_GLYPHS; ++i)
+        {
+          elements[6 * i] = 4 * i;
+          elements[6 * i + 1] = 4 * i + 1;
+          elements[6 * i + 2] = 4 * i + 2;
+          elements[6 * i + 3] = 4 * i + 2;
+          elements[6 * i + 4] = 4 * i + 1;
+          elements[6 * i + 5] = 4 * i + 3;
+        }
+      glGenBuffers (1, &text->ibo);
+      state_bind_buffer (GL_ELEMENT_ARRAY_BUFFER, text->ibo);
+      glBufferData (GL_ELEMENT_ARRAY_BUFFER,
+                    6 * TEXT_BATCH_GLYPHS * sizeof (GLushort), elements,
+                    GL_STATIC_DRAW);
+      g_slice_free1 (6 * TEXT_BATCH_GLYPHS * sizeof (GLushort), elements);
+    }
+  // Glyph atlas, the pages are added when needed
+  text->npages = text->generation = 0;
+  text->max_pages = TEXT_BUDGET / TEXT_PAGE_BYTES;
+  text->clock = 0;
+  memset (&text->stats, 0, sizeof (TextStats));
+  text->glyphs = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+                                        text_glyph_free);
+  text->metrics = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+                                         text_metrics_free);
+  g_mutex_init (&text->mutex);
   return 1;
 
 exit_on_error:
@@ -131,6 +1035,52 @@ exit_on_error:
   return 0;
 }
 
+/**
+ * Function to init the variables used to draw text.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+text_init (Text * text)         ///< Text struct data.
+{
+  return text_init_mode (text, TEXT_MODE_BITMAP);
+}
+
+/**
+ * Function to set the texture memory budget of the glyph atlas. The least
+ *   recently used pages over the budget are removed. At least a page is
+ *   allowed.
+ */
+void
+text_set_budget (Text * text,   ///< Text struct data.
+                 gsize bytes)   ///< Budget in bytes.
+{
+  text->max_pages = CLAMP (bytes / TEXT_PAGE_BYTES, 1, TEXT_MAX_PAGES);
+  if (text->npages <= text->max_pages)
+    return;
+
+  // The batched quads use the removed pages
+  text_batch_flush (text);
+  while (text->npages > text->max_pages)
+    text_page_remove (text, text_page_lru (text));
+}
+
+/**
+ * Function to get the glyph atlas usage counters.
+ */
+void
+text_stats (Text * text,        ///< Text struct data.
+            TextStats * stats)  ///< TextStats struct data.
+{
+  unsigned int i;
+  *stats = text->stats;
+  stats->pages = text->npages;
+  stats->glyphs = g_hash_table_size (text->glyphs);
+  for (i = 0, stats->bytes_resident = 0; i < text->npages; ++i)
+    if (text->pages[i].texture)
+      stats->bytes_resident += TEXT_PAGE_BYTES;
+}
+
 /**
  * Function to free the memory used to draw text.
  */
@@ -142,10 +1092,24 @@ text_destroy (Text * text)      ///< Text struct data.
   fflush (stdout);
 #endif
 
-  glDeleteBuffers (1, &text->vbo);
-  glDeleteProgram (text->program);
-  FT_Done_Face (text->face);
-  FT_Done_Library (text->ft);
+  g_mutex_clear (&text->mutex);
+  text_atlas_reset (text);
+  g_hash_table_destroy (text->glyphs);
+  g_hash_table_destroy (text->metrics);
+  if (text->instanced)
+    state_delete_buffers (1, &text->vbo_corner);
+  else
+    state_delete_buffers (1, &text->ibo);
+  ring_destroy (&text->ring);
+  shader_program_release (text->program);
+  if (text->face)
+    FT_Done_Face (text->face);
+  if (text->ft)
+    FT_Done_Library (text->ft);
+  if (text->measure_face)
+    FT_Done_Face (text->measure_face);
+  if (text->measure_ft)
+    FT_Done_Library (text->measure_ft);
 
 #if DEBUG
   printf ("text_destroy: end\n");
@@ -153,6 +1117,452 @@ text_destroy (Text * text)      ///< Text struct data.
 #endif
 }
 
+/**
+ * Function to get the glyph atlas cache file name of a character set.
+ *
+ * \return cache file name, it has to be freed with g_free.
+ */
+static char *
+text_cache_name (Text * text,   ///< Text struct data.
+                 const char *charset)   ///< UTF-8 string with the characters.
+{
+  char *key, *hash, *name, *file;
+  key = g_strdup_printf ("%s|%" G_GINT64_FORMAT "|%u|%u|%u|%s", FONT,
+                         text->font_mtime, text->pixel_size, text->mode,
+                         TEXT_ATLAS_SIZE, charset);
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA256, key, -1);
+  name = g_strdup_printf ("text-%s.atlas", hash);
+  file = g_build_filename (g_get_user_cache_dir (), "gtkopengl", name, NULL);
+  g_free (name);
+  g_free (hash);
+  g_free (key);
+  return file;
+}
+
+/**
+ * Function to read the glyph atlas of a character set from the cache file.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+text_cache_read (Text * text,   ///< Text struct data.
+                 const char *file)      ///< Cache file name.
+{
+  GMappedFile *mapped;
+  const TextCacheHeader *header;
+  const TextCachePage *pages;
+  const TextGlyph *glyphs;
+  const GLubyte *pixels;
+  TextGlyph *glyph;
+  TextPage *page;
+  gsize size;
+  unsigned int i;
+
+  mapped = g_mapped_file_new (file, FALSE, NULL);
+  if (!mapped)
+    return 0;
+  size = g_mapped_file_get_length (mapped);
+  header = (const TextCacheHeader *) g_mapped_file_get_contents (mapped);
+  if (size < sizeof (TextCacheHeader)
+      || memcmp (header->magic, text_cache_magic, sizeof (header->magic))
+      || header->version != TEXT_CACHE_VERSION
+      || header->mode != text->mode
+      || header->pixel_size != text->pixel_size
+      || header->atlas_size != TEXT_ATLAS_SIZE
+      || header->font_mtime != text->font_mtime
+      || header->npages > text->max_pages
+      || size != sizeof (TextCacheHeader)
+      + header->npages * (sizeof (TextCachePage) + TEXT_PAGE_BYTES)
+      + header->nglyphs * sizeof (TextGlyph))
+    {
+      g_mapped_file_unref (mapped);
+      return 0;
+    }
+  pages = (const TextCachePage *) (header + 1);
+  glyphs = (const TextGlyph *) (pages + header->npages);
+  for (i = 0; i < header->nglyphs; ++i)
+    if (glyphs[i].page >= header->npages)
+      {
+        g_mapped_file_unref (mapped);
+        return 0;
+      }
+
+  // The batched quads use the old atlas contents
+  text_batch_flush (text);
+  text_atlas_reset (text);
+  for (i = 0; i < header->nglyphs; ++i)
+    {
+      glyph = (TextGlyph *) g_slice_alloc (sizeof (TextGlyph));
+      memcpy (glyph, glyphs + i, sizeof (TextGlyph));
+      g_hash_table_insert (text->glyphs, &glyph->key, glyph);
+    }
+
+  // Uploading the page pixels directly from the mapping, it is kept to copy
+  // a page when a glyph is added
+  pixels = (const GLubyte *) (glyphs + header->nglyphs);
+  for (i = 0; i < header->npages; ++i, pixels += TEXT_PAGE_BYTES)
+    {
+      page = text_page_new (text, pixels);
+      page->pen_x = pages[i].pen_x;
+      page->pen_y = pages[i].pen_y;
+      page->row_height = pages[i].row_height;
+    }
+  text->cache = mapped;
+  text_atlas_upload (text);
+  if (header->line_height)
+    {
+      g_mutex_lock (&text->mutex);
+      text->ascender = header->ascender;
+      text->descender = header->descender;
+      text->line_height = header->line_height;
+      g_mutex_unlock (&text->mutex);
+    }
+  return 1;
+}
+
+/**
+ * Function to write the glyph atlas in a cache file.
+ */
+static void
+text_cache_write (Text * text,  ///< Text struct data.
+                  const char *file)     ///< Cache file name.
+{
+  GHashTableIter iter;
+  TextCacheHeader *header;
+  TextCachePage *pages;
+  TextGlyph *glyphs;
+  GLubyte *pixels;
+  char *buffer, *dir;
+  gpointer glyph;
+  gsize size;
+  unsigned int i;
+
+  size = sizeof (TextCacheHeader)
+    + text->npages * (sizeof (TextCachePage) + TEXT_PAGE_BYTES)
+    + g_hash_table_size (text->glyphs) * sizeof (TextGlyph);
+  buffer = (char *) g_malloc0 (size);
+  header = (TextCacheHeader *) buffer;
+  memcpy (header->magic, text_cache_magic, sizeof (header->magic));
+  header->version = TEXT_CACHE_VERSION;
+  header->mode = text->mode;
+  header->pixel_size = text->pixel_size;
+  header->atlas_size = TEXT_ATLAS_SIZE;
+  header->nglyphs = g_hash_table_size (text->glyphs);
+  header->npages = text->npages;
+  header->ascender = text->ascender;
+  header->descender = text->descender;
+  header->line_height = text->line_height;
+  header->padding = 0;
+  header->font_mtime = text->font_mtime;
+  pages = (TextCachePage *) (header + 1);
+  for (i = 0; i < text->npages; ++i)
+    {
+      pages[i].pen_x = text->pages[i].pen_x;
+      pages[i].pen_y = text->pages[i].pen_y;
+      pages[i].row_height = text->pages[i].row_height;
+      pages[i].padding = 0;
+    }
+  glyphs = (TextGlyph *) (pages + text->npages);
+  g_hash_table_iter_init (&iter, text->glyphs);
+  for (i = 0; g_hash_table_iter_next (&iter, NULL, &glyph); ++i)
+    memcpy (glyphs + i, glyph, sizeof (TextGlyph));
+  pixels = (GLubyte *) (glyphs + i);
+  for (i = 0; i < text->npages; ++i, pixels += TEXT_PAGE_BYTES)
+    memcpy (pixels, text->pages[i].pixels ? text->pages[i].pixels
+            : text->pages[i].mapped, TEXT_PAGE_BYTES);
+  dir = g_path_get_dirname (file);
+  g_mkdir_with_parents (dir, 0755);
+  if (!g_file_set_contents (file, buffer, size, NULL))
+    printf ("ERROR! Text: unable to write the cache %s\n", file);
+  g_free (dir);
+  g_free (buffer);
+}
+
+/**
+ * Function to load the glyphs of a character set. The glyph atlas is read
+ *   from a cache file, keyed by the font file, its modification time, the
+ *   pixel size, the glyph mode and the character set. If the cache file is not
+ *   valid, the glyphs are rasterized and the cache file is written.
+ *
+ * \return 1 if the glyphs were read from the cache, 0 otherwise.
+ */
+int
+text_cache_load (Text * text,   ///< Text struct data.
+                 const char *charset)   ///< UTF-8 string with the characters.
+{
+  const char *c;
+  char *file;
+  int hit;
+
+#if DEBUG
+  printf ("text_cache_load: start\n");
+  fflush (stdout);
+#endif
+
+  file = text_cache_name (text, charset);
+  hit = text_cache_read (text, file);
+  if (!hit)
+    {
+      for (c = charset; *c; c = g_utf8_next_char (c))
+        text_glyph (text, g_utf8_get_char (c));
+      text_cache_write (text, file);
+    }
+  g_free (file);
+
+#if DEBUG
+  printf ("text_cache_load: end\n");
+  fflush (stdout);
+#endif
+  return hit;
+}
+
+/**
+ * Function to rasterize glyphs on a thread with its own FreeType face. The
+ *   thread takes one of every nthreads characters of the ranges.
+ */
+static void
+text_prewarm_thread (gpointer data,     ///< TextPrewarm struct data.
+                     gpointer user_data G_GNUC_UNUSED)  ///< unused.
+{
+  TextPrewarm *prewarm;
+  Text *text;
+  FT_Library ft;
+  FT_Face face;
+  guint64 key;
+  gunichar c;
+  FT_UInt index;
+  unsigned int i;
+  int found, full;
+
+  prewarm = (TextPrewarm *) data;
+  text = prewarm->text;
+  ft = NULL;
+  face = NULL;
+  if (!text_face_open (text, &ft, &face))
+    goto end;
+  for (i = full = 0; i < prewarm->nranges && !full; ++i)
+    for (c = prewarm->ranges[2 * i] + prewarm->thread;
+         c <= prewarm->ranges[2 * i + 1] && !full; c += prewarm->nthreads)
+      {
+        key = text_glyph_key (text, c);
+        g_mutex_lock (&text->mutex);
+        found = !!g_hash_table_lookup (text->glyphs, &key);
+        g_mutex_unlock (&text->mutex);
+
+        // Characters without glyph in the font are not rasterized
+        index = FT_Get_Char_Index (face, c);
+        if (found || !index || !text_rasterize (text, face, index))
+          continue;
+        g_mutex_lock (&text->mutex);
+        if (!g_hash_table_lookup (text->glyphs, &key))
+          {
+            if (text_atlas_insert (text, key, face->glyph))
+              ++prewarm->nglyphs;
+            else
+              full = 1;
+          }
+        g_mutex_unlock (&text->mutex);
+      }
+
+end:
+  if (face)
+    FT_Done_Face (face);
+  if (ft)
+    FT_Done_Library (ft);
+}
+
+/**
+ * Function to rasterize the glyphs of character ranges in parallel. Each
+ *   thread of a pool uses its own FreeType face and writes in the CPU copy of
+ *   the atlas pages, the GL thread uploads the pages at the end. The function
+ *   has to be called on the GL thread and returns when all the glyphs are
+ *   ready. Rasterizing stops when the atlas budget is full, no page is evicted.
+ *
+ * \return number of rasterized glyphs.
+ */
+unsigned int
+text_prewarm (Text * text,      ///< Text struct data.
+              const gunichar * ranges,
+              ///< Array of character ranges (first, last).
+              unsigned int nranges)     ///< Number of character ranges.
+{
+  TextPrewarm *prewarm;
+  GThreadPool *pool;
+  unsigned int i, nthreads, nglyphs;
+
+#if DEBUG
+  printf ("text_prewarm: start\n");
+  fflush (stdout);
+#endif
+
+  nthreads = g_get_num_processors ();
+  prewarm = (TextPrewarm *) g_slice_alloc (nthreads * sizeof (TextPrewarm));
+  for (i = 0; i < nthreads; ++i)
+    {
+      prewarm[i].text = text;
+      prewarm[i].ranges = ranges;
+      prewarm[i].nranges = nranges;
+      prewarm[i].thread = i;
+      prewarm[i].nthreads = nthreads;
+      prewarm[i].nglyphs = 0;
+    }
+  pool = g_thread_pool_new (text_prewarm_thread, NULL, nthreads, TRUE, NULL);
+  for (i = 0; i < nthreads; ++i)
+    if (!pool || !g_thread_pool_push (pool, prewarm + i, NULL))
+      text_prewarm_thread (prewarm + i, NULL);
+  if (pool)
+    g_thread_pool_free (pool, FALSE, TRUE);
+  text_atlas_upload (text);
+  for (i = nglyphs = 0; i < nthreads; ++i)
+    nglyphs += prewarm[i].nglyphs;
+  g_slice_free1 (nthreads * sizeof (TextPrewarm), prewarm);
+
+#if DEBUG
+  printf ("text_prewarm: end\n");
+  fflush (stdout);
+#endif
+  return nglyphs;
+}
+
+/**
+ * Function to measure a string without drawing it. The lines are separated by
+ *   '\n' characters. The coordinates are relative to the initial pen
+ *   position, with y upwards as in text_draw. It uses the cached glyph
+ *   metrics and no GL function, so it can be called from any thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+text_measure (Text * text,      ///< Text struct data.
+              const char *string,       ///< String.
+              float sx,         ///< x scale factor.
+              float sy,         ///< y scale factor.
+              TextExtents * extents)    ///< TextExtents struct data.
+{
+  TextMetrics *metrics;
+  float x, y, x1, y1;
+  gunichar c;
+  int ink;
+
+  sx *= text->scale;
+  sy *= text->scale;
+  x = y = 0.f;
+  ink = 0;
+  extents->x1 = extents->y1 = extents->x2 = extents->y2 = 0.f;
+  extents->nlines = 1;
+  g_mutex_lock (&text->mutex);
+  if (!text->line_height && !text_measure_face (text))
+    {
+      g_mutex_unlock (&text->mutex);
+      return 0;
+    }
+  for (; *string; string = g_utf8_next_char (string))
+    {
+      c = g_utf8_get_char (string);
+      if (c == '\n')
+        {
+          x = 0.f;
+          y -= text->line_height * sy;
+          ++extents->nlines;
+          continue;
+        }
+      metrics = text_metrics (text, c);
+      if (!metrics)
+        continue;
+      if (metrics->width && metrics->rows)
+        {
+          x1 = x + metrics->left * sx;
+          y1 = y + metrics->top * sy;
+          if (!ink)
+            {
+              extents->x1 = extents->x2 = x1;
+              extents->y1 = extents->y2 = y1;
+              ink = 1;
+            }
+          extents->x1 = MIN (extents->x1, x1);
+          extents->x2 = MAX (extents->x2, x1 + metrics->width * sx);
+          extents->y2 = MAX (extents->y2, y1);
+          extents->y1 = MIN (extents->y1, y1 - metrics->rows * sy);
+        }
+      x += metrics->advance_x * sx;
+      y += metrics->advance_y * sy;
+    }
+  extents->advance_x = x;
+  extents->advance_y = y;
+  extents->ascender = text->ascender * sy;
+  extents->descender = text->descender * sy;
+  extents->line_height = text->line_height * sy;
+  g_mutex_unlock (&text->mutex);
+  return 1;
+}
+
+/**
+ * Function to start a batch of strings drawn with a draw call per atlas page.
+ */
+void
+text_batch_begin (Text * text)  ///< Text struct data.
+{
+  unsigned int i;
+  for (i = 0; i < text->npages; ++i)
+    text->pages[i].nglyphs = 0;
+}
+
+/**
+ * Function to add a string to the batch.
+ */
+void
+text_batch_add (Text * text,    ///< Text struct data.
+                char *string,   ///< String.
+                float x,        ///< x initial coordinate.
+                float y,        ///< y initial coordinate.
+                float sx,       ///< x scale factor.
+                float sy,       ///< y scale factor.
+                const GLfloat * color)  ///< array of RBGA colors.
+{
+  GLubyte c[4];
+  TextGlyph *glyph;
+  TextPage *page;
+  float x0;
+
+  text_color (c, color);
+  sx *= text->scale;
+  sy *= text->scale;
+  x0 = x;
+  for (; *string; string = g_utf8_next_char (string))
+    {
+      if (*string == '\n')
+        {
+          if (!text->line_height)
+            text_face (text);
+          x = x0;
+          y -= text->line_height * sy;
+          continue;
+        }
+      glyph = text_glyph (text, g_utf8_get_char (string));
+      if (!glyph)
+        continue;
+      if (glyph->width && glyph->rows)
+        {
+          page = text->pages + glyph->page;
+          if (page->nglyphs == TEXT_BATCH_GLYPHS)
+            text_batch_flush (text);
+          text_quad (page->instances + page->nglyphs, glyph, x, y, sx, sy, c);
+          ++page->nglyphs;
+        }
+      x += glyph->advance_x * sx;
+      y += glyph->advance_y * sy;
+    }
+}
+
+/**
+ * Function to draw all the strings added to the batch.
+ */
+void
+text_batch_end (Text * text)    ///< Text struct data.
+{
+  text_batch_flush (text);
+}
+
 /**
  * Function to draw a string.
  */
@@ -165,75 +1575,199 @@ text_draw (Text * text,         ///< Text struct data.
            float sy,            ///< y scale factor.
            const GLfloat * color)       ///< array of RBGA colors.
 {
-  float box[16];
-  FT_Face face;
-  float x2, y2, w, h;
-  FT_UInt glyph;
-  GLuint id;
-  gunichar c;
-
 #if DEBUG
   printf ("text_draw: start\n");
   fflush (stdout);
 #endif
 
-  box[2] = 0.f;
-  box[3] = 0.f;
-  box[6] = 1.f;
-  box[7] = 0.f;
-  box[10] = 0.f;
-  box[11] = 1.f;
-  box[14] = 1.f;
-  box[15] = 1.f;
-
-  glUseProgram (text->program);
-  glGenTextures (1, &id);
-  glBindTexture (GL_TEXTURE_2D, id);
-  glUniform1i (text->uniform_text, 0);
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
-  glUniform4fv (text->uniform_color, 1, color);
-  glEnableVertexAttribArray (text->attribute_position);
-  glBindBuffer (GL_ARRAY_BUFFER, text->vbo);
-  glVertexAttribPointer (text->attribute_position, 4, GL_FLOAT, GL_FALSE, 0, 0);
-  face = text->face;
-  for (; *string; ++string)
-    {
-      c = g_utf8_get_char (string);
-      glyph = FT_Get_Char_Index (face, c);
-      if (FT_Load_Glyph (face, glyph, FT_LOAD_RENDER))
-        continue;
-      glTexImage2D (GL_TEXTURE_2D,
-                    0,
-                    GL_ALPHA,
-                    face->glyph->bitmap.width,
-                    face->glyph->bitmap.rows,
-                    0, GL_ALPHA, GL_UNSIGNED_BYTE, face->glyph->bitmap.buffer);
-      x2 = x + face->glyph->bitmap_left * sx;
-      y2 = -y - face->glyph->bitmap_top * sy;
-      w = face->glyph->bitmap.width * sx;
-      h = face->glyph->bitmap.rows * sy;
-      box[0] = x2;
-      box[1] = -y2;
-      box[4] = x2 + w;
-      box[5] = -y2;
-      box[8] = x2;
-      box[9] = -y2 - h;
-      box[12] = x2 + w;
-      box[13] = -y2 - h;
-      glBufferData (GL_ARRAY_BUFFER, sizeof (box), box, GL_DYNAMIC_DRAW);
-      glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
-      x += (face->glyph->advance.x >> 6) * sx;
-      y += (face->glyph->advance.y >> 6) * sy;
-    }
-  glDisableVertexAttribArray (text->attribute_position);
-  glDeleteTextures (1, &id);
+  text_batch_begin (text);
+  text_batch_add (text, string, x, y, sx, sy, color);
+  text_batch_end (text);
 
 #if DEBUG
   printf ("text_draw: end\n");
   fflush (stdout);
 #endif
 }
+
+/**
+ * Function to lay out the glyph quads of a retained string and to store them
+ *   in its vertex buffer object sorted by atlas page.
+ */
+static void
+text_object_layout (Text * text,        ///< Text struct data.
+                    TextObject * object)        ///< TextObject struct data.
+{
+  GLubyte c[4];
+  unsigned int count[TEXT_MAX_PAGES];
+  TextInstance *instances, *sorted;
+  TextRun *run;
+  unsigned int *pages;
+  TextGlyph *glyph;
+  char *string;
+  float x, y, sx, sy;
+  unsigned int i, n, length, pass;
+
+  text_color (c, object->color);
+  sx = object->sx * text->scale;
+  sy = object->sy * text->scale;
+  length = g_utf8_strlen (object->string, -1);
+  instances = (TextInstance *) g_slice_alloc (2 * length
+                                              * sizeof (TextInstance));
+  sorted = instances + length;
+  pages = (unsigned int *) g_slice_alloc (length * sizeof (unsigned int));
+
+  // A second pass is needed if a page was cleared while laying out
+  pass = 0;
+  do
+    {
+      object->generation = text->generation;
+      x = object->x;
+      y = object->y;
+      for (n = 0, string = object->string; *string;
+           string = g_utf8_next_char (string))
+        {
+          if (*string == '\n')
+            {
+              if (!text->line_height)
+                text_face (text);
+              x = object->x;
+              y -= text->line_height * sy;
+              continue;
+            }
+          glyph = text_glyph (text, g_utf8_get_char (string));
+          if (!glyph)
+            continue;
+          if (glyph->width && glyph->rows)
+            {
+              pages[n] = glyph->page;
+              text_quad (instances + n++, glyph, x, y, sx, sy, c);
+            }
+          x += glyph->advance_x * sx;
+          y += glyph->advance_y * sy;
+        }
+    }
+  while (object->generation != text->generation && ++pass < 2);
+
+  // Sorting the quads by page (counting sort) to draw a run per page
+  memset (count, 0, sizeof (count));
+  for (i = 0; i < n; ++i)
+    ++count[pages[i]];
+  g_slice_free1 (object->nruns * sizeof (TextRun), object->runs);
+  for (i = object->nruns = 0; i < text->npages; ++i)
+    if (count[i])
+      ++object->nruns;
+  object->runs = (TextRun *) g_slice_alloc (object->nruns * sizeof (TextRun));
+  for (i = n = 0, object->nruns = 0; i < text->npages; ++i)
+    if (count[i])
+      {
+        object->runs[object->nruns].page = i;
+        object->runs[object->nruns].first = n;
+        object->runs[object->nruns].nglyphs = 0;
+        n += count[i];
+        count[i] = object->nruns++;
+      }
+  for (i = 0; i < n; ++i)
+    {
+      run = object->runs + count[pages[i]];
+      sorted[run->first + run->nglyphs++] = instances[i];
+    }
+
+  text_upload (text, object->vbo, sorted, n, GL_STATIC_DRAW);
+  g_slice_free1 (length * sizeof (unsigned int), pages);
+  g_slice_free1 (2 * length * sizeof (TextInstance), instances);
+}
+
+/**
+ * Function to create a retained string.
+ *
+ * \return pointer to the TextObject struct data.
+ */
+TextObject *
+text_object_new (Text * text,   ///< Text struct data.
+                 char *string,  ///< String.
+                 float x,       ///< x initial coordinate.
+                 float y,       ///< y initial coordinate.
+                 float sx,      ///< x scale factor.
+                 float sy,      ///< y scale factor.
+                 const GLfloat * color) ///< array of RBGA colors.
+{
+  TextObject *object;
+  object = (TextObject *) g_slice_alloc (sizeof (TextObject));
+  object->string = g_strdup (string);
+  memcpy (object->color, color, 4 * sizeof (GLfloat));
+  object->x = x;
+  object->y = y;
+  object->sx = sx;
+  object->sy = sy;
+  object->runs = NULL;
+  object->nruns = 0;
+  glGenBuffers (1, &object->vbo);
+  text_object_layout (text, object);
+  return object;
+}
+
+/**
+ * Function to update a retained string. The glyph quads are only laid out
+ *   again if something changed.
+ */
+void
+text_object_update (Text * text,        ///< Text struct data.
+                    TextObject * object,        ///< TextObject struct data.
+                    char *string,       ///< String.
+                    float x,    ///< x initial coordinate.
+                    float y,    ///< y initial coordinate.
+                    float sx,   ///< x scale factor.
+                    float sy,   ///< y scale factor.
+                    const GLfloat * color)      ///< array of RBGA colors.
+{
+  if (!strcmp (object->string, string) && object->x == x && object->y == y
+      && object->sx == sx && object->sy == sy
+      && !memcmp (object->color, color, 4 * sizeof (GLfloat)))
+    return;
+  if (strcmp (object->string, string))
+    {
+      g_free (object->string);
+      object->string = g_strdup (string);
+    }
+  memcpy (object->color, color, 4 * sizeof (GLfloat));
+  object->x = x;
+  object->y = y;
+  object->sx = sx;
+  object->sy = sy;
+  text_object_layout (text, object);
+}
+
+/**
+ * Function to draw a retained string.
+ */
+void
+text_object_draw (Text * text,  ///< Text struct data.
+                  TextObject * object)  ///< TextObject struct data.
+{
+  TextRun *run;
+  unsigned int i;
+
+  // The quads point to old atlas places if a page was cleared
+  if (object->generation != text->generation)
+    text_object_layout (text, object);
+  for (i = 0; i < object->nruns; ++i)
+    {
+      run = object->runs + i;
+      text->pages[run->page].last_used = ++text->clock;
+      text_draw_quads (text, object->vbo, text->pages[run->page].texture,
+                       run->first, run->nglyphs);
+    }
+}
+
+/**
+ * Function to free the memory used by a retained string.
+ */
+void
+text_object_destroy (TextObject * object)       ///< TextObject struct data.
+{
+  state_delete_buffers (1, &object->vbo);
+  g_slice_free1 (object->nruns * sizeof (TextRun), object->runs);
+  g_free (object->string);
+  g_slice_free1 (sizeof (TextObject), object);
+}
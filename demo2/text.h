@@ -1,20 +1,231 @@
 #ifndef TEXT__H
 #define TEXT__H 1
 
+#define TEXT_ATLAS_SIZE 512     ///< Side in pixels of the glyph atlas texture.
+#define TEXT_PIXEL_SIZE 12      ///< Pixel size to rasterize the glyphs.
+#define TEXT_SDF_PIXEL_SIZE 32  ///< Pixel size to rasterize the SDF glyphs.
+#define TEXT_SDF_SPREAD 6       ///< Distance in pixels coded in SDF glyphs.
+#define TEXT_BATCH_GLYPHS 4096  ///< Maximum number of glyphs in a draw call.
+#define TEXT_MAX_PAGES 64       ///< Maximum number of glyph atlas pages.
+#define TEXT_PAGE_BYTES (TEXT_ATLAS_SIZE * TEXT_ATLAS_SIZE)
+///< Bytes of a glyph atlas page.
+#define TEXT_BUDGET (4 * TEXT_PAGE_BYTES)
+///< Default texture memory budget of the glyph atlas in bytes.
+#define TEXT_CACHE_VERSION 4    ///< Version of the glyph atlas cache files.
+
+/**
+ * \enum TextMode
+ * \brief Modes to rasterize the glyphs.
+ */
+enum TextMode
+{
+  TEXT_MODE_BITMAP = 0,         ///< Anti-aliased coverage bitmaps.
+  TEXT_MODE_SDF = 1,            ///< Signed distance fields.
+};
+
+/**
+ * \struct TextGlyph
+ * \brief A struct to define a glyph rasterized in the atlas.
+ */
+typedef struct
+{
+  guint64 key;                  ///< Hash key (mode, pixel size and character).
+  GLfloat s0;                   ///< Left texture coordinate in the atlas.
+  GLfloat t0;                   ///< Top texture coordinate in the atlas.
+  GLfloat s1;                   ///< Right texture coordinate in the atlas.
+  GLfloat t1;                   ///< Bottom texture coordinate in the atlas.
+  int left;                     ///< Left bearing in pixels.
+  int top;                      ///< Top bearing in pixels.
+  int advance_x;                ///< x advance in pixels.
+  int advance_y;                ///< y advance in pixels.
+  unsigned int width;           ///< Bitmap width in pixels.
+  unsigned int rows;            ///< Bitmap rows in pixels.
+  unsigned int page;            ///< Atlas page.
+} TextGlyph;
+
+/**
+ * \struct TextVertex
+ * \brief A struct to define a vertex of a glyph quad.
+ */
+typedef struct
+{
+  GLfloat position[4];          ///< Position (x, y) and texture (s, t).
+  GLubyte color[4];             ///< RGBA color.
+} TextVertex;
+
+/**
+ * \struct TextInstance
+ * \brief A struct to define a glyph quad drawn as an instance.
+ */
+typedef struct
+{
+  GLfloat rect[4];              ///< Quad corners (x1, y1, x2, y2).
+  GLfloat texture[4];           ///< Texture corners (s0, t0, s1, t1).
+  GLubyte color[4];             ///< RGBA color.
+} TextInstance;
+
+/**
+ * \struct TextPage
+ * \brief A struct to define a glyph atlas page.
+ */
+typedef struct
+{
+  GLubyte *pixels;              ///< Copy of the page pixels, NULL until a
+  ///< glyph is written in a page read from the cache file.
+  const GLubyte *mapped;        ///< Page pixels in the mapped cache file, NULL
+  ///< for none.
+  TextInstance *instances;      ///< Batched glyph quads using the page.
+  guint64 last_used;            ///< Clock of the last use of a glyph.
+  GLuint texture;               ///< Page texture, 0 until it is uploaded.
+  unsigned int pen_x;           ///< x coordinate of the next free place.
+  unsigned int pen_y;           ///< y coordinate of the current row.
+  unsigned int row_height;      ///< Height of the current row.
+  unsigned int dirty_y0;        ///< First row not uploaded.
+  unsigned int dirty_y1;        ///< Last+1 row not uploaded.
+  unsigned int nglyphs;         ///< Number of batched glyph quads.
+} TextPage;
+
+/**
+ * \struct TextStats
+ * \brief A struct to define the glyph atlas usage counters.
+ */
+typedef struct
+{
+  guint64 hits;                 ///< Glyphs found in the atlas.
+  guint64 misses;               ///< Glyphs rasterized on the GL thread.
+  guint64 evictions;            ///< Pages cleared to make room.
+  gsize bytes_resident;         ///< Bytes of the page textures.
+  unsigned int pages;           ///< Number of pages.
+  unsigned int glyphs;          ///< Number of glyphs in the atlas.
+} TextStats;
+
+/**
+ * \struct TextMetrics
+ * \brief A struct to define the metrics of a glyph to measure text.
+ */
+typedef struct
+{
+  guint64 key;                  ///< Hash key (mode, pixel size and character).
+  int left;                     ///< Left bearing in pixels.
+  int top;                      ///< Top bearing in pixels.
+  int advance_x;                ///< x advance in pixels.
+  int advance_y;                ///< y advance in pixels.
+  unsigned int width;           ///< Ink box width in pixels.
+  unsigned int rows;            ///< Ink box height in pixels.
+} TextMetrics;
+
+/**
+ * \struct TextExtents
+ * \brief A struct to define the extents of a measured string.
+ */
+typedef struct
+{
+  float advance_x;              ///< x advance of the pen at the end.
+  float advance_y;              ///< y advance of the pen at the end.
+  float x1;                     ///< Left of the ink bounding box.
+  float y1;                     ///< Bottom of the ink bounding box.
+  float x2;                     ///< Right of the ink bounding box.
+  float y2;                     ///< Top of the ink bounding box.
+  float ascender;               ///< Height over the baseline of a line.
+  float descender;              ///< Depth under the baseline of a line.
+  float line_height;            ///< Distance between baselines.
+  unsigned int nlines;          ///< Number of lines.
+} TextExtents;
+
 typedef struct
 {
   FT_Library ft;                ///< FreeType data.
-  FT_Face face;                 ///< FreeType face to draw text.
+  FT_Face face;                 ///< FreeType face to draw text, NULL until a
+  ///< glyph has to be rasterized.
+  FT_Library measure_ft;        ///< FreeType data to measure text.
+  FT_Face measure_face;         ///< FreeType face to measure text, NULL until
+  ///< a glyph has to be measured.
+  GHashTable *glyphs;           ///< Glyphs rasterized in the atlas.
+  GHashTable *metrics;          ///< Metrics of the measured glyphs.
+  GMappedFile *cache;           ///< Mapped cache file of the atlas pages, NULL
+  ///< for none.
+  TextPage pages[TEXT_MAX_PAGES];       ///< Glyph atlas pages.
+  TextStats stats;              ///< Glyph atlas usage counters.
+  GMutex mutex;                 ///< Lock of the atlas for the threads.
   GLint attribute_position;     ///< Text variable position.
+  GLint attribute_corner;       ///< Text variable quad corner.
+  GLint attribute_rect;         ///< Text variable instance quad corners.
+  GLint attribute_texture;      ///< Text variable instance texture corners.
+  GLint attribute_color;        ///< Text variable color.
   GLint uniform_text;           ///< Text constant.
-  GLint uniform_color;          ///< Color constant.
-  GLuint vbo;                   ///< Text vertex buffer object.
-  GLuint program;               ///< Text program
+  Ring ring;                    ///< Ring buffer streaming the glyph quads.
+  GLuint ibo;                   ///< Glyph quads indices buffer object.
+  GLuint vbo_corner;            ///< Quad corners vertex buffer object.
+  ShaderProgram *program;       ///< Shared text program.
+  GLenum format;                ///< Glyph atlas texture format.
+  guint64 clock;                ///< Counter of glyph uses.
+  gint64 font_mtime;            ///< Modification time of the font file.
+  float scale;                  ///< Quads scale factor for the pixel size.
+  unsigned int mode;            ///< Mode to rasterize the glyphs.
+  unsigned int instanced;       ///< 1 to draw the glyphs as instances.
+  unsigned int pixel_size;      ///< Pixel size of the face.
+  int ascender;                 ///< Height over the baseline in pixels.
+  int descender;                ///< Depth under the baseline in pixels.
+  int line_height;              ///< Distance between baselines in pixels, 0
+  ///< until read from the cache file or from an opened face.
+  unsigned int npages;          ///< Number of glyph atlas pages.
+  unsigned int max_pages;       ///< Maximum number of pages in the budget.
+  unsigned int generation;      ///< Number of times atlas pages were cleared.
 } Text;                         ///< Struct to define data to draw text.
 
+/**
+ * \struct TextRun
+ * \brief A struct to define a run of glyph quads using the same atlas page.
+ */
+typedef struct
+{
+  unsigned int page;            ///< Atlas page.
+  unsigned int first;           ///< First glyph quad.
+  unsigned int nglyphs;         ///< Number of glyph quads.
+} TextRun;
+
+/**
+ * \struct TextObject
+ * \brief A struct to define a retained string with its glyph quads stored in
+ *   a GPU buffer.
+ */
+typedef struct
+{
+  char *string;                 ///< String.
+  GLfloat color[4];             ///< RGBA color.
+  float x;                      ///< x initial coordinate.
+  float y;                      ///< y initial coordinate.
+  float sx;                     ///< x scale factor.
+  float sy;                     ///< y scale factor.
+  TextRun *runs;                ///< Runs of glyph quads sorted by page.
+  GLuint vbo;                   ///< Glyph quads vertex buffer object.
+  unsigned int nruns;           ///< Number of runs.
+  unsigned int generation;      ///< Atlas generation of the glyph quads.
+} TextObject;
+
+ShaderProgram *text_program_submit (unsigned int mode);
+int text_init_mode (Text * text, unsigned int mode);
 int text_init (Text * text);
+int text_cache_load (Text * text, const char *charset);
+unsigned int text_prewarm (Text * text, const gunichar * ranges,
+                           unsigned int nranges);
+void text_set_budget (Text * text, gsize bytes);
+void text_stats (Text * text, TextStats * stats);
 void text_destroy (Text * text);
+int text_measure (Text * text, const char *string, float sx, float sy,
+                  TextExtents * extents);
+void text_batch_begin (Text * text);
+void text_batch_add (Text * text, char *string, float x, float y, float sx,
+                     float sy, const GLfloat * color);
+void text_batch_end (Text * text);
 void text_draw (Text * text, char *string, float x, float y, float sx, float sy,
                 const GLfloat * color);
+TextObject *text_object_new (Text * text, char *string, float x, float y,
+                             float sx, float sy, const GLfloat * color);
+void text_object_update (Text * text, TextObject * object, char *string,
+                         float x, float y, float sx, float sy,
+                         const GLfloat * color);
+void text_object_draw (Text * text, TextObject * object);
+void text_object_destroy (TextObject * object);
 
 #endif
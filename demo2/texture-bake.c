@@ -0,0 +1,185 @@
+/**
+ * \file texture-bake.c
+ * \brief Source file to bake images into KTX2 compressed textures.
+ * \author Javier Burguete Tolosa.
+ * \date 2022-2025.
+ * \license BSD-2-Clause.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <epoxy/gl.h>
+
+#include "ktx.h"
+#include "shader.h"
+#include "image.h"
+
+#define BAKE_ROWS 8             ///< Number of block rows encoded by a task.
+
+/**
+ * \struct BakeTask
+ * \brief A struct to define rows of blocks encoded on a worker thread.
+ */
+typedef struct
+{
+  const GLubyte *pixels;        ///< Level pixels in the OpenGL order.
+  guint8 *blocks;               ///< Level blocks.
+  GLenum format;                ///< GL compressed internal format.
+  unsigned int width;           ///< Level width.
+  unsigned int height;          ///< Level height.
+  unsigned int row0;            ///< First block row.
+  unsigned int row1;            ///< Last block row plus one.
+} BakeTask;
+
+/**
+ * Function to encode the rows of blocks of a task on a worker thread.
+ */
+static void
+bake_encode (gpointer data,     ///< BakeTask struct data.
+             gpointer user_data G_GNUC_UNUSED)  ///< unused.
+{
+  BakeTask *task;
+  task = (BakeTask *) data;
+  ktx_encode (task->format, task->pixels, task->width, task->height,
+              task->row0, task->row1, task->blocks);
+}
+
+/**
+ * Main function to bake an image in a KTX2 compressed texture. The blocks are
+ *   encoded by bands of rows on a pool of worker threads.
+ *
+ * \return 0 on success, error code on error.
+ */
+int
+main (int argn,                 ///< number of command-line arguments.
+      char **argc)              ///< array of command-line arguments.
+{
+  GLubyte *pixels[KTX_LEVELS];
+  guint8 *blocks[KTX_LEVELS];
+  gsize sizes[KTX_LEVELS];
+  Image *image;
+  BakeTask *tasks;
+  GThreadPool *pool;
+  const char *error_message;
+  GLenum format;
+  unsigned int i, j, n, ntasks, nlevels, width, height;
+  int mipmaps, ok;
+
+  mipmaps = argn == 5 && !strcmp (argc[1], "-m");
+  if (argn != 4 + mipmaps)
+    {
+      printf ("The syntax is:\n./texture-bake [-m] format input output\n"
+              "with format bc1, bc1a, bc3, etc2 or etc2a\n"
+              "and -m to bake the mipmap levels\n");
+      return 1;
+    }
+  format = ktx_format_name (argc[1 + mipmaps]);
+  if (!format || format == GL_COMPRESSED_RGBA_BPTC_UNORM)
+    {
+      error_message = "unknown format";
+      goto exit_on_error;
+    }
+  image_set_cache (0);
+  image = image_new (argc[2 + mipmaps]);
+  if (!image || !image->image)
+    {
+      if (image)
+        image_free (image);
+      error_message = "unable to read the input image";
+      goto exit_on_error;
+    }
+
+  // Mipmap levels
+  width = image->width;
+  height = image->height;
+  pixels[0] = image->image;
+  nlevels = 1;
+  ntasks = 0;
+  for (i = 0;; ++i)
+    {
+      sizes[i] = ktx_level_size (format, width, height);
+      blocks[i] = (guint8 *) g_slice_alloc (sizes[i]);
+      ntasks += (((height + 3) / 4) + BAKE_ROWS - 1) / BAKE_ROWS;
+      if (!mipmaps || (width == 1 && height == 1) || i + 1 == KTX_LEVELS)
+        break;
+      pixels[i + 1]
+        = (GLubyte *) g_slice_alloc (4 * (gsize) MAX (1, width / 2)
+                                     * MAX (1, height / 2));
+      image_downsample (pixels[i], width, height, pixels[i + 1]);
+      width = MAX (1, width / 2);
+      height = MAX (1, height / 2);
+      ++nlevels;
+    }
+
+  // Encoding the bands of block rows on the worker threads
+  tasks = (BakeTask *) g_slice_alloc (ntasks * sizeof (BakeTask));
+  pool = g_thread_pool_new (bake_encode, NULL, g_get_num_processors (), TRUE,
+                            NULL);
+  for (i = n = 0; i < nlevels; ++i)
+    {
+      width = MAX (1, image->width >> i);
+      height = MAX (1, image->height >> i);
+      for (j = 0; j < (height + 3) / 4; j += BAKE_ROWS, ++n)
+        {
+          tasks[n].pixels = pixels[i];
+          tasks[n].blocks = blocks[i];
+          tasks[n].format = format;
+          tasks[n].width = width;
+          tasks[n].height = height;
+          tasks[n].row0 = j;
+          tasks[n].row1 = MIN (j + BAKE_ROWS, (height + 3) / 4);
+          if (!pool || !g_thread_pool_push (pool, tasks + n, NULL))
+            bake_encode (tasks + n, NULL);
+        }
+    }
+  if (pool)
+    g_thread_pool_free (pool, FALSE, TRUE);
+  ok = ktx_write (argc[3 + mipmaps], format, image->width, image->height,
+                  nlevels, blocks);
+
+  // Freeing memory
+  g_slice_free1 (ntasks * sizeof (BakeTask), tasks);
+  for (i = 0; i < nlevels; ++i)
+    {
+      g_slice_free1 (sizes[i], blocks[i]);
+      if (i)
+        g_slice_free1 (4 * (gsize) MAX (1, image->width >> i)
+                       * MAX (1, image->height >> i), pixels[i]);
+    }
+  image_free (image);
+  if (!ok)
+    {
+      error_message = "unable to write the output texture";
+      goto exit_on_error;
+    }
+  return 0;
+
+exit_on_error:
+  printf ("ERROR! Texture bake: %s\n", error_message);
+  return 2;
+}
@@ -0,0 +1,83 @@
+/**
+ * \file tiled-cut.c
+ * \brief Source file to cut images in pyramids of tiles.
+ * \author Javier Burguete Tolosa.
+ * \date 2022-2025.
+ * \license BSD-2-Clause.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <epoxy/gl.h>
+
+#include "ring.h"
+#include "ktx.h"
+#include "shader.h"
+#include "image.h"
+#include "tiled.h"
+
+/**
+ * Main function to cut an image in a pyramid of tiles to draw it as a tiled
+ *   image.
+ *
+ * \return 0 on success, error code on error.
+ */
+int
+main (int argn,                 ///< number of command-line arguments.
+      char **argc)              ///< array of command-line arguments.
+{
+  const char *error_message;
+  int tile, option;
+
+  option = argn == 5 && !strcmp (argc[1], "-t");
+  if (argn != 3 + 2 * option)
+    {
+      printf ("The syntax is:\n./tiled-cut [-t tile] input dir\n"
+              "with tile the side in pixels of the tiles (default %u)\n",
+              TILED_TILE);
+      return 1;
+    }
+  tile = option ? atoi (argc[2]) : TILED_TILE;
+  if (tile < 4 || tile > 4096)
+    {
+      error_message = "bad tile side";
+      goto exit_on_error;
+    }
+  image_set_cache (0);
+  if (!tiled_cut (argc[1 + 2 * option], argc[2 + 2 * option], tile))
+    {
+      error_message = "unable to cut the image";
+      goto exit_on_error;
+    }
+  return 0;
+
+exit_on_error:
+  printf ("ERROR! Tiled cutter: %s\n", error_message);
+  return 2;
+}
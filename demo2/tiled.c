@@ -0,0 +1,776 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <epoxy/gl.h>
+
+#include "state.h"
+#include "ktx.h"
+#include "shader.h"
+#include "image.h"
+#include "ring.h"
+#include "tiled.h"
+
+#define TILED_VERTEX (4 * sizeof (GLfloat))
+///< Size in bytes of a tile quad vertex: position (x, y) and texture (s, t).
+#define TILED_BORDER 1
+///< Texels around a tile in its cache slot, so the linear filter at the tile
+///< edges does not sample the neighbouring slots.
+
+/**
+ * Function to get the key of a tile.
+ *
+ * \return tile key.
+ */
+static inline guint64
+tiled_key (unsigned int level,  ///< Pyramid level.
+           unsigned int x,      ///< Tile column.
+           unsigned int y)      ///< Tile row.
+{
+  return ((guint64) level << 48) | ((guint64) y << 24) | x;
+}
+
+/**
+ * Function to get the file name of a tile.
+ *
+ * \return tile file name, it has to be freed with g_free.
+ */
+char *
+tiled_tile_name (const char *dir,       ///< Pyramid directory.
+                 unsigned int level,    ///< Pyramid level.
+                 unsigned int x,        ///< Tile column.
+                 unsigned int y)        ///< Tile row.
+{
+  return g_strdup_printf ("%s" G_DIR_SEPARATOR_S "%u" G_DIR_SEPARATOR_S
+                          "%u-%u.qoi", dir, level, x, y);
+}
+
+/**
+ * Function to get the number of levels of a pyramid. The last level has only
+ *   a tile.
+ *
+ * \return number of levels.
+ */
+unsigned int
+tiled_levels (unsigned int width,       ///< Image width.
+              unsigned int height,      ///< Image height.
+              unsigned int tile)        ///< Side in pixels of the tiles.
+{
+  unsigned int n;
+  for (n = 1; MAX (width, height) > ((guint64) tile << (n - 1)); ++n)
+    ;
+  return n;
+}
+
+/**
+ * Function to make the directory of a pyramid level.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int
+tiled_level_dir (const char *dir,       ///< Pyramid directory.
+                 unsigned int level)    ///< Pyramid level.
+{
+  char *name;
+  int ok;
+  name = g_strdup_printf ("%s" G_DIR_SEPARATOR_S "%u", dir, level);
+  ok = !g_mkdir_with_parents (name, 0755);
+  g_free (name);
+  return ok;
+}
+
+/**
+ * Function to cut an image in a pyramid of tiles. The first level is cut from
+ *   bands of rows read in order and every next level is filtered from the
+ *   tiles of the previous level, so the memory does not grow with the image
+ *   size. It does not use GL, so it can be called from any thread.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int
+tiled_cut (const char *name,    ///< Image file name.
+           const char *dir,     ///< Pyramid directory.
+           unsigned int tile)   ///< Side in pixels of the tiles.
+{
+  ImageStream *stream;
+  GKeyFile *key_file;
+  GLubyte *band, *pixels, *children;
+  char *file;
+  const char *error_message;
+  unsigned int width, height, nlevels, level, lw, lh, x, y, tw, th, cx, cy,
+    ox, oy, cw, ch, rw, rh, r;
+  int ok;
+
+#if DEBUG
+  printf ("tiled_cut: start\n");
+  fflush (stdout);
+#endif
+
+  stream = image_stream_open (name, &width, &height);
+  if (!stream)
+    {
+      error_message = "unable to open the image";
+      goto exit_on_error;
+    }
+  nlevels = tiled_levels (width, height, tile);
+  pixels = (GLubyte *) g_slice_alloc (4 * tile * tile);
+  children = (GLubyte *) g_slice_alloc (16 * tile * tile);
+
+  // First level, cut from bands of rows
+  band = (GLubyte *) g_try_malloc (4 * (gsize) width * tile);
+  ok = band && tiled_level_dir (dir, 0);
+  for (y = 0; ok && y * tile < height; ++y)
+    {
+      th = MIN (tile, height - y * tile);
+      ok = image_stream_read (stream, band, th);
+      for (x = 0; ok && x * tile < width; ++x)
+        {
+          tw = MIN (tile, width - x * tile);
+          for (r = 0; r < th; ++r)
+            memcpy (pixels + 4 * tw * (th - 1 - r),
+                    band + 4 * ((gsize) width * r + x * tile), 4 * tw);
+          file = tiled_tile_name (dir, 0, x, y);
+          ok = image_write (file, tw, th, pixels, TILED_FORMAT);
+          g_free (file);
+        }
+    }
+  g_free (band);
+  image_stream_close (stream);
+
+  // Next levels, filtered from the 2x2 tiles of the previous level
+  for (level = 1; ok && level < nlevels; ++level)
+    {
+      ok = tiled_level_dir (dir, level);
+      lw = MAX (1, width >> (level - 1));
+      lh = MAX (1, height >> (level - 1));
+      for (y = 0; ok && y * tile < MAX (1, height >> level); ++y)
+        for (x = 0; ok && x * tile < MAX (1, width >> level); ++x)
+          {
+            rw = MIN (2 * tile, lw - 2 * x * tile);
+            rh = MIN (2 * tile, lh - 2 * y * tile);
+            for (cy = 0; ok && cy < 2; ++cy)
+              for (cx = 0; ok && cx < 2; ++cx)
+                {
+                  ox = cx * tile;
+                  oy = cy * tile;
+                  if (ox >= rw || oy >= rh)
+                    continue;
+                  cw = MIN (tile, rw - ox);
+                  ch = MIN (tile, rh - oy);
+                  file = tiled_tile_name (dir, level - 1, 2 * x + cx,
+                                          2 * y + cy);
+                  ok = image_decode (file, cw, ch, pixels);
+                  g_free (file);
+                  for (r = 0; ok && r < ch; ++r)
+                    memcpy (children + 4 * ((gsize) rw * (rh - 1 - oy - r)
+                                            + ox),
+                            pixels + 4 * cw * (ch - 1 - r), 4 * cw);
+                }
+            if (!ok)
+              break;
+            image_downsample (children, rw, rh, pixels);
+            file = tiled_tile_name (dir, level, x, y);
+            ok = image_write (file, MAX (1, rw / 2), MAX (1, rh / 2), pixels,
+                              TILED_FORMAT);
+            g_free (file);
+          }
+    }
+  g_slice_free1 (16 * tile * tile, children);
+  g_slice_free1 (4 * tile * tile, pixels);
+
+  // Pyramid description
+  if (ok)
+    {
+      key_file = g_key_file_new ();
+      g_key_file_set_integer (key_file, "tiled", "width", width);
+      g_key_file_set_integer (key_file, "tiled", "height", height);
+      g_key_file_set_integer (key_file, "tiled", "tile", tile);
+      g_key_file_set_integer (key_file, "tiled", "levels", nlevels);
+      file = g_build_filename (dir, "tiled.ini", NULL);
+      ok = g_key_file_save_to_file (key_file, file, NULL);
+      g_free (file);
+      g_key_file_free (key_file);
+    }
+  if (!ok)
+    {
+      error_message = "unable to write the tiles";
+      goto exit_on_error;
+    }
+
+#if DEBUG
+  printf ("tiled_cut: end\n");
+  fflush (stdout);
+#endif
+  return 1;
+
+exit_on_error:
+  printf ("ERROR! Tiled: %s\n", error_message);
+#if DEBUG
+  printf ("tiled_cut: end\n");
+  fflush (stdout);
+#endif
+  return 0;
+}
+
+/**
+ * Function to add a border duplicating the edge texels to the decoded pixels
+ *   of a tile. The rows are moved in place from the last one to their place in
+ *   the bordered tile.
+ */
+static void
+tiled_border (GLubyte * pixels, ///< Decoded pixels, with room for the border.
+              unsigned int width,       ///< Tile width.
+              unsigned int height)      ///< Tile height.
+{
+  GLubyte *row;
+  unsigned int i, j, pitch;
+  pitch = 4 * (width + 2 * TILED_BORDER);
+  for (i = height; i-- > 0;)
+    {
+      row = pixels + pitch * (i + TILED_BORDER);
+      memmove (row + 4 * TILED_BORDER, pixels + 4 * width * i, 4 * width);
+      for (j = 0; j < TILED_BORDER; ++j)
+        {
+          memcpy (row + 4 * j, row + 4 * TILED_BORDER, 4);
+          memcpy (row + 4 * (width + TILED_BORDER + j),
+                  row + 4 * (width + TILED_BORDER - 1), 4);
+        }
+    }
+  for (j = 0; j < TILED_BORDER; ++j)
+    {
+      memcpy (pixels + pitch * j, pixels + pitch * TILED_BORDER, pitch);
+      memcpy (pixels + pitch * (height + TILED_BORDER + j),
+              pixels + pitch * (height + TILED_BORDER - 1), pitch);
+    }
+}
+
+/**
+ * Function to decode a tile on a worker thread.
+ */
+static void
+tiled_decode (gpointer data,    ///< TiledLoad struct data.
+              gpointer user_data G_GNUC_UNUSED) ///< unused.
+{
+  TiledLoad *load;
+  int ok;
+  load = (TiledLoad *) data;
+  ok = image_decode (load->name, load->width, load->height, load->pixels);
+  if (ok)
+    tiled_border (load->pixels, load->width, load->height);
+  g_atomic_int_set (&load->state, ok ? TILED_LOAD_READY : TILED_LOAD_FAILED);
+}
+
+/**
+ * Function to create a tiled image from a pyramid of tiles. It has to be
+ *   called on the GL thread.
+ *
+ * \return pointer to the Tiled struct data on success, NULL on error.
+ */
+Tiled *
+tiled_new (const char *dir)     ///< Pyramid directory.
+{
+  Tiled *tiled;
+  GKeyFile *key_file;
+  char *file;
+  const char *error_message;
+  GLint k;
+  unsigned int i;
+
+#if DEBUG
+  printf ("tiled_new: start\n");
+  fflush (stdout);
+#endif
+
+  // Reading the pyramid description
+  tiled = (Tiled *) g_slice_alloc0 (sizeof (Tiled));
+  key_file = g_key_file_new ();
+  file = g_build_filename (dir, "tiled.ini", NULL);
+  if (g_key_file_load_from_file (key_file, file, G_KEY_FILE_NONE, NULL))
+    {
+      tiled->width = g_key_file_get_integer (key_file, "tiled", "width", NULL);
+      tiled->height
+        = g_key_file_get_integer (key_file, "tiled", "height", NULL);
+      tiled->tile = g_key_file_get_integer (key_file, "tiled", "tile", NULL);
+      tiled->nlevels
+        = g_key_file_get_integer (key_file, "tiled", "levels", NULL);
+    }
+  g_free (file);
+  g_key_file_free (key_file);
+  if (!tiled->width || !tiled->height || !tiled->tile
+      || tiled->nlevels != tiled_levels (tiled->width, tiled->height,
+                                         tiled->tile))
+    {
+      g_slice_free1 (sizeof (Tiled), tiled);
+      tiled = NULL;
+      error_message = "bad pyramid description";
+      goto exit_on_error;
+    }
+  tiled->dir = g_strdup (dir);
+  tiled->pitch = tiled->tile + 2 * TILED_BORDER;
+
+  // Shared texture program
+  tiled->program = image_program ();
+  if (!tiled->program)
+    {
+      error_message = "unable to get the texture program";
+      goto exit_on_error;
+    }
+  tiled->attribute_position
+    = tiled->program->attributes[IMAGE_ATTRIBUTE_POSITION];
+  tiled->attribute_texture
+    = tiled->program->attributes[IMAGE_ATTRIBUTE_TEXTURE];
+  tiled->uniform_texture = tiled->program->uniforms[IMAGE_UNIFORM_TEXTURE];
+  tiled->uniform_matrix = tiled->program->uniforms[IMAGE_UNIFORM_MATRIX];
+
+  // Tile cache texture, not mipmapped, the pyramid levels are the mipmaps.
+  // Every slot keeps its tile with a border
+  glGetIntegerv (GL_MAX_TEXTURE_SIZE, &k);
+  tiled->side = MIN (TILED_SLOTS, k / (GLint) tiled->pitch);
+  if (!tiled->side)
+    {
+      error_message = "tiles larger than the maximum texture size";
+      goto exit_on_error;
+    }
+  tiled->nslots = tiled->side * tiled->side;
+  glGenTextures (1, &tiled->texture);
+  state_bind_texture (tiled->texture);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, tiled->side * tiled->pitch,
+                tiled->side * tiled->pitch, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                NULL);
+
+  // Page table and tile loads
+  tiled->slots
+    = (TiledSlot *) g_slice_alloc0 (tiled->nslots * sizeof (TiledSlot));
+  tiled->table = g_hash_table_new (g_int64_hash, g_int64_equal);
+  if (!ring_init (&tiled->ring, GL_ARRAY_BUFFER,
+                  RING_SEGMENTS * TILED_BATCH_TILES * 6 * TILED_VERTEX))
+    {
+      error_message = "unable to init the tile quads buffer";
+      goto exit_on_error;
+    }
+  for (i = 0; i < TILED_LOADS; ++i)
+    {
+      tiled->loads[i].tiled = tiled;
+      tiled->loads[i].pixels
+        = (GLubyte *) g_slice_alloc (4 * tiled->pitch * tiled->pitch);
+      tiled->loads[i].state = TILED_LOAD_EMPTY;
+    }
+  tiled->pool = g_thread_pool_new (tiled_decode, NULL,
+                                   MIN (TILED_LOADS, g_get_num_processors ()),
+                                   FALSE, NULL);
+  tiled->stats.slots = tiled->nslots;
+  tiled_view (tiled, 0.5 * tiled->width, 0.5 * tiled->height, 1.);
+
+#if DEBUG
+  printf ("tiled_new: end\n");
+  fflush (stdout);
+#endif
+  return tiled;
+
+exit_on_error:
+  printf ("ERROR! Tiled: %s\n", error_message);
+  if (tiled)
+    tiled_destroy (tiled);
+#if DEBUG
+  printf ("tiled_new: end\n");
+  fflush (stdout);
+#endif
+  return NULL;
+}
+
+/**
+ * Function to set the view of a tiled image.
+ */
+void
+tiled_view (Tiled * tiled,      ///< Tiled struct data.
+            double x,           ///< x coordinate in pixels of the view center.
+            double y,           ///< y coordinate in pixels of the view center.
+            double zoom)        ///< Window pixels per image pixel.
+{
+  tiled->x = x;
+  tiled->y = y;
+  tiled->zoom = MAX (zoom, 1e-9);
+}
+
+/**
+ * Function to get the cache slot of a tile in the page table.
+ *
+ * \return pointer to the TiledSlot struct, NULL if the tile is not cached.
+ */
+static inline TiledSlot *
+tiled_lookup (Tiled * tiled,    ///< Tiled struct data.
+              unsigned int level,       ///< Pyramid level.
+              unsigned int x,   ///< Tile column.
+              unsigned int y)   ///< Tile row.
+{
+  guint64 key;
+  key = tiled_key (level, x, y);
+  return (TiledSlot *) g_hash_table_lookup (tiled->table, &key);
+}
+
+/**
+ * Function to queue the load of a tile if it is not loading and a load buffer
+ *   is free.
+ */
+static void
+tiled_request (Tiled * tiled,   ///< Tiled struct data.
+               unsigned int level,      ///< Pyramid level.
+               unsigned int x,  ///< Tile column.
+               unsigned int y)  ///< Tile row.
+{
+  TiledLoad *load, *free_load;
+  guint64 key;
+  unsigned int i;
+
+  key = tiled_key (level, x, y);
+  free_load = NULL;
+  for (i = 0; i < TILED_LOADS; ++i)
+    {
+      load = tiled->loads + i;
+      if (g_atomic_int_get (&load->state) == TILED_LOAD_EMPTY)
+        {
+          if (!free_load)
+            free_load = load;
+        }
+      else if (load->key == key)
+        return;
+    }
+  if (!free_load)
+    return;
+  load = free_load;
+  load->key = key;
+  load->width = MIN (tiled->tile, MAX (1, tiled->width >> level)
+                     - x * tiled->tile);
+  load->height = MIN (tiled->tile, MAX (1, tiled->height >> level)
+                      - y * tiled->tile);
+  g_free (load->name);
+  load->name = tiled_tile_name (tiled->dir, level, x, y);
+  g_atomic_int_set (&load->state, TILED_LOAD_DECODING);
+  ++tiled->loading;
+  if (!tiled->pool || !g_thread_pool_push (tiled->pool, load, NULL))
+    tiled_decode (load, NULL);
+}
+
+/**
+ * Function to get a slot for a new tile. A free slot is used if available,
+ *   else the least recently used tile not drawn in the current frame is
+ *   removed.
+ *
+ * \return pointer to the TiledSlot struct, NULL if all the slots are drawn.
+ */
+static TiledSlot *
+tiled_slot (Tiled * tiled)      ///< Tiled struct data.
+{
+  TiledSlot *slot, *lru;
+  unsigned int i;
+
+  lru = NULL;
+  for (i = 0; i < tiled->nslots; ++i)
+    {
+      slot = tiled->slots + i;
+      if (!slot->used)
+        return slot;
+      if (slot->last_used < tiled->frame
+          && (!lru || slot->last_used < lru->last_used))
+        lru = slot;
+    }
+  if (lru)
+    {
+      g_hash_table_remove (tiled->table, &lru->key);
+      lru->used = 0;
+      ++tiled->stats.evictions;
+    }
+  return lru;
+}
+
+/**
+ * Function to upload the decoded tiles to the tile cache texture.
+ */
+static void
+tiled_upload (Tiled * tiled)    ///< Tiled struct data.
+{
+  TiledLoad *load;
+  TiledSlot *slot;
+  unsigned int i, j, state;
+
+  state_bind_texture (tiled->texture);
+  state_attributes (STATE_ATTRIBUTE (tiled->attribute_position)
+                    | STATE_ATTRIBUTE (tiled->attribute_texture));
+  for (i = 0; i < TILED_LOADS; ++i)
+    {
+      load = tiled->loads + i;
+      state = g_atomic_int_get (&load->state);
+      if (state != TILED_LOAD_READY && state != TILED_LOAD_FAILED)
+        continue;
+
+      // The failed tiles keep a slot so they are not loaded again
+      slot = tiled_slot (tiled);
+      if (slot)
+        {
+          j = slot - tiled->slots;
+          slot->key = load->key;
+          slot->width = load->width;
+          slot->height = load->height;
+          slot->last_used = tiled->frame;
+          slot->used = 1;
+          slot->valid = (state == TILED_LOAD_READY);
+          if (slot->valid)
+            {
+              glTexSubImage2D (GL_TEXTURE_2D, 0,
+                               (j % tiled->side) * tiled->pitch,
+                               (j / tiled->side) * tiled->pitch,
+                               load->width + 2 * TILED_BORDER,
+                               load->height + 2 * TILED_BORDER, GL_RGBA,
+                               GL_UNSIGNED_BYTE, load->pixels);
+              ++tiled->stats.loads;
+            }
+          else
+            printf ("ERROR! Tiled: unable to load %s\n", load->name);
+          g_hash_table_insert (tiled->table, &slot->key, slot);
+        }
+      g_atomic_int_set (&load->state, TILED_LOAD_EMPTY);
+      --tiled->loading;
+    }
+}
+
+/**
+ * Function to write the quad of a visible tile. If the tile is not cached,
+ *   its load is queued and the region is drawn from the nearest cached coarser
+ *   level.
+ *
+ * \return 1 if the quad is written, 0 if no level of the region is cached.
+ */
+static unsigned int
+tiled_quad (Tiled * tiled,      ///< Tiled struct data.
+            unsigned int level, ///< Pyramid level.
+            unsigned int x,     ///< Tile column.
+            unsigned int y,     ///< Tile row.
+            double sx,          ///< x scale from image pixels to window.
+            double sy,          ///< y scale from image pixels to window.
+            GLfloat * vertices) ///< Quad vertices.
+{
+  TiledSlot *slot;
+  double p[2], q[2], u[2], v[2], span, scale, ax, ay, c;
+  unsigned int m, j;
+
+  slot = tiled_lookup (tiled, level, x, y);
+  if (slot)
+    slot->last_used = tiled->frame;
+  if (slot && slot->valid)
+    {
+      m = level;
+      ++tiled->stats.hits;
+    }
+  else
+    {
+      if (!slot)
+        tiled_request (tiled, level, x, y);
+      ++tiled->stats.misses;
+      for (m = level + 1, slot = NULL; m < tiled->nlevels; ++m)
+        {
+          slot = tiled_lookup (tiled, m, x >> (m - level), y >> (m - level));
+          if (slot && slot->valid)
+            break;
+          slot = NULL;
+        }
+      if (!slot)
+        return 0;
+      slot->last_used = tiled->frame;
+    }
+
+  // Tile region in image pixels
+  scale = (double) (1 << level);
+  span = tiled->tile * scale;
+  p[0] = x * span;
+  q[0] = y * span;
+  p[1] = p[0] + scale * MIN (tiled->tile, MAX (1, tiled->width >> level)
+                             - x * tiled->tile);
+  q[1] = q[0] + scale * MIN (tiled->tile, MAX (1, tiled->height >> level)
+                             - y * tiled->tile);
+
+  // Texture coordinates in the slot of the drawn level, inside the border,
+  // the rows are in the OpenGL order
+  scale = (double) (1 << m);
+  j = slot - tiled->slots;
+  ax = (x >> (m - level)) * tiled->tile * scale;
+  ay = (y >> (m - level)) * tiled->tile * scale;
+  c = 1. / (tiled->side * tiled->pitch);
+  for (j = 0; j < 2; ++j)
+    {
+      u[j] = c * ((slot - tiled->slots) % tiled->side * tiled->pitch
+                  + TILED_BORDER + (p[j] - ax) / scale);
+      v[j] = c * ((slot - tiled->slots) / tiled->side * tiled->pitch
+                  + TILED_BORDER + slot->height - (q[j] - ay) / scale);
+      p[j] = (p[j] - tiled->x) * sx;
+      q[j] = (tiled->y - q[j]) * sy;
+    }
+
+  // Two triangles
+  vertices[0] = vertices[20] = p[0];
+  vertices[1] = vertices[21] = q[0];
+  vertices[2] = vertices[22] = u[0];
+  vertices[3] = vertices[23] = v[0];
+  vertices[4] = p[0];
+  vertices[5] = q[1];
+  vertices[6] = u[0];
+  vertices[7] = v[1];
+  vertices[8] = vertices[12] = p[1];
+  vertices[9] = vertices[13] = q[1];
+  vertices[10] = vertices[14] = u[1];
+  vertices[11] = vertices[15] = v[1];
+  vertices[16] = p[1];
+  vertices[17] = q[0];
+  vertices[18] = u[1];
+  vertices[19] = v[0];
+  return 1;
+}
+
+/**
+ * Function to draw the visible tiles of a tiled image. The level with about a
+ *   tile pixel per window pixel is drawn. It has to be called on the GL
+ *   thread.
+ */
+void
+tiled_draw (Tiled * tiled,      ///< Tiled struct data.
+            unsigned int window_width,  ///< Window width.
+            unsigned int window_height) ///< Window height.
+{
+  const GLfloat matrix[16] = {
+    1.f, 0.f, 0.f, 0.f,
+    0.f, 1.f, 0.f, 0.f,
+    0.f, 0.f, 1.f, 0.f,
+    0.f, 0.f, 0.f, 1.f
+  };
+  GLfloat *vertices;
+  GLintptr offset;
+  GLsizeiptr size;
+  double x0, x1, y0, y1, span;
+  unsigned int level, tx0, tx1, ty0, ty1, nx, ntiles, i, j, n, m;
+
+  ++tiled->frame;
+  tiled_upload (tiled);
+
+  // The coarsest level is always requested to draw the missing tiles
+  if (!tiled_lookup (tiled, tiled->nlevels - 1, 0, 0))
+    tiled_request (tiled, tiled->nlevels - 1, 0, 0);
+
+  // Visible tiles
+  for (level = 0; level + 1 < tiled->nlevels
+       && tiled->zoom * (1 << (level + 1)) <= 1.; ++level)
+    ;
+  x0 = MAX (0., tiled->x - 0.5 * window_width / tiled->zoom);
+  x1 = MIN (tiled->width, tiled->x + 0.5 * window_width / tiled->zoom);
+  y0 = MAX (0., tiled->y - 0.5 * window_height / tiled->zoom);
+  y1 = MIN (tiled->height, tiled->y + 0.5 * window_height / tiled->zoom);
+  if (x0 >= x1 || y0 >= y1)
+    return;
+  span = (double) tiled->tile * (1 << level);
+  tx0 = (unsigned int) (x0 / span);
+  ty0 = (unsigned int) (y0 / span);
+  tx1 = MIN ((unsigned int) (x1 / span) + 1,
+             (MAX (1, tiled->width >> level) + tiled->tile - 1) / tiled->tile);
+  ty1 = MIN ((unsigned int) (y1 / span) + 1,
+             (MAX (1, tiled->height >> level) + tiled->tile - 1)
+             / tiled->tile);
+  nx = tx1 - tx0;
+  ntiles = nx * (ty1 - ty0);
+
+  state_use_program (tiled->program->id);
+  state_uniform_matrix4fv (tiled->uniform_matrix, matrix);
+  state_uniform1i (tiled->uniform_texture, 0);
+  state_active_texture (GL_TEXTURE0);
+  state_bind_texture (tiled->texture);
+  state_attributes (STATE_ATTRIBUTE (tiled->attribute_position)
+                    | STATE_ATTRIBUTE (tiled->attribute_texture));
+  for (i = 0; i < ntiles; i += n)
+    {
+      n = MIN (ntiles - i, TILED_BATCH_TILES);
+      size = n * 6 * TILED_VERTEX;
+      vertices = (GLfloat *) ring_map (&tiled->ring, size, TILED_VERTEX,
+                                       &offset);
+      if (!vertices)
+        return;
+      for (j = m = 0; j < n; ++j)
+        m += tiled_quad (tiled, level, tx0 + (i + j) % nx, ty0 + (i + j) / nx,
+                         2. * tiled->zoom / window_width,
+                         2. * tiled->zoom / window_height,
+                         vertices + 24 * m);
+      ring_unmap (&tiled->ring, offset, size);
+      glVertexAttribPointer (tiled->attribute_position, 2, GL_FLOAT, GL_FALSE,
+                             TILED_VERTEX, (void *) offset);
+      glVertexAttribPointer (tiled->attribute_texture, 2, GL_FLOAT, GL_FALSE,
+                             TILED_VERTEX,
+                             (void *) (offset + 2 * sizeof (GLfloat)));
+      glDrawArrays (GL_TRIANGLES, 0, 6 * m);
+    }
+}
+
+/**
+ * Function to get the number of loading tiles.
+ *
+ * \return number of loading tiles.
+ */
+unsigned int
+tiled_loading (Tiled * tiled)   ///< Tiled struct data.
+{
+  return tiled->loading;
+}
+
+/**
+ * Function to get the counters of a tiled image.
+ */
+void
+tiled_stats (Tiled * tiled,     ///< Tiled struct data.
+             TiledStats * stats)        ///< TiledStats struct data.
+{
+  *stats = tiled->stats;
+  stats->resident = g_hash_table_size (tiled->table);
+}
+
+/**
+ * Function to free the memory used by a tiled image.
+ */
+void
+tiled_destroy (Tiled * tiled)   ///< Tiled struct data.
+{
+  unsigned int i;
+
+#if DEBUG
+  printf ("tiled_destroy: start\n");
+  fflush (stdout);
+#endif
+
+  // Waiting for the decoding tiles
+  if (tiled->pool)
+    g_thread_pool_free (tiled->pool, FALSE, TRUE);
+  for (i = 0; i < TILED_LOADS; ++i)
+    {
+      if (tiled->loads[i].pixels)
+        g_slice_free1 (4 * tiled->pitch * tiled->pitch,
+                       tiled->loads[i].pixels);
+      g_free (tiled->loads[i].name);
+    }
+  if (tiled->table)
+    {
+      g_hash_table_destroy (tiled->table);
+      ring_destroy (&tiled->ring);
+    }
+  if (tiled->slots)
+    g_slice_free1 (tiled->nslots * sizeof (TiledSlot), tiled->slots);
+  state_delete_textures (1, &tiled->texture);
+  shader_program_release (tiled->program);
+  g_free (tiled->dir);
+  g_slice_free1 (sizeof (Tiled), tiled);
+
+#if DEBUG
+  printf ("tiled_destroy: end\n");
+  fflush (stdout);
+#endif
+}
@@ -0,0 +1,117 @@
+#ifndef TILED__H
+#define TILED__H 1
+
+#define TILED_TILE 256          ///< Default side in pixels of the tiles.
+#define TILED_SLOTS 16          ///< Maximum side in tiles of the tile cache
+///< texture.
+#define TILED_LOADS 8           ///< Number of tiles loading at once.
+#define TILED_BATCH_TILES 1024  ///< Maximum number of tiles in a draw call.
+#define TILED_FORMAT IMAGE_FORMAT_QOI   ///< Tile file format.
+
+/**
+ * \enum TiledLoadState
+ * \brief States of a tile load buffer.
+ */
+enum TiledLoadState
+{
+  TILED_LOAD_EMPTY = 0,         ///< Free.
+  TILED_LOAD_DECODING = 1,      ///< Decoding on a worker thread.
+  TILED_LOAD_READY = 2,         ///< Decoded.
+  TILED_LOAD_FAILED = 3,        ///< Decoding failed.
+};
+
+/**
+ * \struct TiledStats
+ * \brief A struct to define the counters of a tiled image.
+ */
+typedef struct
+{
+  guint64 hits;                 ///< Visible tiles drawn from the cache.
+  guint64 misses;               ///< Visible tiles drawn from a coarser level.
+  guint64 loads;                ///< Loaded tiles.
+  guint64 evictions;            ///< Tiles removed from the cache.
+  unsigned int resident;        ///< Tiles in the cache.
+  unsigned int slots;           ///< Tile slots of the cache.
+} TiledStats;
+
+typedef struct _Tiled Tiled;
+
+/**
+ * \struct TiledSlot
+ * \brief A struct to define a slot of the tile cache texture.
+ */
+typedef struct
+{
+  guint64 key;                  ///< Tile key (level and position).
+  guint64 last_used;            ///< Frame of the last use.
+  unsigned int width;           ///< Tile width.
+  unsigned int height;          ///< Tile height.
+  unsigned int used;            ///< 1 if the slot has a tile.
+  unsigned int valid;           ///< 1 if the tile was loaded, 0 if it failed.
+} TiledSlot;
+
+/**
+ * \struct TiledLoad
+ * \brief A struct to define a buffer with a tile decoded on a worker thread.
+ */
+typedef struct
+{
+  Tiled *tiled;                 ///< Tiled struct data.
+  GLubyte *pixels;              ///< Decoded pixels.
+  char *name;                   ///< Tile file name.
+  guint64 key;                  ///< Tile key.
+  unsigned int width;           ///< Tile width.
+  unsigned int height;          ///< Tile height.
+  gint state;                   ///< Buffer state, atomic.
+} TiledLoad;
+
+/**
+ * \struct _Tiled
+ * \brief A struct to define an image cut in a pyramid of tiles. The visible
+ *   tiles are streamed in a tile cache texture. A page table maps the tiles
+ *   to their cache slots.
+ */
+struct _Tiled
+{
+  TiledLoad loads[TILED_LOADS]; ///< Tile load buffers.
+  TiledStats stats;             ///< Counters.
+  Ring ring;                    ///< Streaming buffer of the tile quads.
+  GHashTable *table;            ///< Page table, tile key to TiledSlot.
+  TiledSlot *slots;             ///< Slots of the tile cache texture.
+  GThreadPool *pool;            ///< Pool of threads decoding tiles.
+  char *dir;                    ///< Pyramid directory.
+  double x;                     ///< x coordinate in pixels of the view center.
+  double y;                     ///< y coordinate in pixels of the view center.
+  double zoom;                  ///< Window pixels per image pixel.
+  guint64 frame;                ///< Frame counter.
+  GLint attribute_position;     ///< Position variable.
+  GLint attribute_texture;      ///< Texture variable.
+  GLint uniform_texture;        ///< Texture constant.
+  GLint uniform_matrix;         ///< Projection matrix.
+  ShaderProgram *program;       ///< Shared texture program.
+  GLuint texture;               ///< Tile cache texture.
+  unsigned int width;           ///< Image width.
+  unsigned int height;          ///< Image height.
+  unsigned int tile;            ///< Side in pixels of the tiles.
+  unsigned int pitch;           ///< Side in texels of a cache slot, a tile
+  ///< with a border of duplicated edge texels.
+  unsigned int nlevels;         ///< Number of pyramid levels.
+  unsigned int side;            ///< Side in tiles of the tile cache texture.
+  unsigned int nslots;          ///< Number of tile cache slots.
+  unsigned int loading;         ///< Number of loading tiles.
+};
+
+char *tiled_tile_name (const char *dir, unsigned int level, unsigned int x,
+                       unsigned int y);
+unsigned int tiled_levels (unsigned int width, unsigned int height,
+                           unsigned int tile);
+int tiled_cut (const char *name, const char *dir, unsigned int tile);
+Tiled *tiled_new (const char *dir);
+void tiled_view (Tiled * tiled, double x, double y, double zoom);
+void tiled_draw (Tiled * tiled, unsigned int window_width,
+                 unsigned int window_height);
+unsigned int tiled_loading (Tiled * tiled);
+void tiled_stats (Tiled * tiled, TiledStats * stats);
+void tiled_destroy (Tiled * tiled);
+
+#endif